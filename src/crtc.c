@@ -32,16 +32,21 @@
 #include "omap_tvout.h"
 #include "omap_video.h"
 #include "omap.h"
+#include "perf.h"
 
 void fbdev_flip_crtcs(ScrnInfoPtr pScrn,
 		      unsigned int page_scan_next)
 {
 	FBDevPtr fPtr = FBDEVPTR(pScrn);
 	xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(pScrn);
+	unsigned int ioctls;
 	int i;
 
 	fPtr->page_scan_next = page_scan_next;
 
+	/* Flip all CRTCs in one go */
+	omap_overlay_begin();
+
 	for (i = 0; i < config->num_output; i++) {
 		xf86OutputPtr output = config->output[i];
 		xf86CrtcPtr crtc = output->crtc;
@@ -65,6 +70,11 @@ void fbdev_flip_crtcs(ScrnInfoPtr pScrn,
 				 crtc->x, crtc->y,
 				 crtc_priv->sw, crtc_priv->sh);
 	}
+
+	omap_overlay_commit(&ioctls);
+
+	PERF_INCREMENT(ovl_commits);
+	PERF_INCREMENT2(ovl_ioctls, ioctls);
 }
 
 xf86OutputPtr
@@ -378,6 +388,7 @@ crtc_set_mode_major(xf86CrtcPtr crtc,
 	enum omap_mirror ovl_mirror = OMAP_MIRROR_NONE;
 	CARD32 wss;
 	int dpms;
+	Bool clone_blit = FALSE;
 
 	buffer = fPtr->page_scan_next;
 
@@ -415,10 +426,12 @@ crtc_set_mode_major(xf86CrtcPtr crtc,
 		rotation = RR_Rotate_0;
 	}
 
+	/* The GPU scaled clone lives in the primary framebuffer */
 	if (!output_priv->xv_clone_fullscreen ||
 	    !omap_video_clone(crtc->scrn, crtc, &buffer,
 			      &sx, &sy, &sw, &sh,
-			      &aspectw, &aspecth)) {
+			      &aspectw, &aspecth, &clone_blit) ||
+	    clone_blit) {
 		if (omap_overlay_get_fb(priv->ovl) != fPtr->fb[0]) {
 			/*
 			 * Trick to make Xv<->CRTC clone switching smoother.
@@ -485,6 +498,15 @@ crtc_set_mode_major(xf86CrtcPtr crtc,
 			    &dx, &dy, &dw, &dh);
 	}
 
+	/*
+	 * The GPU already scaled the clone, so only scan out
+	 * what fits the output. DSS handles any leftover upscaling.
+	 */
+	if (clone_blit) {
+		sw = min(sw, dw);
+		sh = min(sh, dh);
+	}
+
 	priv->sw = sw;
 	priv->sh = sh;
 	priv->dx = dx;
@@ -605,6 +627,11 @@ static const xf86CrtcFuncsRec fbdev_crtc_funcs = {
 	.destroy             = crtc_destroy,
 	.set_mode_major      = crtc_set_mode_major,
 	.set_origin          = crtc_set_origin,
+	.set_cursor_colors   = fbdev_crtc_set_cursor_colors,
+	.set_cursor_position = fbdev_crtc_set_cursor_position,
+	.show_cursor         = fbdev_crtc_show_cursor,
+	.hide_cursor         = fbdev_crtc_hide_cursor,
+	.load_cursor_argb    = fbdev_crtc_load_cursor_argb,
 };
 
 xf86CrtcPtr
@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2010  Nokia Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Hardware cursor.
+ *
+ * The cursor image is kept in a small ARGB framebuffer which a spare
+ * video overlay blends on top of the screen. Moving the pointer only
+ * moves the overlay: nothing is saved, restored or damaged in the
+ * screen pixmap, and a manual update panel is only sent the area the
+ * cursor left and entered.
+ *
+ * OMAP3 can only blend ARGB on VID2, which Xv and the TV CRTC want as
+ * well. The cursor takes it when it is free and gives it back as soon
+ * as someone else asks for an overlay; the server then falls back to
+ * the software cursor.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <xf86.h>
+#include <xf86Crtc.h>
+#include <xf86Cursor.h>
+
+#include "fbdev.h"
+#include "omap.h"
+#include "perf.h"
+
+static Bool cursor_get_overlay(ScrnInfoPtr pScrn)
+{
+	struct fbdev_cursor *cursor = &FBDEVPTR(pScrn)->cursor;
+
+	if (cursor->ovl)
+		return TRUE;
+
+	cursor->ovl = fbdev_get_overlay(pScrn, FBDEV_OVERLAY_USAGE_CURSOR);
+	if (!cursor->ovl)
+		return FALSE;
+
+	if (!omap_fb_assign_overlay(cursor->fb, cursor->ovl) ||
+	    !omap_overlay_global_alpha(cursor->ovl, 255)) {
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			   "Unable to set up cursor overlay\n");
+		fbdev_put_overlay(pScrn, cursor->ovl);
+		cursor->ovl = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Sends the part of a and b which is visible to a manual update panel */
+static void cursor_flush(xf86CrtcPtr crtc, const BoxRec *a, const BoxRec *b)
+{
+	xf86OutputPtr output = fbdev_crtc_get_output(crtc);
+	struct fbdev_output *output_priv;
+	enum omap_output_update update = OMAP_OUTPUT_UPDATE_AUTO;
+	BoxRec box = *a;
+
+	if (!output)
+		return;
+
+	output_priv = output->driver_private;
+
+	omap_output_get_update_mode(output_priv->out, &update);
+	if (update != OMAP_OUTPUT_UPDATE_MANUAL)
+		return;
+
+	if (b && b->x1 < b->x2) {
+		if (box.x1 >= box.x2) {
+			box = *b;
+		} else {
+			box.x1 = min(box.x1, b->x1);
+			box.y1 = min(box.y1, b->y1);
+			box.x2 = max(box.x2, b->x2);
+			box.y2 = max(box.y2, b->y2);
+		}
+	}
+
+	if (box.x1 >= box.x2)
+		return;
+
+	omap_output_update(output_priv->out, box.x1, box.y1,
+			   box.x2 - box.x1, box.y2 - box.y1);
+}
+
+static void cursor_hide(ScrnInfoPtr pScrn)
+{
+	struct fbdev_cursor *cursor = &FBDEVPTR(pScrn)->cursor;
+	xf86CrtcPtr crtc = cursor->crtc;
+	xf86OutputPtr output;
+
+	if (!crtc)
+		return;
+
+	omap_overlay_disable(cursor->ovl);
+
+	/* Back to what the AlphaMode output property asks for */
+	output = fbdev_crtc_get_output(crtc);
+	if (output) {
+		struct fbdev_output *output_priv = output->driver_private;
+
+		omap_output_alpha_blending(output_priv->out,
+					   output_priv->alpha_mode);
+	}
+
+	cursor_flush(crtc, &cursor->box, NULL);
+
+	cursor->crtc = NULL;
+	cursor->box.x1 = cursor->box.x2 = 0;
+}
+
+/*
+ * Maps a box of the cursor, in screen orientation, to the image the
+ * server has rotated and reflected for the CRTC. This is the transform
+ * of fbdev_crtc_output_coords() with the cursor as the mode.
+ */
+static void cursor_image_box(Rotation rotation,
+			     int *x, int *y, int *w, int *h)
+{
+	const int size = FBDEV_CURSOR_SIZE;
+	int tx, ty, t;
+
+	if (rotation & RR_Reflect_X)
+		*x = size - *x - *w;
+	if (rotation & RR_Reflect_Y)
+		*y = size - *y - *h;
+
+	tx = *x;
+	ty = *y;
+
+	switch (rotation & 0xf) {
+	case RR_Rotate_90:
+		*x = ty;
+		*y = size - tx - *w;
+		break;
+	case RR_Rotate_180:
+		*x = size - tx - *w;
+		*y = size - ty - *h;
+		break;
+	case RR_Rotate_270:
+		*x = size - ty - *h;
+		*y = tx;
+		break;
+	}
+
+	if (rotation & (RR_Rotate_90 | RR_Rotate_270)) {
+		t = *w;
+		*w = *h;
+		*h = t;
+	}
+}
+
+/*
+ * Moves the overlay to the cursor position on the CRTC. The server
+ * has already rotated and reflected the image for the CRTC, so the
+ * overlay shows it as is. The visible part is cropped from the image
+ * and scaled to where it lands on the output.
+ */
+static void cursor_move(xf86CrtcPtr crtc)
+{
+	ScrnInfoPtr pScrn = crtc->scrn;
+	struct fbdev_cursor *cursor = &FBDEVPTR(pScrn)->cursor;
+	struct fbdev_crtc *crtc_priv = crtc->driver_private;
+	xf86OutputPtr output = fbdev_crtc_get_output(crtc);
+	int x = crtc_priv->cursor_x;
+	int y = crtc_priv->cursor_y;
+	int w = xf86ModeWidth(&crtc->mode, crtc->rotation);
+	int h = xf86ModeHeight(&crtc->mode, crtc->rotation);
+	int sx, sy, sw, sh;
+	unsigned int dx, dy, dw, dh;
+	BoxRec box, old = cursor->box;
+
+	/* The part of the cursor on the CRTC, in screen coordinates */
+	box.x1 = crtc->x + max(x, 0);
+	box.y1 = crtc->y + max(y, 0);
+	box.x2 = crtc->x + min(x + FBDEV_CURSOR_SIZE, w);
+	box.y2 = crtc->y + min(y + FBDEV_CURSOR_SIZE, h);
+
+	if (!output || box.x1 >= box.x2 || box.y1 >= box.y2) {
+		cursor_hide(pScrn);
+		return;
+	}
+
+	/* The same part of the cursor image */
+	sx = box.x1 - crtc->x - x;
+	sy = box.y1 - crtc->y - y;
+	sw = box.x2 - box.x1;
+	sh = box.y2 - box.y1;
+	cursor_image_box(crtc->rotation, &sx, &sy, &sw, &sh);
+
+	fbdev_crtc_output_coords(crtc, &box, &dx, &dy, &dw, &dh);
+
+	if (!omap_overlay_setup(cursor->ovl, 0,
+				sx, sy, sw, sh,
+				dx, dy, dw, dh,
+				OMAP_MIRROR_NONE, OMAP_ROTATE_0)) {
+		cursor_hide(pScrn);
+		return;
+	}
+
+	if (!omap_overlay_enabled(cursor->ovl))
+		omap_overlay_enable(cursor->ovl);
+
+	cursor->box.x1 = dx;
+	cursor->box.y1 = dy;
+	cursor->box.x2 = dx + dw;
+	cursor->box.y2 = dy + dh;
+
+	cursor_flush(crtc, &cursor->box, &old);
+
+	PERF_INCREMENT(cursor_moves);
+}
+
+void fbdev_crtc_set_cursor_colors(xf86CrtcPtr crtc, int bg, int fg)
+{
+	/* Two color cursors are converted to ARGB by the server */
+}
+
+void fbdev_crtc_set_cursor_position(xf86CrtcPtr crtc, int x, int y)
+{
+	struct fbdev_cursor *cursor = &FBDEVPTR(crtc->scrn)->cursor;
+	struct fbdev_crtc *crtc_priv = crtc->driver_private;
+
+	crtc_priv->cursor_x = x;
+	crtc_priv->cursor_y = y;
+
+	if (cursor->crtc == crtc)
+		cursor_move(crtc);
+}
+
+void fbdev_crtc_show_cursor(xf86CrtcPtr crtc)
+{
+	struct fbdev_cursor *cursor = &FBDEVPTR(crtc->scrn)->cursor;
+	xf86OutputPtr output = fbdev_crtc_get_output(crtc);
+	struct fbdev_output *output_priv;
+
+	/* There's one overlay, cloned CRTCs get the cursor in turn */
+	if (!cursor->ovl || !output ||
+	    (cursor->crtc && cursor->crtc != crtc))
+		return;
+
+	output_priv = output->driver_private;
+
+	/*
+	 * Mode sets reprogram the output, so redo this every time.
+	 * Alpha blending also puts VID2 on top of the other overlays.
+	 */
+	if (!omap_output_assign_overlay(output_priv->out, cursor->ovl) ||
+	    !omap_output_alpha_blending(output_priv->out, true)) {
+		xf86DrvMsg(crtc->scrn->scrnIndex, X_ERROR,
+			   "Unable to show cursor overlay\n");
+		return;
+	}
+
+	cursor->crtc = crtc;
+	cursor_move(crtc);
+}
+
+void fbdev_crtc_hide_cursor(xf86CrtcPtr crtc)
+{
+	struct fbdev_cursor *cursor = &FBDEVPTR(crtc->scrn)->cursor;
+
+	if (cursor->crtc == crtc)
+		cursor_hide(crtc->scrn);
+}
+
+void fbdev_crtc_load_cursor_argb(xf86CrtcPtr crtc, CARD32 *image)
+{
+	struct fbdev_cursor *cursor = &FBDEVPTR(crtc->scrn)->cursor;
+	char *dst = cursor->mem;
+	int i;
+
+	/* Called for every CRTC with the same image */
+	if (!memcmp(cursor->image, image, sizeof(cursor->image)))
+		return;
+
+	memcpy(cursor->image, image, sizeof(cursor->image));
+
+	for (i = 0; i < FBDEV_CURSOR_SIZE; i++) {
+		memcpy(dst, image, FBDEV_CURSOR_SIZE * sizeof(*image));
+		dst += cursor->pitch;
+		image += FBDEV_CURSOR_SIZE;
+	}
+}
+
+static Bool use_hw_cursor(ScreenPtr pScreen, CursorPtr pCurs)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	struct fbdev_cursor *cursor = &FBDEVPTR(pScrn)->cursor;
+
+	return cursor_get_overlay(pScrn) &&
+		cursor->UseHWCursor(pScreen, pCurs);
+}
+
+static Bool use_hw_cursor_argb(ScreenPtr pScreen, CursorPtr pCurs)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	struct fbdev_cursor *cursor = &FBDEVPTR(pScrn)->cursor;
+
+	return cursor_get_overlay(pScrn) &&
+		cursor->UseHWCursorARGB(pScreen, pCurs);
+}
+
+#if GET_ABI_MAJOR(ABI_VIDEODRV_VERSION) >= 23
+static Bool reset_cursor(ClientPtr client, void *closure)
+{
+	xf86CursorResetCursor(closure);
+
+	return TRUE;
+}
+#endif
+
+/*
+ * Gives the cursor overlay back for other use. Returns FALSE if the
+ * cursor didn't have one.
+ */
+Bool fbdev_cursor_put_overlay(ScrnInfoPtr pScrn)
+{
+	struct fbdev_cursor *cursor = &FBDEVPTR(pScrn)->cursor;
+
+	if (!cursor->ovl)
+		return FALSE;
+
+	cursor_hide(pScrn);
+
+	fbdev_put_overlay(pScrn, cursor->ovl);
+	cursor->ovl = NULL;
+
+	PERF_INCREMENT(cursor_evicted);
+
+	/*
+	 * Switch to the software cursor once the overlay has been taken.
+	 * Older servers only do that the next time the cursor changes.
+	 */
+#if GET_ABI_MAJOR(ABI_VIDEODRV_VERSION) >= 23
+	QueueWorkProc(reset_cursor, NULL, xf86ScrnToScreen(pScrn));
+#endif
+
+	return TRUE;
+}
+
+Bool fbdev_cursor_init(ScreenPtr pScreen)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	FBDevPtr fPtr = FBDEVPTR(pScrn);
+	struct fbdev_cursor *cursor = &fPtr->cursor;
+	xf86CursorInfoPtr info;
+	size_t len;
+
+	/* Xv was set up without the second port for this */
+	cursor->fb = fPtr->fb[1];
+
+	if (!omap_fb_alloc(cursor->fb, FBDEV_CURSOR_SIZE, FBDEV_CURSOR_SIZE,
+			   OMAP_FORMAT_ARGB8888, 1, 1, 1))
+		goto error;
+
+	if (!omap_fb_get_info(cursor->fb, NULL, NULL, &cursor->pitch) ||
+	    !omap_fb_map(cursor->fb, &cursor->mem, &len))
+		goto free_fb;
+
+	memset(cursor->mem, 0, len);
+
+	if (!xf86_cursors_init(pScreen,
+			       FBDEV_CURSOR_SIZE, FBDEV_CURSOR_SIZE,
+			       HARDWARE_CURSOR_TRUECOLOR_AT_8BPP |
+			       HARDWARE_CURSOR_AND_SOURCE_WITH_MASK |
+			       HARDWARE_CURSOR_SOURCE_MASK_INTERLEAVE_64 |
+			       HARDWARE_CURSOR_UPDATE_UNHIDDEN |
+			       HARDWARE_CURSOR_ARGB))
+		goto unmap;
+
+	/* Only use the hardware cursor while there's an overlay for it */
+	info = XF86_CRTC_CONFIG_PTR(pScrn)->cursor_info;
+	cursor->UseHWCursor = info->UseHWCursor;
+	info->UseHWCursor = use_hw_cursor;
+	cursor->UseHWCursorARGB = info->UseHWCursorARGB;
+	info->UseHWCursorARGB = use_hw_cursor_argb;
+
+	return TRUE;
+
+ unmap:
+	omap_fb_unmap(cursor->fb);
+ free_fb:
+	omap_fb_free(cursor->fb);
+ error:
+	cursor->fb = NULL;
+	return FALSE;
+}
+
+void fbdev_cursor_fini(ScreenPtr pScreen)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	struct fbdev_cursor *cursor = &FBDEVPTR(pScrn)->cursor;
+
+	if (!cursor->fb)
+		return;
+
+	xf86_cursors_fini(pScreen);
+
+	if (cursor->ovl) {
+		cursor_hide(pScrn);
+		fbdev_put_overlay(pScrn, cursor->ovl);
+		cursor->ovl = NULL;
+	}
+
+	omap_fb_unmap(cursor->fb);
+	omap_fb_free(cursor->fb);
+	cursor->fb = NULL;
+}
@@ -352,6 +352,29 @@ fbdev_get_overlay(ScrnInfoPtr pScrn, enum fbdev_overlay_usage usage)
 			i = 2;
 	}
 
+	/* Only VID2 can blend the ARGB cursor */
+	if (usage == FBDEV_OVERLAY_USAGE_CURSOR) {
+		if (i < 0 && !fPtr->ovl_usage[2])
+			i = 2;
+	}
+
+	/* Leave VID2 for Xv and the cursor if possible */
+	if (usage == FBDEV_OVERLAY_USAGE_DRI2) {
+		if (i < 0 && !fPtr->ovl_usage[1])
+			i = 1;
+		if (i < 0 && !fPtr->ovl_usage[2])
+			i = 2;
+	}
+
+	/*
+	 * The cursor and DRI2 swaps make do without an overlay,
+	 * everything else can't.
+	 */
+	if (i < 0 && usage != FBDEV_OVERLAY_USAGE_CURSOR &&
+	    usage != FBDEV_OVERLAY_USAGE_DRI2 &&
+	    (fbdev_cursor_put_overlay(pScrn) ||
+	     dri2_ovl_swap_put_overlay(pScrn)))
+		return fbdev_get_overlay(pScrn, usage);
 
 	if (i < 0)
 		return NULL;
@@ -361,7 +384,10 @@ fbdev_get_overlay(ScrnInfoPtr pScrn, enum fbdev_overlay_usage usage)
 	       usage == FBDEV_OVERLAY_USAGE_CRTC1 ? "CRTC1" :
 	       usage == FBDEV_OVERLAY_USAGE_XV ? "XV" :
 	       usage == FBDEV_OVERLAY_USAGE_XV1 ? "XV1" :
-	       usage == FBDEV_OVERLAY_USAGE_XV2 ? "XV2" : "Unknown reason");
+	       usage == FBDEV_OVERLAY_USAGE_XV2 ? "XV2" :
+	       usage == FBDEV_OVERLAY_USAGE_CURSOR ? "CURSOR" :
+	       usage == FBDEV_OVERLAY_USAGE_DRI2 ? "DRI2" :
+	       "Unknown reason");
 
 	fPtr->ovl_usage[i] = usage;
 	return fPtr->ovl[i];
@@ -386,7 +412,11 @@ void fbdev_put_overlay(ScrnInfoPtr pScrn, struct omap_overlay *ovl)
 		       fPtr->ovl_usage[i] == FBDEV_OVERLAY_USAGE_XV1 ?
 		       "XV1" :
 		       fPtr->ovl_usage[i] == FBDEV_OVERLAY_USAGE_XV2 ?
-		       "XV2" : "Unknown reason");
+		       "XV2" :
+		       fPtr->ovl_usage[i] == FBDEV_OVERLAY_USAGE_CURSOR ?
+		       "CURSOR" :
+		       fPtr->ovl_usage[i] == FBDEV_OVERLAY_USAGE_DRI2 ?
+		       "DRI2" : "Unknown reason");
 
 		fPtr->ovl_usage[i] = FBDEV_OVERLAY_USAGE_NONE;
 		omap_fb_assign_overlay(fPtr->fb[i], fPtr->ovl[i]);
@@ -394,6 +424,42 @@ void fbdev_put_overlay(ScrnInfoPtr pScrn, struct omap_overlay *ovl)
 	}
 }
 
+/*
+ * Reserve enough video memory for the screen in both orientations,
+ * so that RandR rotation and smaller resizes can be handled within
+ * the initial allocation (see omap_fb_resize()).
+ */
+static void reserve_fb(ScrnInfoPtr pScrn)
+{
+	FBDevPtr fPtr = FBDEVPTR(pScrn);
+	unsigned int w = pScrn->virtualX;
+	unsigned int h = pScrn->virtualY;
+	unsigned int bpp = pScrn->bitsPerPixel;
+	enum omap_format format = get_omap_format(bpp, pScrn->depth);
+	unsigned int num_bufs;
+	unsigned int size, size_rot;
+
+	num_bufs = fPtr->conf.page_flip_bufs;
+	if (fPtr->conf.video_clone_blit)
+		num_bufs += CLONE_BLIT_BUFFERS;
+	if (fPtr->conf.overlay_swap)
+		num_bufs += OVERLAY_SWAP_BUFFERS;
+
+	size = omap_fb_calc_size(w, h, format, num_bufs,
+				 buffer_alignment(),
+				 pitch_alignment(w, bpp));
+	size_rot = omap_fb_calc_size(h, w, format, num_bufs,
+				     buffer_alignment(),
+				     pitch_alignment(h, bpp));
+	size = max(size, size_rot);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Reserving %u KiB of video memory for the framebuffer\n",
+		   size >> 10);
+
+	omap_fb_reserve(fPtr->fb[0], size);
+}
+
 static Bool
 realloc_fb(ScrnInfoPtr pScrn,
 	   unsigned int width,
@@ -404,11 +470,33 @@ realloc_fb(ScrnInfoPtr pScrn,
 	FBDevPtr fPtr = FBDEVPTR(pScrn);
 	bool ret;
 	int i;
+	unsigned int num_bufs;
 	bool enabled_ovls[ARRAY_SIZE(fPtr->ovl)] = { [0] = false };
 
 	DebugF("%s(%p, %u, %u, %u, %u)\n",
 	       __func__, pScrn, width, height, bpp, depth);
 
+	num_bufs = fPtr->conf.page_flip_bufs;
+	if (fPtr->conf.video_clone_blit)
+		num_bufs += CLONE_BLIT_BUFFERS;
+	if (fPtr->conf.overlay_swap)
+		num_bufs += OVERLAY_SWAP_BUFFERS;
+
+	/*
+	 * Fast path: if the new layout fits into the current allocation
+	 * just reprogram the overlays. The memory isn't touched so the
+	 * overlays needn't be disabled and the mapping stays valid.
+	 */
+	if (fPtr->fbmem &&
+	    omap_fb_resize(fPtr->fb[0], width, height,
+			   get_omap_format(bpp, depth),
+			   num_bufs,
+			   buffer_alignment(),
+			   pitch_alignment(width, bpp))) {
+		fPtr->num_fb_bufs = num_bufs;
+		return TRUE;
+	}
+
 	if (fPtr->fbmem)
 		omap_fb_unmap(fPtr->fb[0]);
 
@@ -440,9 +528,51 @@ realloc_fb(ScrnInfoPtr pScrn,
 
 	ret = omap_fb_alloc(fPtr->fb[0], width, height,
 			    get_omap_format(bpp, depth),
-			    fPtr->conf.page_flip_bufs,
+			    num_bufs,
 			    buffer_alignment(),
 			    pitch_alignment(width, bpp));
+	if (!ret && fPtr->conf.reserve_fb) {
+		/* The reservation is optional, try without it. */
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+			   "Unable to reserve video memory for rotation, "
+			   "disabling the reservation\n");
+		fPtr->conf.reserve_fb = FALSE;
+		omap_fb_reserve(fPtr->fb[0], 0);
+
+		ret = omap_fb_alloc(fPtr->fb[0], width, height,
+				    get_omap_format(bpp, depth),
+				    num_bufs,
+				    buffer_alignment(),
+				    pitch_alignment(width, bpp));
+	}
+	if (!ret && fPtr->conf.overlay_swap) {
+		/* The overlay swap buffers are optional, try without them. */
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+			   "Not enough video memory for DRI2 overlay swaps, "
+			   "disabling them\n");
+		fPtr->conf.overlay_swap = FALSE;
+		num_bufs -= OVERLAY_SWAP_BUFFERS;
+
+		ret = omap_fb_alloc(fPtr->fb[0], width, height,
+				    get_omap_format(bpp, depth),
+				    num_bufs,
+				    buffer_alignment(),
+				    pitch_alignment(width, bpp));
+	}
+	if (!ret && num_bufs != fPtr->conf.page_flip_bufs) {
+		/* The clone buffers are optional, try without them. */
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+			   "Not enough video memory for GPU scaled Xv clone, "
+			   "disabling it\n");
+		fPtr->conf.video_clone_blit = FALSE;
+		num_bufs = fPtr->conf.page_flip_bufs;
+
+		ret = omap_fb_alloc(fPtr->fb[0], width, height,
+				    get_omap_format(bpp, depth),
+				    num_bufs,
+				    buffer_alignment(),
+				    pitch_alignment(width, bpp));
+	}
 	if (!ret) {
 		if (fPtr->fbmem) {
 			/* remap the original framebuffer configuration */
@@ -467,6 +597,8 @@ realloc_fb(ScrnInfoPtr pScrn,
 	if (!omap_fb_map(fPtr->fb[0], &fPtr->fbmem, &fPtr->fbmem_len))
 		FatalError("Unable to map framebuffer\n");
 
+	fPtr->num_fb_bufs = num_bufs;
+
 	/* Restore enabled overlays */
 	for (i = 0; i < ARRAY_SIZE(fPtr->ovl); i++) {
 		if (!enabled_ovls[i])
@@ -593,6 +725,83 @@ static const OptionInfoRec FBDevOptions[] = {
 		.value = { 0 },
 		.found = FALSE
 	},
+	{
+		.token = OPTION_VIDEO_COPY_THREADS,
+		.name = "VideoCopyThreads",
+		.type = OPTV_INTEGER,
+		.value = { 0 },
+		.found = FALSE
+	},
+	{
+		.token = OPTION_VIDEO_CLONE_BLIT,
+		.name = "VideoCloneBlit",
+		.type = OPTV_BOOLEAN,
+		.value = { 0 },
+		.found = FALSE
+	},
+	{
+		.token = OPTION_RESERVE_FB,
+		.name = "ReserveFramebuffer",
+		.type = OPTV_BOOLEAN,
+		.value = { 0 },
+		.found = FALSE
+	},
+	{
+		.token = OPTION_ACCEL_COMPOSITE,
+		.name = "AccelComposite",
+		.type = OPTV_BOOLEAN,
+		.value = { 0 },
+		.found = FALSE
+	},
+	{
+		.token = OPTION_ASYNC_WAIT,
+		.name = "AsyncWait",
+		.type = OPTV_BOOLEAN,
+		.value = { 0 },
+		.found = FALSE
+	},
+	{
+		.token = OPTION_PIXMAP_SLABS,
+		.name = "PixmapSlabs",
+		.type = OPTV_BOOLEAN,
+		.value = { 0 },
+		.found = FALSE
+	},
+	{
+		.token = OPTION_PROMOTE_PIXMAPS,
+		.name = "PromotePixmaps",
+		.type = OPTV_BOOLEAN,
+		.value = { 0 },
+		.found = FALSE
+	},
+	{
+		.token = OPTION_LOCKED_MEMORY,
+		.name = "LockedMemory",
+		.type = OPTV_INTEGER,
+		.value = { 0 },
+		.found = FALSE
+	},
+	{
+		.token = OPTION_HUGE_PAGES,
+		.name = "HugePages",
+		.type = OPTV_BOOLEAN,
+		.value = { 0 },
+		.found = FALSE
+	},
+	{
+		.token = OPTION_HW_CURSOR,
+		.name = "HWCursor",
+		.type = OPTV_BOOLEAN,
+		.value = { 0 },
+		.found = FALSE
+	},
+	{
+		.token = OPTION_OVERLAY_SWAP,
+		.name = "OverlaySwap",
+		.type = OPTV_BOOLEAN,
+		.value = { 0 },
+		.found = FALSE
+	},
 	{
 		.token = -1,
 		.name = NULL,
@@ -655,6 +864,7 @@ static void FBDevFreeRec(ScrnInfoPtr pScrn)
 {
 	if (pScrn->driverPrivate == NULL)
 		return;
+	free(FBDEVPTR(pScrn)->pvr2d);
 	free(pScrn->driverPrivate);
 	pScrn->driverPrivate = NULL;
 }
@@ -829,6 +1039,153 @@ static void FBDevInitConf(ScrnInfoPtr pScrn)
 
 	xf86DrvMsg(pScrn->scrnIndex, from, "%s poisoning in SwapBuffers\n",
 		   fPtr->conf.poison_swapbuffers ? "Enabling" : "Disabling");
+
+	/* VideoCopyThreads */
+
+	from = X_DEFAULT;
+	fPtr->conf.video_copy_threads = 0;
+
+	if (xf86GetOptValInteger(fPtr->Options,
+				 OPTION_VIDEO_COPY_THREADS, &i)) {
+		if (i < 0 || i > MAX_VIDEO_COPY_THREADS) {
+			xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+				   "%d is not a valid VideoCopyThreads value\n",
+				   i);
+		} else {
+			from = X_CONFIG;
+			fPtr->conf.video_copy_threads = i;
+		}
+	}
+
+	xf86DrvMsg(pScrn->scrnIndex, from, "Using %d video copy threads\n",
+		   fPtr->conf.video_copy_threads);
+
+	/* VideoCloneBlit */
+
+	from = X_DEFAULT;
+	fPtr->conf.video_clone_blit = FALSE;
+
+	if (xf86GetOptValBool(fPtr->Options, OPTION_VIDEO_CLONE_BLIT,
+			      &fPtr->conf.video_clone_blit))
+		from = X_CONFIG;
+
+	xf86DrvMsg(pScrn->scrnIndex, from, "%s GPU scaled Xv clone\n",
+		   fPtr->conf.video_clone_blit ? "Enabling" : "Disabling");
+
+	/* ReserveFramebuffer */
+
+	from = X_DEFAULT;
+	fPtr->conf.reserve_fb = TRUE;
+
+	if (xf86GetOptValBool(fPtr->Options, OPTION_RESERVE_FB,
+			      &fPtr->conf.reserve_fb))
+		from = X_CONFIG;
+
+	xf86DrvMsg(pScrn->scrnIndex, from,
+		   "%s framebuffer memory reservation\n",
+		   fPtr->conf.reserve_fb ? "Enabling" : "Disabling");
+
+	/* AccelComposite */
+
+	from = X_DEFAULT;
+	fPtr->conf.accel_composite = FALSE;
+
+	if (xf86GetOptValBool(fPtr->Options, OPTION_ACCEL_COMPOSITE,
+			      &fPtr->conf.accel_composite))
+		from = X_CONFIG;
+
+	xf86DrvMsg(pScrn->scrnIndex, from, "%s RENDER acceleration\n",
+		   fPtr->conf.accel_composite ? "Enabling" : "Disabling");
+
+	from = X_DEFAULT;
+	fPtr->conf.async_wait = FALSE;
+
+	if (xf86GetOptValBool(fPtr->Options, OPTION_ASYNC_WAIT,
+			      &fPtr->conf.async_wait))
+		from = X_CONFIG;
+
+	xf86DrvMsg(pScrn->scrnIndex, from, "%s asynchronous GPU waits\n",
+		   fPtr->conf.async_wait ? "Enabling" : "Disabling");
+
+	from = X_DEFAULT;
+	fPtr->conf.pixmap_slabs = TRUE;
+
+	if (xf86GetOptValBool(fPtr->Options, OPTION_PIXMAP_SLABS,
+			      &fPtr->conf.pixmap_slabs))
+		from = X_CONFIG;
+
+	xf86DrvMsg(pScrn->scrnIndex, from, "%s pixmap slabs\n",
+		   fPtr->conf.pixmap_slabs ? "Enabling" : "Disabling");
+
+	from = X_DEFAULT;
+	fPtr->conf.promote_pixmaps = TRUE;
+
+	if (xf86GetOptValBool(fPtr->Options, OPTION_PROMOTE_PIXMAPS,
+			      &fPtr->conf.promote_pixmaps))
+		from = X_CONFIG;
+
+	xf86DrvMsg(pScrn->scrnIndex, from, "%s pixmap promotion\n",
+		   fPtr->conf.promote_pixmaps ? "Enabling" : "Disabling");
+
+	/* LockedMemory */
+
+	from = X_DEFAULT;
+	fPtr->conf.locked_memory = 0;
+
+	if (xf86GetOptValInteger(fPtr->Options, OPTION_LOCKED_MEMORY, &i)) {
+		if (i < 0) {
+			xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+				   "%d is not a valid LockedMemory value\n",
+				   i);
+		} else {
+			from = X_CONFIG;
+			fPtr->conf.locked_memory = i;
+		}
+	}
+
+	if (fPtr->conf.locked_memory)
+		xf86DrvMsg(pScrn->scrnIndex, from,
+			   "Locking at most %d MiB of pixmap memory\n",
+			   fPtr->conf.locked_memory);
+	else
+		xf86DrvMsg(pScrn->scrnIndex, from,
+			   "Not limiting locked pixmap memory\n");
+
+	/* HugePages */
+
+	from = X_DEFAULT;
+	fPtr->conf.huge_pages = FALSE;
+
+	if (xf86GetOptValBool(fPtr->Options, OPTION_HUGE_PAGES,
+			      &fPtr->conf.huge_pages))
+		from = X_CONFIG;
+
+	xf86DrvMsg(pScrn->scrnIndex, from, "%s huge page pixmaps\n",
+		   fPtr->conf.huge_pages ? "Enabling" : "Disabling");
+
+	/* HWCursor */
+
+	from = X_DEFAULT;
+	fPtr->conf.hw_cursor = FALSE;
+
+	if (xf86GetOptValBool(fPtr->Options, OPTION_HW_CURSOR,
+			      &fPtr->conf.hw_cursor))
+		from = X_CONFIG;
+
+	xf86DrvMsg(pScrn->scrnIndex, from, "%s hardware cursor\n",
+		   fPtr->conf.hw_cursor ? "Enabling" : "Disabling");
+
+	/* OverlaySwap */
+
+	from = X_DEFAULT;
+	fPtr->conf.overlay_swap = FALSE;
+
+	if (xf86GetOptValBool(fPtr->Options, OPTION_OVERLAY_SWAP,
+			      &fPtr->conf.overlay_swap))
+		from = X_CONFIG;
+
+	xf86DrvMsg(pScrn->scrnIndex, from, "%s DRI2 overlay swaps\n",
+		   fPtr->conf.overlay_swap ? "Enabling" : "Disabling");
 }
 
 static Bool FBDevPreInit(ScrnInfoPtr pScrn, int flags)
@@ -967,6 +1324,9 @@ static Bool FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 		"\tvirtualX=%d, virtualY=%d\n",
 		pScrn->virtualX, pScrn->virtualY);
 
+	if (fPtr->conf.reserve_fb)
+		reserve_fb(pScrn);
+
 	if (!realloc_fb(pScrn, pScrn->virtualX, pScrn->virtualY,
 			pScrn->bitsPerPixel, pScrn->depth)) {
 		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
@@ -1027,16 +1387,24 @@ static Bool FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 	if (USE_SGX)
 		EXA_Init(pScreen);
 
-	fbdev_init_video(pScreen, 2, fPtr->fb[2], fPtr->fb[1]);
+	/* The hardware cursor gets the second Xv framebuffer */
+	if (fPtr->conf.hw_cursor)
+		fbdev_init_video(pScreen, 1, fPtr->fb[2]);
+	else
+		fbdev_init_video(pScreen, 2, fPtr->fb[2], fPtr->fb[1]);
 
 	xf86SetBlackWhitePixels(pScreen);
 	xf86SetBackingStore(pScreen);
 
 	pScrn->vtSema = TRUE;
 
-	/* software cursor */
+	/* software cursor, also the fallback for the hardware one */
 	miDCInitialize(pScreen, xf86GetPointerScreenFuncs());
 
+	if (fPtr->conf.hw_cursor && !fbdev_cursor_init(pScreen))
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+			   "Hardware cursor initialization failed\n");
+
 	if (!xf86SetDesiredModes(pScrn))
 		return FALSE;
 
@@ -1139,6 +1507,8 @@ static Bool FBDevCloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	FBDevPtr fPtr = FBDEVPTR(pScrn);
 
+	fbdev_cursor_fini(pScreen);
+
 	ExtFBCloseScreen(pScreen);
 
 	PVR2DCloseScreen(pScreen);
@@ -44,6 +44,8 @@
 
 #include "omap.h"
 
+struct pvr2d_screen;
+
 #define PVRSGX_VERSION          4000
 #define PVRSGX_NAME             "PVRSGX"
 #define PVRSGX_DRIVER_NAME      "pvrsgx"
@@ -73,6 +75,17 @@ enum {
 	OPTION_CAN_CHANGE_SCREEN_SIZE,
 	OPTION_POISON_GETBUFFERS,
 	OPTION_POISON_SWAPBUFFERS,
+	OPTION_VIDEO_COPY_THREADS,
+	OPTION_VIDEO_CLONE_BLIT,
+	OPTION_RESERVE_FB,
+	OPTION_ACCEL_COMPOSITE,
+	OPTION_ASYNC_WAIT,
+	OPTION_PIXMAP_SLABS,
+	OPTION_PROMOTE_PIXMAPS,
+	OPTION_LOCKED_MEMORY,
+	OPTION_HUGE_PAGES,
+	OPTION_HW_CURSOR,
+	OPTION_OVERLAY_SWAP,
 };
 
 enum fbdev_overlay_usage {
@@ -82,6 +95,8 @@ enum fbdev_overlay_usage {
 	FBDEV_OVERLAY_USAGE_XV, /* any */
 	FBDEV_OVERLAY_USAGE_XV1, /* VID1 */
 	FBDEV_OVERLAY_USAGE_XV2, /* VID2 */
+	FBDEV_OVERLAY_USAGE_CURSOR,
+	FBDEV_OVERLAY_USAGE_DRI2,
 };
 
 struct fbdev_crtc {
@@ -89,6 +104,26 @@ struct fbdev_crtc {
 	struct omap_overlay *ovl;
 	unsigned int sw, sh, dx, dy, dw, dh;
 	int dpms;
+	/* cursor position relative to the CRTC */
+	int cursor_x, cursor_y;
+};
+
+#define FBDEV_CURSOR_SIZE 64
+
+/* see cursor.c */
+struct fbdev_cursor {
+	/* NULL if the hardware cursor is not in use */
+	struct omap_fb *fb;
+	void *mem;
+	unsigned int pitch;
+	CARD32 image[FBDEV_CURSOR_SIZE * FBDEV_CURSOR_SIZE];
+	/* NULL while the software cursor is used */
+	struct omap_overlay *ovl;
+	/* the CRTC showing the cursor and where on its output */
+	xf86CrtcPtr crtc;
+	BoxRec box;
+	Bool (*UseHWCursor)(ScreenPtr pScreen, CursorPtr pCurs);
+	Bool (*UseHWCursorARGB)(ScreenPtr pScreen, CursorPtr pCurs);
 };
 
 enum fbdev_output_type {
@@ -117,6 +152,8 @@ struct fbdev_output {
 typedef struct {
 	void *fbmem;
 	size_t fbmem_len;
+	/* page flip buffers + GPU clone buffers */
+	unsigned num_fb_bufs;
 	unsigned page_scan_next;
 	CreateScreenResourcesProcPtr CreateScreenResources;
 	CloseScreenProcPtr CloseScreen;
@@ -129,6 +166,7 @@ typedef struct {
 	XF86VideoAdaptorPtr overlay_adaptor;
 	DestroyWindowProcPtr video_destroy_window;
 	DestroyPixmapProcPtr video_destroy_pixmap;
+	struct omap_copy_pool *copy_pool;
 
 	xf86CrtcPtr crtc_lcd;
 	xf86CrtcPtr crtc_tv;
@@ -144,6 +182,9 @@ typedef struct {
 
 	PixmapPtr pixmap;
 
+	/* SGX/PVR2D state */
+	struct pvr2d_screen *pvr2d;
+
 	struct {
 		Bool update_lock;
 		DamagePtr damage;
@@ -156,6 +197,8 @@ typedef struct {
 	/* flip statistics */
 	OsTimerPtr flip_stats_timer;
 
+	struct fbdev_cursor cursor;
+
 	struct {
 		unsigned int swap_control;
 		Bool render_sync;
@@ -164,6 +207,17 @@ typedef struct {
 		Bool can_change_screen_size;
 		Bool poison_getbuffers;
 		Bool poison_swapbuffers;
+		int video_copy_threads;
+		Bool video_clone_blit;
+		Bool reserve_fb;
+		Bool accel_composite;
+		Bool async_wait;
+		Bool pixmap_slabs;
+		Bool promote_pixmaps;
+		int locked_memory;
+		Bool huge_pages;
+		Bool hw_cursor;
+		Bool overlay_swap;
 	} conf;
 } FBDevRec, *FBDevPtr;
 
@@ -193,6 +247,8 @@ do { \
 #define VIDEO_IMAGE_MAX_WIDTH 2048
 #define VIDEO_IMAGE_MAX_HEIGHT 2048
 
+#define MAX_VIDEO_COPY_THREADS 4
+
 xf86CrtcPtr fbdev_crtc_create(ScrnInfoPtr pScrn,
 			      enum fbdev_overlay_usage usage);
 xf86OutputPtr fbdev_output_create(ScrnInfoPtr pScrn,
@@ -205,6 +261,15 @@ struct omap_overlay *fbdev_get_overlay(ScrnInfoPtr pScrn,
 				       enum fbdev_overlay_usage usage);
 void fbdev_put_overlay(ScrnInfoPtr pScrn, struct omap_overlay *ovl);
 
+Bool fbdev_cursor_init(ScreenPtr pScreen);
+void fbdev_cursor_fini(ScreenPtr pScreen);
+Bool fbdev_cursor_put_overlay(ScrnInfoPtr pScrn);
+void fbdev_crtc_set_cursor_colors(xf86CrtcPtr crtc, int bg, int fg);
+void fbdev_crtc_set_cursor_position(xf86CrtcPtr crtc, int x, int y);
+void fbdev_crtc_show_cursor(xf86CrtcPtr crtc);
+void fbdev_crtc_hide_cursor(xf86CrtcPtr crtc);
+void fbdev_crtc_load_cursor_argb(xf86CrtcPtr crtc, CARD32 *image);
+
 xf86OutputPtr fbdev_crtc_get_output(xf86CrtcPtr crtc);
 
 void fbdev_flip_crtcs(ScrnInfoPtr pScrn, unsigned int page_scan_next);
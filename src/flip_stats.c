@@ -88,7 +88,8 @@ static CARD32 statsCallback(OsTimerPtr timer, CARD32 time, pointer arg)
 		   "swaps killed before render done  : %u\n"
 		   "swaps killed before flip issued  : %u\n"
 		   "swaps killed before flip done    : %u\n"
-		   "blits while fullscreen           : %u\n",
+		   "blits while fullscreen           : %u\n"
+		   "display updates after flips      : %u\n",
 		   flip_stats.swaps_requested,
 		   flip_stats.swaps_completed_dead +
 		   flip_stats.swaps_completed_from_swap_request +
@@ -118,7 +119,8 @@ static CARD32 statsCallback(OsTimerPtr timer, CARD32 time, pointer arg)
 		   flip_stats.swaps_killed_before_render_done,
 		   flip_stats.swaps_killed_before_flip_issued,
 		   flip_stats.swaps_killed_before_flip_done,
-		   flip_stats.blits_while_fullscreen);
+		   flip_stats.blits_while_fullscreen,
+		   flip_stats.display_updates);
 
 	if (reset)
 		memset(&flip_stats, 0, sizeof flip_stats);
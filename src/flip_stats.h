@@ -46,6 +46,7 @@ struct flip_stats {
 	unsigned int swaps_killed_before_flip_issued;
 	unsigned int swaps_killed_before_flip_done;
 	unsigned int blits_while_fullscreen;
+	unsigned int display_updates;
 };
 
 extern struct flip_stats flip_stats;
@@ -109,6 +110,11 @@ static inline void flip_stats_blit_while_fullscreen(void)
 	flip_stats.blits_while_fullscreen++;
 }
 
+static inline void flip_stats_display_update(void)
+{
+	flip_stats.display_updates++;
+}
+
 Bool flip_stats_init(ScreenPtr pScreen);
 void flip_stats_fini(ScreenPtr pScreen);
 
@@ -127,6 +133,7 @@ static inline void flip_stats_render_completed_dead(void) {}
 static inline void flip_stats_render_completed(struct dri2_swap_request *req) {}
 static inline void flip_stats_swap_killed(struct dri2_swap_request *req) {}
 static inline void flip_stats_blit_while_fullscreen(void) {}
+static inline void flip_stats_display_update(void) {}
 static inline Bool flip_stats_init(ScreenPtr pScreen) { return FALSE; }
 static inline void flip_stats_fini(ScreenPtr pScreen) {}
 
@@ -68,6 +68,13 @@ struct omap_fb {
 	/* memory alloc info */
 	struct omapfb_mem_info mem_info;
 
+	/* bytes covered by the current layout */
+	unsigned int used;
+	/* omap_fb_alloc() never allocates less than this */
+	unsigned int reserved;
+	unsigned long num_resizes;
+	unsigned long num_reallocs;
+
 	/* overlays scanning out of this fb */
 	struct omap_overlay *ovls[3];
 };
@@ -103,6 +110,15 @@ struct omap_overlay {
 	unsigned int global_alpha;
 	enum omap_mirror mirror;
 	bool enabled;
+
+	/* state staged by omap_overlay_begin() */
+	bool staged;
+	bool staged_setup;
+	unsigned int staged_buffer;
+	unsigned int staged_sx, staged_sy, staged_sw, staged_sh;
+	unsigned int staged_dx, staged_dy, staged_dw, staged_dh;
+	enum omap_mirror staged_mirror;
+	enum omap_rotate staged_rotate;
 };
 
 struct omap_output {
@@ -131,6 +147,8 @@ struct omap_output {
 	uint32_t wss;
 };
 
+static bool overlay_flush(struct omap_overlay *ovl);
+
 static void func_printf(const char *func,
 			const char *fmt, ...)
 {
@@ -539,6 +557,9 @@ static bool overlay_update(struct omap_overlay *ovl,
 
 	dprintf(" ovl = %s\n", ovl->name);
 
+	if (!overlay_flush(ovl))
+		goto error;
+
 	/*
 	 * memory reallocation may have forced changes upon var,
 	 * read it from the device instad of trusting the cached data.
@@ -715,6 +736,7 @@ bool omap_fb_free(struct omap_fb *fb)
 	}
 
 	fb->mem_info = mem_info;
+	fb->used = 0;
 	fb->w = 0;
 	fb->h = 0;
 	fb->format = 0;
@@ -809,6 +831,37 @@ static void align_for_format(enum omap_format format,
 	*w = (*pitch << 3) / bpp;
 }
 
+/*
+ * Adjust w and h to the layout the buffers will actually have
+ * in memory and return the total size needed for num_buffers.
+ */
+static unsigned int fb_layout(unsigned int *w,
+			      unsigned int *h,
+			      enum omap_format format,
+			      unsigned int num_buffers,
+			      unsigned int buffer_align,
+			      unsigned int pitch_align)
+{
+	unsigned int pitch;
+
+	adjust_fb_size(w, h);
+
+	align_for_format(format, pitch_align, w, &pitch);
+
+	/* No need to align when there's only one buffer */
+	if (num_buffers == 1)
+		buffer_align = 1;
+
+	/*
+	 * Modify h so that the buffer boundary
+	 * is aligned to buffer_align bytes.
+	 */
+	buffer_align = lcm(pitch, buffer_align);
+	*h = div_round_up(pitch * *h, buffer_align) * buffer_align / pitch;
+
+	return pitch * *h * num_buffers;
+}
+
 bool omap_fb_alloc(struct omap_fb *fb,
 		   unsigned int w,
 		   unsigned int h,
@@ -820,7 +873,7 @@ bool omap_fb_alloc(struct omap_fb *fb,
 	struct omap_overlay *ovl;
 	int r;
 	struct omapfb_mem_info mem_info;
-	unsigned int pitch;
+	unsigned int size;
 
 	ENTER();
 
@@ -842,22 +895,10 @@ bool omap_fb_alloc(struct omap_fb *fb,
 
 	mem_info = fb->mem_info;
 
-	adjust_fb_size(&w, &h);
-
-	align_for_format(format, pitch_align, &w, &pitch);
-
-	/* No need to align when there's only one buffer */
-	if (num_buffers == 1)
-		buffer_align = 1;
-
-	/*
-	 * Modify h so that the buffer boundary
-	 * is aligned to buffer_align bytes.
-	 */
-	buffer_align = lcm(pitch, buffer_align);
-	h = div_round_up(pitch * h, buffer_align) * buffer_align / pitch;
+	size = fb_layout(&w, &h, format, num_buffers,
+			 buffer_align, pitch_align);
 
-	mem_info.size = pitch * h * num_buffers;
+	mem_info.size = size > fb->reserved ? size : fb->reserved;
 
 	/* Skip SETUP_MEM if the size already matches */
 	if (memcmp(&mem_info, &fb->mem_info, sizeof mem_info)) {
@@ -870,12 +911,15 @@ bool omap_fb_alloc(struct omap_fb *fb,
 			eprintf_mi("failed", &mem_info);
 			goto error;
 		}
+
+		fb->num_reallocs++;
 	}
 
 	if (!fb_update_overlays(fb, w, h, num_buffers, format))
 		goto error_realloc;
 
 	fb->mem_info = mem_info;
+	fb->used = size;
 	fb->w = w;
 	fb->h = h;
 	fb->format = format;
@@ -891,6 +935,67 @@ bool omap_fb_alloc(struct omap_fb *fb,
 	return false;
 }
 
+bool omap_fb_resize(struct omap_fb *fb,
+		    unsigned int w,
+		    unsigned int h,
+		    enum omap_format format,
+		    unsigned int num_buffers,
+		    unsigned int buffer_align,
+		    unsigned int pitch_align)
+{
+	unsigned int size;
+
+	ENTER();
+
+	assert(fb != NULL);
+	assert(w != 0);
+	assert(h != 0);
+	assert(num_buffers != 0);
+	assert(buffer_align != 0);
+	assert(pitch_align != 0);
+
+	dprintf(" fb = %s\n", fb->name);
+
+	size = fb_layout(&w, &h, format, num_buffers,
+			 buffer_align, pitch_align);
+
+	/*
+	 * Not an error, the caller has to do a full omap_fb_alloc().
+	 * That's also needed when the reservation hasn't been
+	 * allocated yet.
+	 */
+	if (size > fb->mem_info.size ||
+	    fb->reserved > fb->mem_info.size) {
+		LEAVE();
+		return false;
+	}
+
+	if (fb->w == w && fb->h == h &&
+	    fb->format == format && fb->num_buffers == num_buffers) {
+		LEAVE();
+		return true;
+	}
+
+	if (!fb_update_overlays(fb, w, h, num_buffers, format))
+		goto error;
+
+	fb->used = size;
+	fb->w = w;
+	fb->h = h;
+	fb->format = format;
+	fb->num_buffers = num_buffers;
+	fb->num_resizes++;
+
+	LEAVE();
+	return true;
+
+ error:
+	/* Try to get the old layout back */
+	fb_update_overlays(fb, fb->w, fb->h, fb->num_buffers, fb->format);
+	ERROR();
+	return false;
+}
+
 bool omap_fb_check_size(struct omap_fb *fb,
 			unsigned int w,
 			unsigned int h,
@@ -921,12 +1026,48 @@ bool omap_fb_check_size(struct omap_fb *fb,
 
 	/* No need to align when there's only one buffer */
 	if (num_buffers != 1 &&
-	    fb->mem_info.size / num_buffers % buffer_align)
+	    fb->used / num_buffers % buffer_align)
 		return false;
 
 	return true;
 }
 
+unsigned int omap_fb_calc_size(unsigned int w,
+			       unsigned int h,
+			       enum omap_format format,
+			       unsigned int num_buffers,
+			       unsigned int buffer_align,
+			       unsigned int pitch_align)
+{
+	assert(w != 0);
+	assert(h != 0);
+	assert(num_buffers != 0);
+	assert(buffer_align != 0);
+	assert(pitch_align != 0);
+
+	return fb_layout(&w, &h, format, num_buffers,
+			 buffer_align, pitch_align);
+}
+
+void omap_fb_reserve(struct omap_fb *fb, unsigned int size)
+{
+	assert(fb != NULL);
+
+	fb->reserved = size;
+}
+
+void omap_fb_get_stats(const struct omap_fb *fb,
+		       struct omap_fb_stats *stats)
+{
+	assert(fb != NULL);
+
+	stats->size = fb->mem_info.size;
+	stats->used = fb->used;
+	stats->reserved = fb->reserved;
+	stats->resizes = fb->num_resizes;
+	stats->reallocs = fb->num_reallocs;
+}
+
 static bool var_to_format(const struct fb_var_screeninfo *var,
 			  enum omap_format *ret_format)
 {
@@ -1188,6 +1329,10 @@ bool omap_fb_assign_overlay(struct omap_fb *fb,
 	dprintf(" fb = %s\n", fb->name);
 	dprintf(" ovl = %s\n", ovl->name);
 
+	/* Don't leave staged state behind for the old association */
+	if (!overlay_flush(ovl))
+		goto error;
+
 	if (ovl->fb != NULL) {
 		if (ovl->fb != fb) {
 			struct omap_fb *old_fb = ovl->fb;
@@ -1254,6 +1399,10 @@ bool omap_output_assign_overlay(struct omap_output *out,
 	dprintf(" out = %s\n", out->name);
 	dprintf(" ovl = %s\n", ovl->name);
 
+	/* Don't leave staged state behind for the old association */
+	if (!overlay_flush(ovl))
+		goto error;
+
 	if (ovl->out != NULL) {
 		if (ovl->out != out) {
 			struct omap_output *old_out = ovl->out;
@@ -1536,7 +1685,30 @@ void omap_fb_unmap(struct omap_fb *fb)
 	LEAVE();
 }
 
-bool omap_overlay_pan(struct omap_overlay *ovl,
+/*
+ * Overlay state changes can be staged between omap_overlay_begin()
+ * and omap_overlay_commit(). Repeated setups and pans of the same
+ * overlay collapse into one, and the commit then only issues the
+ * ioctls needed to go from the cached state to the final one.
+ */
+static struct {
+	bool active;
+	struct omap_overlay *ovls[3];
+	int num_ovls;
+} transaction;
+
+/* overlay state ioctls issued so far */
+static unsigned int ovl_ioctl_count;
+
+static int ovl_ioctl(struct omap_overlay *ovl, unsigned long request,
+		     void *arg)
+{
+	ovl_ioctl_count++;
+
+	return ioctl(ovl->fd, request, arg);
+}
+
+static bool overlay_pan(struct omap_overlay *ovl,
 			unsigned int buffer,
 			unsigned int sx, unsigned int sy,
 			unsigned int sw, unsigned int sh)
@@ -1573,7 +1745,7 @@ bool omap_overlay_pan(struct omap_overlay *ovl,
 	var.activate = FB_ACTIVATE_NOW;
 
 	dprintf_var("panning", &var);
-	r = ioctl(ovl->fd, FBIOPAN_DISPLAY, &var);
+	r = ovl_ioctl(ovl, FBIOPAN_DISPLAY, &var);
 
 	if (r) {
 		eprintf("ioctl(FBIOPAN_DISPLAY) failed %d:%s\n",
@@ -1601,19 +1773,19 @@ bool omap_overlay_pan(struct omap_overlay *ovl,
 	return true;
 
  error_pan:
-	ioctl(ovl->fd, FBIOPUT_VSCREENINFO, &ovl->var);
+	ovl_ioctl(ovl, FBIOPUT_VSCREENINFO, &ovl->var);
 	ERROR();
 	return false;
 }
 
-bool omap_overlay_setup(struct omap_overlay *ovl,
-			unsigned int buffer,
-			unsigned int sx, unsigned int sy,
-			unsigned int sw, unsigned int sh,
-			unsigned int dx, unsigned int dy,
-			unsigned int dw, unsigned int dh,
-			enum omap_mirror mirror,
-			enum omap_rotate rotate)
+static bool overlay_setup(struct omap_overlay *ovl,
+			  unsigned int buffer,
+			  unsigned int sx, unsigned int sy,
+			  unsigned int sw, unsigned int sh,
+			  unsigned int dx, unsigned int dy,
+			  unsigned int dw, unsigned int dh,
+			  enum omap_mirror mirror,
+			  enum omap_rotate rotate)
 {
 	struct omap_fb *fb;
 	int r = 0;
@@ -1689,7 +1861,7 @@ bool omap_overlay_setup(struct omap_overlay *ovl,
 
 		if (memcmp(&plane_info, &ovl->plane_info, sizeof plane_info)) {
 			dprintf_pi("setup", &plane_info);
-			r = ioctl(ovl->fd, OMAPFB_SETUP_PLANE, &plane_info);
+			r = ovl_ioctl(ovl, OMAPFB_SETUP_PLANE, &plane_info);
 		}
 		if (r) {
 			eprintf("ioctl(OMAPFB_SETUP_PLANE) failed %d:%s\n",
@@ -1699,10 +1871,10 @@ bool omap_overlay_setup(struct omap_overlay *ovl,
 		}
 
 		dprintf_var("putting", &var);
-		r = ioctl(ovl->fd, FBIOPUT_VSCREENINFO, &var);
+		r = ovl_ioctl(ovl, FBIOPUT_VSCREENINFO, &var);
 	} else if (pan_display) {
 		dprintf_var("panning", &var);
-		r = ioctl(ovl->fd, FBIOPAN_DISPLAY, &var);
+		r = ovl_ioctl(ovl, FBIOPAN_DISPLAY, &var);
 	} else {
 		dprintf_var("unchanged", &var);
 	}
@@ -1729,7 +1901,7 @@ bool omap_overlay_setup(struct omap_overlay *ovl,
 
 	if (memcmp(&plane_info, &ovl->plane_info, sizeof plane_info)) {
 		dprintf_pi("setup", &plane_info);
-		r = ioctl(ovl->fd, OMAPFB_SETUP_PLANE, &plane_info);
+		r = ovl_ioctl(ovl, OMAPFB_SETUP_PLANE, &plane_info);
 	}
 	if (r) {
 		eprintf("ioctl(OMAPFB_SETUP_PLANE) failed %d:%s\n",
@@ -1767,17 +1939,141 @@ bool omap_overlay_setup(struct omap_overlay *ovl,
 
 #if 1
  error_setup_plane:
-	ioctl(ovl->fd, OMAPFB_SETUP_PLANE, &ovl->plane_info);
+	ovl_ioctl(ovl, OMAPFB_SETUP_PLANE, &ovl->plane_info);
 #endif
  error_putv:
-	ioctl(ovl->fd, FBIOPUT_VSCREENINFO, &ovl->var);
+	ovl_ioctl(ovl, FBIOPUT_VSCREENINFO, &ovl->var);
  error_move_plane:
-	ioctl(ovl->fd, OMAPFB_SETUP_PLANE, &ovl->plane_info);
+	ovl_ioctl(ovl, OMAPFB_SETUP_PLANE, &ovl->plane_info);
  error:
 	ERROR();
 	return false;
 }
 
+static void stage_overlay(struct omap_overlay *ovl)
+{
+	assert(transaction.active);
+
+	if (ovl->staged)
+		return;
+
+	assert(transaction.num_ovls < ARRAY_SIZE(transaction.ovls));
+	transaction.ovls[transaction.num_ovls++] = ovl;
+
+	ovl->staged = true;
+	ovl->staged_setup = false;
+}
+
+/* Apply the staged state of the overlay, if any */
+static bool overlay_flush(struct omap_overlay *ovl)
+{
+	if (!ovl->staged)
+		return true;
+
+	ovl->staged = false;
+
+	if (!ovl->staged_setup)
+		return overlay_pan(ovl, ovl->staged_buffer,
+				   ovl->staged_sx, ovl->staged_sy,
+				   ovl->staged_sw, ovl->staged_sh);
+
+	return overlay_setup(ovl, ovl->staged_buffer,
+			     ovl->staged_sx, ovl->staged_sy,
+			     ovl->staged_sw, ovl->staged_sh,
+			     ovl->staged_dx, ovl->staged_dy,
+			     ovl->staged_dw, ovl->staged_dh,
+			     ovl->staged_mirror, ovl->staged_rotate);
+}
+
+bool omap_overlay_pan(struct omap_overlay *ovl,
+		      unsigned int buffer,
+		      unsigned int sx, unsigned int sy,
+		      unsigned int sw, unsigned int sh)
+{
+	if (!transaction.active)
+		return overlay_pan(ovl, buffer, sx, sy, sw, sh);
+
+	/* A pan after a staged setup just changes its source */
+	stage_overlay(ovl);
+
+	ovl->staged_buffer = buffer;
+	ovl->staged_sx = sx;
+	ovl->staged_sy = sy;
+	ovl->staged_sw = sw;
+	ovl->staged_sh = sh;
+
+	return true;
+}
+
+bool omap_overlay_setup(struct omap_overlay *ovl,
+			unsigned int buffer,
+			unsigned int sx, unsigned int sy,
+			unsigned int sw, unsigned int sh,
+			unsigned int dx, unsigned int dy,
+			unsigned int dw, unsigned int dh,
+			enum omap_mirror mirror,
+			enum omap_rotate rotate)
+{
+	if (!transaction.active)
+		return overlay_setup(ovl, buffer, sx, sy, sw, sh,
+				     dx, dy, dw, dh, mirror, rotate);
+
+	stage_overlay(ovl);
+
+	ovl->staged_setup = true;
+	ovl->staged_buffer = buffer;
+	ovl->staged_sx = sx;
+	ovl->staged_sy = sy;
+	ovl->staged_sw = sw;
+	ovl->staged_sh = sh;
+	ovl->staged_dx = dx;
+	ovl->staged_dy = dy;
+	ovl->staged_dw = dw;
+	ovl->staged_dh = dh;
+	ovl->staged_mirror = mirror;
+	ovl->staged_rotate = rotate;
+
+	return true;
+}
+
+void omap_overlay_begin(void)
+{
+	ENTER();
+
+	assert(!transaction.active);
+
+	transaction.active = true;
+	transaction.num_ovls = 0;
+
+	LEAVE();
+}
+
+bool omap_overlay_commit(unsigned int *ret_ioctls)
+{
+	unsigned int count = ovl_ioctl_count;
+	bool ret = true;
+	int i;
+
+	ENTER();
+
+	assert(transaction.active);
+
+	transaction.active = false;
+
+	for (i = 0; i < transaction.num_ovls; i++) {
+		if (!overlay_flush(transaction.ovls[i]))
+			ret = false;
+	}
+
+	transaction.num_ovls = 0;
+
+	if (ret_ioctls)
+		*ret_ioctls = ovl_ioctl_count - count;
+
+	LEAVE();
+	return ret;
+}
+
 struct omap_output *omap_overlay_get_output(struct omap_overlay *ovl)
 {
 	return ovl->out;
@@ -1841,6 +2137,10 @@ bool omap_overlay_enable(struct omap_overlay *ovl)
 
 	dprintf(" ovl = %s\n", ovl->name);
 
+	/* plane_info must be up to date */
+	if (!overlay_flush(ovl))
+		goto error;
+
 	if (ovl->enabled || ovl->plane_info.enabled)
 		goto done;
 
@@ -1853,7 +2153,7 @@ bool omap_overlay_enable(struct omap_overlay *ovl)
 	plane_info.enabled = 1;
 
 	dprintf_pi("setup", &plane_info);
-	r = ioctl(ovl->fd, OMAPFB_SETUP_PLANE, &plane_info);
+	r = ovl_ioctl(ovl, OMAPFB_SETUP_PLANE, &plane_info);
 	if (r) {
 		eprintf("ioctl(OMAPFB_SETUP_PLANE) failed %d:%s\n",
 			errno, strerror(errno));
@@ -1886,6 +2186,10 @@ bool omap_overlay_disable(struct omap_overlay *ovl)
 
 	dprintf(" ovl = %s\n", ovl->name);
 
+	/* plane_info must be up to date */
+	if (!overlay_flush(ovl))
+		goto error;
+
 	if (!ovl->enabled || !ovl->plane_info.enabled)
 		goto done;
 
@@ -1894,7 +2198,7 @@ bool omap_overlay_disable(struct omap_overlay *ovl)
 	plane_info.enabled = 0;
 
 	dprintf_pi("setup", &plane_info);
-	r = ioctl(ovl->fd, OMAPFB_SETUP_PLANE, &plane_info);
+	r = ovl_ioctl(ovl, OMAPFB_SETUP_PLANE, &plane_info);
 	if (r) {
 		eprintf("ioctl(OMAPFB_SETUP_PLANE) failed %d:%s\n",
 			errno, strerror(errno));
@@ -2000,6 +2304,10 @@ bool omap_output_open(struct omap_output *out,
 	int enabled;
 	int tear_elim;
 	int update_mode;
+	struct dss2_attr display_attrs[] = {
+		{ .option = "enabled" },
+		{ .option = "tear_elim" },
+	};
 
 	ENTER();
 
@@ -2049,13 +2357,12 @@ bool omap_output_open(struct omap_output *out,
 	if (r)
 		goto error;
 
-	r = dss2_read_int(dss2_display, idx, "enabled", &enabled);
-	if (r)
-		goto error;
-
-	r = dss2_read_int(dss2_display, idx, "tear_elim", &tear_elim);
+	r = dss2_read_ints(dss2_display, idx,
+			   display_attrs, ARRAY_SIZE(display_attrs));
 	if (r)
 		goto error;
+	enabled = display_attrs[0].value;
+	tear_elim = display_attrs[1].value;
 
 	r = dss2_read_int(dss2_fb, idx, "update_mode", &update_mode);
 	if (r)
@@ -2094,6 +2401,9 @@ bool omap_output_close(struct omap_output *out)
 
 	dprintf(" out = %s\n", out->name);
 
+	/* The display may go away, don't keep its attributes open */
+	dss2_invalidate();
+
 	output_init(out);
 
 	LEAVE();
@@ -90,6 +90,49 @@ bool omap_fb_alloc(struct omap_fb *fb,
 		   unsigned int pitch_align);
 bool omap_fb_free(struct omap_fb *fb);
 
+/*
+ * Re-layout the fb inside its current allocation. Only the
+ * overlays are reprogrammed, the memory and any mapping of it
+ * stay valid. Returns false if the new layout doesn't fit.
+ */
+bool omap_fb_resize(struct omap_fb *fb,
+		    unsigned int w,
+		    unsigned int h,
+		    enum omap_format format,
+		    unsigned int num_buffers,
+		    unsigned int buffer_align,
+		    unsigned int pitch_align);
+
+/* Returns the memory size omap_fb_alloc() would need */
+unsigned int omap_fb_calc_size(unsigned int w,
+			       unsigned int h,
+			       enum omap_format format,
+			       unsigned int num_buffers,
+			       unsigned int buffer_align,
+			       unsigned int pitch_align);
+
+/*
+ * Make omap_fb_alloc() allocate at least 'size' bytes so that
+ * later layouts up to that size fit in with omap_fb_resize().
+ * Takes effect on the next omap_fb_alloc(). 0 drops the reservation.
+ */
+void omap_fb_reserve(struct omap_fb *fb, unsigned int size);
+
+struct omap_fb_stats {
+	/* bytes allocated from the kernel */
+	unsigned int size;
+	/* bytes covered by the current layout */
+	unsigned int used;
+	unsigned int reserved;
+	/* layout changes done within the allocation */
+	unsigned long resizes;
+	/* OMAPFB_SETUP_MEM calls */
+	unsigned long reallocs;
+};
+
+void omap_fb_get_stats(const struct omap_fb *fb,
+		       struct omap_fb_stats *stats);
+
 /* Returns true if fb size matches */
 bool omap_fb_check_size(struct omap_fb *fb,
 			unsigned int w,
@@ -151,6 +194,15 @@ bool omap_overlay_setup(struct omap_overlay *ovl,
 			enum omap_mirror mirror,
 			enum omap_rotate rotate);
 
+/*
+ * Stage omap_overlay_setup() and omap_overlay_pan() calls on all
+ * overlays until omap_overlay_commit(), which then applies only
+ * the final state of each overlay. ret_ioctls, if not NULL, gets
+ * the number of overlay ioctls the commit issued.
+ */
+void omap_overlay_begin(void);
+bool omap_overlay_commit(unsigned int *ret_ioctls);
+
 /* show the overlay */
 bool omap_overlay_enable(struct omap_overlay *ovl);
 /* Hide the overlay */
@@ -37,23 +37,108 @@
 #include "fbdev.h"
 #include "omap_sysfs.h"
 
-static int sysfs_write(const char *path, const char *value, size_t len)
+/*
+ * Opening a sysfs attribute means a full path lookup which is
+ * surprisingly expensive, so keep the attributes open and just
+ * pread()/pwrite() them at offset 0. An entry is dropped whenever
+ * it gives an error, and dss2_invalidate() drops everything.
+ */
+#define SYSFS_CACHE_SIZE 32
+
+static struct sysfs_fd {
+	char *path;
+	int flags;
+	int fd;
+	unsigned int last_use;
+} sysfs_cache[SYSFS_CACHE_SIZE];
+
+static unsigned int sysfs_use_count;
+
+static void sysfs_put_fd(struct sysfs_fd *entry)
+{
+	close(entry->fd);
+	free(entry->path);
+	entry->path = NULL;
+	entry->fd = -1;
+}
+
+static struct sysfs_fd *sysfs_get_fd(const char *path, int flags)
 {
+	struct sysfs_fd *entry = NULL;
+	char *dup;
 	int fd;
+	int i;
+
+	for (i = 0; i < SYSFS_CACHE_SIZE; i++) {
+		struct sysfs_fd *e = &sysfs_cache[i];
+
+		if (!e->path) {
+			if (!entry || entry->path)
+				entry = e;
+			continue;
+		}
+
+		if (e->flags == flags && !strcmp(e->path, path)) {
+			e->last_use = ++sysfs_use_count;
+			return e;
+		}
+
+		/* Evict the least recently used entry if full */
+		if (!entry || (entry->path && e->last_use < entry->last_use))
+			entry = e;
+	}
+
+	fd = open(path, flags | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	dup = strdup(path);
+	if (!dup) {
+		close(fd);
+		return NULL;
+	}
+
+	if (entry->path)
+		sysfs_put_fd(entry);
+
+	entry->path = dup;
+	entry->flags = flags;
+	entry->fd = fd;
+	entry->last_use = ++sysfs_use_count;
+
+	return entry;
+}
+
+void dss2_invalidate(void)
+{
+	int i;
+
+	for (i = 0; i < SYSFS_CACHE_SIZE; i++) {
+		if (sysfs_cache[i].path)
+			sysfs_put_fd(&sysfs_cache[i]);
+	}
+}
+
+static int sysfs_write(const char *path, const char *value, size_t len)
+{
+	struct sysfs_fd *entry;
 	ssize_t r;
 
 	DebugF("omap/sysfs: writing '%s' to '%s'\n", value, path);
 
-	fd = open(path, O_WRONLY);
-	if (fd < 0) {
+	entry = sysfs_get_fd(path, O_WRONLY);
+	if (!entry) {
+		int err = errno;
+
 		xf86DrvMsg(0, X_WARNING,
 			"omap/sysfs: can't open '%s' for writing: %d:%s\n",
-			path, errno, strerror(errno));
-		return fd;
+			path, err, strerror(err));
+		errno = err;
+		return -1;
 	}
 
 	for (;;) {
-		r = write(fd, value, len);
+		r = pwrite(entry->fd, value, len, 0);
 		if (r < 0) {
 			if (errno == EINTR)
 				continue;
@@ -61,12 +146,15 @@ static int sysfs_write(const char *path, const char *value, size_t len)
 		break;
 	}
 
-	close(fd);
-
 	if (r < 0) {
+		int err = errno;
+
+		/* The attribute may be stale, reopen it next time */
+		sysfs_put_fd(entry);
 		xf86DrvMsg(0, X_WARNING,
 			"omap/sysfs: can't write to '%s': %d:%s\n",
-			path, errno, strerror(errno));
+			path, err, strerror(err));
+		errno = err;
 		return -1;
 	}
 
@@ -75,21 +163,24 @@ static int sysfs_write(const char *path, const char *value, size_t len)
 
 static int sysfs_read(const char *path, char *value, size_t len)
 {
-	int fd;
+	struct sysfs_fd *entry;
 	ssize_t r;
 
 	DebugF("omap/sysfs: reading '%s'\n", path);
 
-	fd = open(path, O_RDONLY);
-	if (fd < 0) {
+	entry = sysfs_get_fd(path, O_RDONLY);
+	if (!entry) {
+		int err = errno;
+
 		xf86DrvMsg(0, X_WARNING,
 			"omap/sysfs: can't open '%s' for reading: %d:%s\n",
-			path, errno, strerror(errno));
-		return fd;
+			path, err, strerror(err));
+		errno = err;
+		return -1;
 	}
 
 	for (;;) {
-		r = read(fd, value, len);
+		r = pread(entry->fd, value, len, 0);
 		if (r < 0) {
 			if (errno == EINTR)
 				continue;
@@ -97,12 +188,14 @@ static int sysfs_read(const char *path, char *value, size_t len)
 		break;
 	}
 
-	close(fd);
-
 	if (r < 0) {
+		int err = errno;
+
+		sysfs_put_fd(entry);
 		xf86DrvMsg(0, X_WARNING,
 			"omap/sysfs: can't read from '%s': %d:%s\n",
-			path, errno, strerror(errno));
+			path, err, strerror(err));
+		errno = err;
 		return -1;
 	}
 
@@ -176,3 +269,44 @@ int dss2_write_int(const char *fmt, int index, const char *option, int a)
 
 	return dss2_write_str(fmt, index, option, buf);
 }
+
+/*
+ * Builds the attribute directory path once and returns
+ * a pointer to where the attribute name goes.
+ */
+static char *dss2_dir(char *path, size_t len,
+		      const char *fmt, int index, size_t *ret_left)
+{
+	size_t n;
+
+	snprintf(path, len, fmt, index, "");
+	path[len - 1] = '\0';
+
+	n = strlen(path);
+	*ret_left = len - n;
+
+	return path + n;
+}
+
+int dss2_read_ints(const char *fmt, int index,
+		   struct dss2_attr *attrs, int num)
+{
+	char path[PATH_MAX];
+	char buf[32];
+	char *option;
+	size_t left;
+	int i;
+
+	option = dss2_dir(path, sizeof path, fmt, index, &left);
+
+	for (i = 0; i < num; i++) {
+		snprintf(option, left, "%s", attrs[i].option);
+
+		if (sysfs_read(path, buf, sizeof buf))
+			return -1;
+
+		attrs[i].value = atoi(buf);
+	}
+
+	return 0;
+}
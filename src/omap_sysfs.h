@@ -33,4 +33,19 @@ int dss2_read_str(const char *fmt, int index, const char *option, char *str,
 int dss2_write_str(const char *fmt, int index, const char *option,
 		   const char *str);
 
+struct dss2_attr {
+	const char *option;
+	int value;
+};
+
+/*
+ * Read several attributes of the same sysfs directory.
+ * Stops at the first failure.
+ */
+int dss2_read_ints(const char *fmt, int index,
+		   struct dss2_attr *attrs, int num);
+
+/* Drop all cached sysfs file descriptors */
+void dss2_invalidate(void);
+
 #endif
@@ -39,10 +39,12 @@
 #include <xf86Crtc.h>
 #include "omap_video.h"
 #include "omap_video_formats.h"
+#include "omap_video_copy.h"
 #include "omap_sysfs.h"
 #include "sgx_xv.h"
 #include "omap.h"
 #include "extfb.h"
+#include "perf.h"
 
 struct omap_video_info {
 	int id;
@@ -55,6 +57,10 @@ struct omap_video_info {
 	Bool autopaint_ckey;
 	Bool disable_ckey;
 	Bool changed_ckey;
+	/* The part of the drawable which already has the colorkey */
+	RegionRec ckey_region;
+	/* rendering to the drawable which may cover the colorkey */
+	DamagePtr ckey_damage;
 	Bool vsync;
 
 	enum {
@@ -88,6 +94,12 @@ struct omap_video_info {
 	/* CRTC for clone video */
 	xf86CrtcPtr clone_crtc;
 	Bool update_clone;
+	/* GPU scaled clone (VideoCloneBlit) */
+	Bool clone_blit;
+	Bool clone_frame;
+	void *clone_src;
+	unsigned int clone_shown;
+	int clone_pending;
 	enum omap_rotate rotate;
 	enum omap_mirror mirror;
 	Rotation crtc_rotation;
@@ -97,6 +109,14 @@ struct omap_video_info {
 	Bool fbdev_reserved;
 
 	int stacking;
+
+	/* Row signatures of the frames in video memory (XV_DIRTY_ROWS) */
+	Bool dirty_rows;
+	CARD32 *row_sig[2];
+	CARD32 *row_sig_new;
+	unsigned int row_sig_height;
+	Bool row_sig_valid[2];
+	Bool row_sig_ready;
 };
 #define get_omap_video_info(fbdev, n) ((fbdev)->overlay_adaptor->pPortPrivates[n].ptr)
 
@@ -125,12 +145,14 @@ static XF86AttributeRec xv_attributes[] = {
 	{XvSettable             , 0, 0, "XV_OMAP_FBDEV_SYNC"},
 	{XvGettable | XvSettable, 0, 2, "XV_STACKING"},
 	{XvGettable | XvSettable, 1, 56, "XV_ROTATION"},
+	{XvGettable | XvSettable, 0, 1, "XV_DIRTY_ROWS"},
 };
 
 static Atom xv_ckey, xv_autopaint_ckey, xv_disable_ckey, xv_vsync;
 static Atom xv_crtc, xv_overlay_alpha;
 static Atom xv_double_buffer, xv_omap_fbdev_num, xv_omap_fbdev_reserve;
 static Atom xv_clone_fullscreen, xv_omap_fbdev_sync, xv_stacking, xv_rotation;
+static Atom xv_dirty_rows;
 
 /*
  * Window property, not Xv property.
@@ -496,6 +518,9 @@ static void unmap_video_mem(struct omap_video_info *video_info)
 	if (!video_info->mem)
 		return;
 
+	pvr2dCloneUnwrap(video_info->fbdev->pvr2d, video_info->clone_src);
+	video_info->clone_src = NULL;
+
 	omap_fb_unmap(video_info->fb);
 
 	video_info->mem = NULL;
@@ -542,6 +567,52 @@ static enum omap_format get_omap_format(CARD32 fourcc)
 	}
 }
 
+/*
+ * The row signatures describe what is in each video buffer. Anything
+ * that changes the buffer layout or contents behind our back must
+ * invalidate them.
+ */
+static void invalidate_row_sigs(struct omap_video_info *video_info)
+{
+	video_info->row_sig_valid[0] = FALSE;
+	video_info->row_sig_valid[1] = FALSE;
+	video_info->row_sig_ready = FALSE;
+}
+
+static void free_row_sigs(struct omap_video_info *video_info)
+{
+	free(video_info->row_sig[0]);
+	free(video_info->row_sig[1]);
+	free(video_info->row_sig_new);
+	video_info->row_sig[0] = NULL;
+	video_info->row_sig[1] = NULL;
+	video_info->row_sig_new = NULL;
+	video_info->row_sig_height = 0;
+	invalidate_row_sigs(video_info);
+}
+
+static Bool alloc_row_sigs(struct omap_video_info *video_info,
+			   unsigned int height)
+{
+	if (video_info->row_sig_height == height)
+		return TRUE;
+
+	free_row_sigs(video_info);
+
+	video_info->row_sig[0] = malloc(height * sizeof(CARD32));
+	video_info->row_sig[1] = malloc(height * sizeof(CARD32));
+	video_info->row_sig_new = malloc(height * sizeof(CARD32));
+	if (!video_info->row_sig[0] || !video_info->row_sig[1] ||
+	    !video_info->row_sig_new) {
+		free_row_sigs(video_info);
+		return FALSE;
+	}
+
+	video_info->row_sig_height = height;
+
+	return TRUE;
+}
+
 /**
  * Allocates video memory to satisfy the specified image size and format.
  */
@@ -550,12 +621,27 @@ static Bool alloc_mem(struct omap_video_info *video_info,
 {
 	enum omap_format format = get_omap_format(fourcc);
 	unsigned int pitch;
+	unsigned int pitch_align = 1;
+
+	/* Let the GPU read the overlay memory for the clone */
+	if (video_info->fbdev->conf.video_clone_blit)
+		pitch_align = pvr2dClonePitchAlign(width);
 
 	if (video_info->allocated &&
 	    omap_fb_check_size(video_info->fb, width, height,
-			       format, 2, 1, 1))
+			       format, 2, 1, pitch_align))
 		return TRUE;
 
+	/*
+	 * Video that shrinks or returns to an earlier size fits
+	 * into the memory we already have, no need to go through
+	 * a kernel reallocation and a plane disable.
+	 */
+	if (video_info->allocated &&
+	    omap_fb_resize(video_info->fb, width, height,
+			   format, 2, 1, pitch_align))
+		goto done;
+
 	/* Disable plane so that reallocation will work. */
 	if (video_info->state == OMAP_STATE_ACTIVE) {
 		omap_overlay_disable(video_info->ovl);
@@ -563,11 +649,12 @@ static Bool alloc_mem(struct omap_video_info *video_info,
 	}
 
 	if (!omap_fb_alloc(video_info->fb, width, height,
-			   format, 2, 1, 1)) {
+			   format, 2, 1, pitch_align)) {
 		ErrorF("omap/video: couldn't allocate memory for video plane!\n");
 		return FALSE;
 	}
 
+ done:
 	if (!omap_fb_get_info(video_info->fb, NULL, NULL, &pitch)) {
 		ErrorF("omap/video: couldn't get memory info!\n");
 		omap_fb_free(video_info->fb);
@@ -578,6 +665,7 @@ static Bool alloc_mem(struct omap_video_info *video_info,
 	video_info->allocated = TRUE;
 	video_info->dirty = TRUE;
 	video_info->pitch = pitch;
+	invalidate_row_sigs(video_info);
 
 	return TRUE;
 }
@@ -587,6 +675,8 @@ static Bool alloc_mem(struct omap_video_info *video_info,
  */
 static void free_mem(struct omap_video_info *video_info)
 {
+	invalidate_row_sigs(video_info);
+
 	if (!video_info->allocated)
 		return;
 
@@ -675,11 +765,73 @@ static Bool flip_plane(struct omap_video_info *video_info)
 		return FALSE;
 
 	video_info->buffer = next_buffer;
-	video_info->update_clone = TRUE;
+
+	/* The GPU clone only needs a blit, not a full CRTC update */
+	if (video_info->clone_blit)
+		video_info->clone_frame = TRUE;
+	else
+		video_info->update_clone = TRUE;
 
 	return TRUE;
 }
 
+/*
+ * Rendering to the drawable can paint over the colorkey without
+ * changing the clip list. Forget about the colorkey there, so that
+ * the next PutImage paints it again. Our own fills are reported too,
+ * but omap_fill_color_key() sets ckey_region right after them.
+ */
+static void ckey_damage_report(DamagePtr damage, RegionPtr region,
+			       void *closure)
+{
+	struct omap_video_info *video_info = closure;
+	DrawablePtr drawable = video_info->drawable;
+	RegionRec reg;
+
+	if (!drawable || !RegionNotEmpty(&video_info->ckey_region))
+		return;
+
+	/* Damage is relative to the drawable, the clip list isn't */
+	RegionNull(&reg);
+	RegionCopy(&reg, region);
+	RegionTranslate(&reg, drawable->x, drawable->y);
+	RegionSubtract(&video_info->ckey_region,
+		       &video_info->ckey_region, &reg);
+	RegionUninit(&reg);
+}
+
+static void set_drawable(struct omap_video_info *video_info,
+			 DrawablePtr drawable)
+{
+	if (drawable == video_info->drawable)
+		return;
+
+	video_info->changed_ckey = TRUE;
+
+	if (video_info->ckey_damage) {
+#if XORG_VERSION_CURRENT >= XORG_VERSION_NUMERIC(1,14,99,2,0)
+		DamageUnregister(video_info->ckey_damage);
+#else
+		DamageUnregister(video_info->drawable,
+				 video_info->ckey_damage);
+#endif
+		DamageDestroy(video_info->ckey_damage);
+		video_info->ckey_damage = NULL;
+	}
+
+	video_info->drawable = drawable;
+
+	if (!drawable)
+		return;
+
+	/* Without it the colorkey is just repainted on clip changes */
+	video_info->ckey_damage = DamageCreate(ckey_damage_report, NULL,
+					       DamageReportRawRegion, TRUE,
+					       drawable->pScreen, video_info);
+	if (video_info->ckey_damage)
+		DamageRegister(drawable, video_info->ckey_damage);
+}
+
 static void drawable_destroyed(FBDevPtr fbdev, DrawablePtr drawable)
 {
 	int i;
@@ -688,7 +840,7 @@ static void drawable_destroyed(FBDevPtr fbdev, DrawablePtr drawable)
 	for (i = 0; i < fbdev->num_video_ports; i++) {
 		video_info = get_omap_video_info(fbdev, i);
 		if (video_info->drawable == drawable)
-			video_info->drawable = NULL;
+			set_drawable(video_info, NULL);
 	}
 }
 
@@ -787,6 +939,9 @@ static void stop_video(struct omap_video_info *video_info)
 
 	video_info->crtc = NULL;
 
+	RegionEmpty(&video_info->ckey_region);
+	video_info->changed_ckey = TRUE;
+
 	cancel_ckey_timer(video_info);
 
 	DebugF("omap stop_video: stopped plane %d\n", video_info->id);
@@ -915,6 +1070,10 @@ static void clone_sync(ScrnInfoPtr pScrn)
 	if (!video_info)
 		return;
 
+	/* The clone overlay doesn't scan out the video memory */
+	if (video_info->clone_blit)
+		return;
+
 	crtc = video_info->clone_crtc;
 	if (!crtc)
 		return;
@@ -995,6 +1154,10 @@ static int omap_video_get_attribute(ScrnInfoPtr pScrn, Atom attribute,
 		*value = video_info->rotation;
 		LEAVE();
 		return Success;
+	} else if (attribute == xv_dirty_rows) {
+		*value = video_info->dirty_rows;
+		LEAVE();
+		return Success;
 	}
 
 	LEAVE();
@@ -1043,6 +1206,7 @@ static int omap_video_set_attribute(ScrnInfoPtr pScrn, Atom attribute,
 
 		video_info->double_buffer = value;
 		video_info->dirty = TRUE;
+		invalidate_row_sigs(video_info);
 		LEAVE();
 		return Success;
 	} else if (attribute == xv_ckey) {
@@ -1198,6 +1362,17 @@ static int omap_video_set_attribute(ScrnInfoPtr pScrn, Atom attribute,
 
 		LEAVE();
 		return Success;
+	} else if (attribute == xv_dirty_rows) {
+		if (value != 0 && value != 1) {
+			LEAVE();
+			return BadValue;
+		}
+
+		video_info->dirty_rows = value;
+		if (!value)
+			free_row_sigs(video_info);
+		LEAVE();
+		return Success;
 	}
 
 	LEAVE();
@@ -1259,7 +1434,8 @@ Bool omap_video_clone(ScrnInfoPtr pScrn, xf86CrtcPtr crtc,
 		      unsigned int *buffer,
 		      unsigned int *sx, unsigned int *sy,
 		      unsigned int *sw, unsigned int *sh,
-		      unsigned int *dw, unsigned int *dh)
+		      unsigned int *dw, unsigned int *dh,
+		      Bool *blit)
 {
 	struct omap_video_info *video_info = get_clone_info(pScrn);
 	struct fbdev_crtc *priv = crtc->driver_private;
@@ -1272,6 +1448,27 @@ Bool omap_video_clone(ScrnInfoPtr pScrn, xf86CrtcPtr crtc,
 	if (crtc != video_info->clone_crtc)
 		return FALSE;
 
+	/*
+	 * The GPU scales the video into a clone buffer in the
+	 * primary framebuffer. The caller clamps sw and sh to
+	 * the final output size, and the blit uses that size.
+	 */
+	if (video_info->clone_blit) {
+		*buffer = video_info->fbdev->conf.page_flip_bufs +
+			video_info->clone_shown;
+		*sx = 0;
+		*sy = 0;
+		*sw = pScrn->virtualX;
+		*sh = pScrn->virtualY;
+		*dw = video_info->dst_w;
+		*dh = video_info->dst_h;
+		*blit = TRUE;
+
+		return TRUE;
+	}
+
+	*blit = FALSE;
+
 	if (omap_overlay_get_fb(priv->ovl) != video_info->fb) {
 		/*
 		 * Trick to make Xv<->CRTC clone switching smoother.
@@ -1301,6 +1498,80 @@ Bool omap_video_clone_active(ScrnInfoPtr pScrn, xf86CrtcPtr crtc)
 	return video_info && crtc == video_info->clone_crtc;
 }
 
+/*
+ * GPU clone pipeline. Each new frame is blitted into a free clone
+ * buffer, and the clone overlay is flipped to the previous frame's
+ * buffer once the GPU is done with it. So the clone runs one frame
+ * behind and the primary overlay never waits for the clone CRTC.
+ * The shown buffer is never blitted into, also not right after the
+ * clone overlay was set up again: it keeps showing clone_shown
+ * until the first new frame is done.
+ */
+static void clone_blit_frame(ScrnInfoPtr pScrn,
+			     struct omap_video_info *video_info,
+			     xf86CrtcPtr crtc)
+{
+	struct fbdev_crtc *priv = crtc->driver_private;
+	unsigned int page_flip_bufs = video_info->fbdev->conf.page_flip_bufs;
+	unsigned int idx;
+
+	if (!video_info->clone_src) {
+		video_info->clone_src = pvr2dCloneWrap(video_info->fbdev->pvr2d,
+						       video_info->mem,
+						       video_info->mem_len);
+		if (!video_info->clone_src)
+			return;
+	}
+
+	/* Show the previous frame if the GPU has finished it */
+	if (video_info->clone_pending >= 0 &&
+	    !pvr2dCloneBusy(video_info->fbdev->pvr2d,
+			    video_info->clone_pending)) {
+		if (omap_overlay_pan(priv->ovl, page_flip_bufs +
+				     video_info->clone_pending,
+				     0, 0, priv->sw, priv->sh))
+			video_info->clone_shown = video_info->clone_pending;
+		video_info->clone_pending = -1;
+	}
+
+	/*
+	 * Use the buffer which is neither shown nor pending.
+	 * A still busy pending frame simply gets dropped.
+	 */
+	for (idx = 0; idx == video_info->clone_shown ||
+		     (int) idx == video_info->clone_pending; idx++)
+		;
+
+	if (!pvr2dCloneBlit(pScrn, video_info->clone_src,
+			    get_omap_format(video_info->fourcc),
+			    video_info->width, video_info->height,
+			    video_info->pitch, video_info->buffer,
+			    video_info->src_x, video_info->src_y,
+			    video_info->src_w, video_info->src_h,
+			    idx, priv->sw, priv->sh)) {
+		ErrorF("omap/video: clone blit failed\n");
+		return;
+	}
+
+	video_info->clone_pending = idx;
+}
+
+/* Can the clone be scaled by the GPU instead of DSS? */
+static Bool can_clone_blit(struct omap_video_info *video_info)
+{
+	if (!video_info->fbdev->conf.video_clone_blit)
+		return FALSE;
+
+	/* The blit reads the front buffer while the back one is written */
+	if (!video_info->double_buffer)
+		return FALSE;
+
+	return pvr2dCloneCheck(video_info->fbdev->pvr2d,
+			       get_omap_format(video_info->fourcc),
+			       video_info->width, video_info->height,
+			       video_info->pitch);
+}
+
 static void clone_update(ScrnInfoPtr pScrn)
 {
 	struct omap_video_info *video_info;
@@ -1311,7 +1582,8 @@ static void clone_update(ScrnInfoPtr pScrn)
 	if (!video_info)
 		return;
 
-	if (!video_info->update_clone)
+	if (!video_info->update_clone &&
+	    !video_info->clone_frame)
 		return;
 
 	crtc = video_info->clone_crtc;
@@ -1323,14 +1595,22 @@ static void clone_update(ScrnInfoPtr pScrn)
 	if (!crtc->enabled || priv->dpms != DPMSModeOn)
 		return;
 
-	/*
-	 * FIXME refactor the code a bit to avoid having
-	 * to call set_mode_major() for this.
-	 */
-	crtc->funcs->set_mode_major(crtc, &crtc->mode,
-				    crtc->rotation,
-				    crtc->x, crtc->y);
-	video_info->update_clone = FALSE;
+	if (video_info->update_clone) {
+		/*
+		 * FIXME refactor the code a bit to avoid having
+		 * to call set_mode_major() for this.
+		 */
+		crtc->funcs->set_mode_major(crtc, &crtc->mode,
+					    crtc->rotation,
+					    crtc->x, crtc->y);
+		video_info->update_clone = FALSE;
+		video_info->clone_pending = -1;
+	}
+
+	if (video_info->clone_blit)
+		clone_blit_frame(pScrn, video_info, crtc);
+
+	video_info->clone_frame = FALSE;
 }
 
 static void clone_stop(struct omap_video_info *video_info)
@@ -1338,6 +1618,10 @@ static void clone_stop(struct omap_video_info *video_info)
 	xf86CrtcPtr crtc = video_info->clone_crtc;
 	struct fbdev_crtc *priv;
 
+	video_info->clone_blit = FALSE;
+	video_info->clone_frame = FALSE;
+	video_info->clone_pending = -1;
+
 	if (!crtc)
 		return;
 
@@ -1379,6 +1663,8 @@ static void omap_video_stop(ScrnInfoPtr pScrn, pointer data, Bool exit)
 		video_info->clone = TRUE;
 		video_info->stacking = 0;
 		video_info->rotation = RR_Rotate_0;
+		video_info->dirty_rows = FALSE;
+		free_row_sigs(video_info);
 
 		/* Disable color keying */
 		setup_colorkey(video_info, FALSE);
@@ -1388,7 +1674,7 @@ static void omap_video_stop(ScrnInfoPtr pScrn, pointer data, Bool exit)
 		video_info->fbdev_reserved = FALSE;
 	}
 
-	video_info->drawable = NULL;
+	set_drawable(video_info, NULL);
 
 	if (!video_info->fbdev_reserved)
 		put_overlay(video_info);
@@ -1544,17 +1830,241 @@ void omap_video_update_crtc(ScrnInfoPtr pScrn,
 	}
 }
 
+struct frame_copy {
+	int id;
+	CARD8 *src;
+	CARD8 *dst;
+	int width, height;
+	unsigned int pitch;
+};
+
+static void copy_frame_band(void *data, int y1, int y2)
+{
+	const struct frame_copy *c = data;
+	int width = c->width;
+	int rows = y2 - y1;
+
+	switch (c->id) {
+	case FOURCC_RV32:
+	case FOURCC_AV32:
+		omap_copy_32(c->src + y1 * OMAP_RV32_PITCH(width),
+			     c->dst + y1 * c->pitch,
+			     OMAP_RV32_PITCH(width),
+			     c->pitch,
+			     width, rows, 0, 0,
+			     width, rows);
+		break;
+
+	case FOURCC_RV12:
+	case FOURCC_RV16:
+	case FOURCC_AV12:
+		omap_copy_16(c->src + y1 * OMAP_RV16_PITCH(width),
+			     c->dst + y1 * c->pitch,
+			     OMAP_RV16_PITCH(width),
+			     c->pitch,
+			     width, rows, 0, 0,
+			     width, rows);
+		break;
+
+	case FOURCC_UYVY:
+	case FOURCC_YUY2:
+		omap_copy_packed(c->src + y1 * OMAP_YUY2_PITCH(width),
+				 c->dst + y1 * c->pitch,
+				 OMAP_YUY2_PITCH(width),
+				 c->pitch,
+				 width, rows, 0, 0,
+				 width, rows);
+		break;
+
+	case FOURCC_YV12:
+	case FOURCC_I420:
+		omap_copy_planar_rows(c->src, c->dst,
+				      OMAP_YV12_PITCH_LUMA(width),
+				      OMAP_YV12_PITCH_CHROMA(width),
+				      c->pitch,
+				      width, c->height, y1, y2, c->id);
+		break;
+	}
+}
+
+static Bool is_rgb_format(int fourcc)
+{
+	switch (fourcc) {
+	case FOURCC_RV12:
+	case FOURCC_RV16:
+	case FOURCC_RV32:
+	case FOURCC_AV12:
+	case FOURCC_AV32:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/* FNV-1a over pixels, good enough to spot changed rows. */
+static CARD32 row_signature(int fourcc, const CARD8 *row, int width)
+{
+	CARD32 sig = 2166136261u;
+	int i;
+
+	if (fourcc == FOURCC_RV32 || fourcc == FOURCC_AV32) {
+		const CARD32 *p = (const CARD32 *) row;
+
+		for (i = 0; i < width; i++)
+			sig = (sig ^ p[i]) * 16777619u;
+	} else {
+		const CARD16 *p = (const CARD16 *) row;
+
+		for (i = 0; i < width; i++)
+			sig = (sig ^ p[i]) * 16777619u;
+	}
+
+	return sig;
+}
+
+/*
+ * With XV_DIRTY_ROWS enabled calculate the row signatures of an RGB
+ * frame and compare them against the frame currently on screen.
+ * Returns FALSE if the new frame is identical to the displayed one.
+ */
+static Bool frame_changed(struct omap_video_info *video_info,
+			  int id, const CARD8 *buf, int width, int height)
+{
+	unsigned int cur = video_info->double_buffer ? video_info->buffer : 0;
+	unsigned int pitch;
+	int y;
+
+	video_info->row_sig_ready = FALSE;
+
+	if (!video_info->dirty_rows || !is_rgb_format(id))
+		return TRUE;
+
+	if (!alloc_row_sigs(video_info, height))
+		return TRUE;
+
+	if (id == FOURCC_RV32 || id == FOURCC_AV32)
+		pitch = OMAP_RV32_PITCH(width);
+	else
+		pitch = OMAP_RV16_PITCH(width);
+
+	for (y = 0; y < height; y++)
+		video_info->row_sig_new[y] =
+			row_signature(id, buf + y * pitch, width);
+
+	video_info->row_sig_ready = TRUE;
+
+	if (!video_info->row_sig_valid[cur])
+		return TRUE;
+
+	return memcmp(video_info->row_sig_new, video_info->row_sig[cur],
+		      height * sizeof(CARD32)) != 0;
+}
+
+/*
+ * Copy only the row spans which differ from what the target
+ * buffer already contains.
+ */
+static void copy_dirty_rows(struct omap_video_info *video_info,
+			    int id, CARD8 *buf, CARD8 *mem,
+			    int width, int height)
+{
+	unsigned int next = video_info->double_buffer ? !video_info->buffer : 0;
+	const CARD32 *new_sig = video_info->row_sig_new;
+	CARD32 *sig = video_info->row_sig[next];
+	Bool valid = video_info->row_sig_valid[next];
+	int y1, y2;
+
+	for (y1 = 0; y1 < height; y1 = y2) {
+		if (valid && sig[y1] == new_sig[y1]) {
+			y2 = y1 + 1;
+			continue;
+		}
+
+		for (y2 = y1 + 1; y2 < height; y2++)
+			if (valid && sig[y2] == new_sig[y2])
+				break;
+
+		if (id == FOURCC_RV32 || id == FOURCC_AV32)
+			omap_copy_32(buf, mem,
+				     OMAP_RV32_PITCH(width),
+				     video_info->pitch,
+				     width, height, 0, y1,
+				     width, y2 - y1);
+		else
+			omap_copy_16(buf, mem,
+				     OMAP_RV16_PITCH(width),
+				     video_info->pitch,
+				     width, height, 0, y1,
+				     width, y2 - y1);
+	}
+
+	memcpy(sig, new_sig, height * sizeof(CARD32));
+	video_info->row_sig_valid[next] = TRUE;
+}
+
+/*
+ * Copy the client's frame into video memory. The copy may be split
+ * across the video copy threads, but it has always completed by the
+ * time this returns, so the plane can be flipped right after.
+ */
+static void copy_frame(struct omap_video_info *video_info,
+		       int id, unsigned char *buf, CARD8 *mem,
+		       int width, int height)
+{
+	struct frame_copy c = {
+		.id = id,
+		.src = buf,
+		.dst = mem,
+		.width = width,
+		.height = height,
+		.pitch = video_info->pitch,
+	};
+
+	if (video_info->row_sig_ready) {
+		copy_dirty_rows(video_info, id, buf, mem, width, height);
+		return;
+	}
+
+	/* Planar bands must start on an even row to keep chroma aligned */
+	omap_copy_pool_run(video_info->fbdev->copy_pool, height, 2,
+			   height * video_info->pitch,
+			   copy_frame_band, &c);
+}
+
+/*
+ * Paint the colorkey into the parts of clip_boxes which don't have it yet.
+ * The area actually painted is added to the painted region, if given.
+ */
 static void omap_fill_color_key(ScrnInfoPtr pScrn, DrawablePtr drawable,
-		struct omap_video_info *video_info, RegionPtr clip_boxes)
+		struct omap_video_info *video_info, RegionPtr clip_boxes,
+		RegionPtr painted)
 {
+	RegionRec fill;
+
 	if (!video_info->autopaint_ckey)
 		return;
 
-	/* Display update will be schedule next */
-	extfb_lock_display_update(pScrn);
-	xf86XVFillKeyHelperPort(drawable, video_info, video_info->ckey,
-				clip_boxes, video_info->changed_ckey);
-	extfb_unlock_display_update(pScrn);
+	RegionNull(&fill);
+
+	if (video_info->changed_ckey)
+		RegionCopy(&fill, clip_boxes);
+	else
+		RegionSubtract(&fill, clip_boxes, &video_info->ckey_region);
+
+	if (RegionNotEmpty(&fill)) {
+		/* Display update will be schedule next */
+		extfb_lock_display_update(pScrn);
+		xf86XVFillKeyHelperDrawable(drawable, video_info->ckey, &fill);
+		extfb_unlock_display_update(pScrn);
+
+		if (painted)
+			RegionUnion(painted, painted, &fill);
+	}
+
+	RegionCopy(&video_info->ckey_region, clip_boxes);
+	video_info->changed_ckey = FALSE;
+
+	RegionUninit(&fill);
 }
 
 /**
@@ -1577,10 +2087,14 @@ static int omap_video_putimage(ScrnInfoPtr pScrn,
 {
 	struct omap_video_info *video_info = (struct omap_video_info *)data;
 	Bool enable = FALSE;
+	Bool clone_blit;
 	int ret = Success;
+	unsigned int ioctls;
+	unsigned int old_buffer;
+	Bool commit_ok;
 	CARD8 *mem;
 	xf86CrtcPtr crtc;
-	RegionRec old;
+	RegionRec old, painted;
 
 	/*
 	 * FIXME client's might not be prepared for errors
@@ -1605,10 +2119,15 @@ static int omap_video_putimage(ScrnInfoPtr pScrn,
 		goto out;
 	}
 
+	if (id != video_info->fourcc ||
+	    width != video_info->width ||
+	    height != video_info->height)
+		invalidate_row_sigs(video_info);
+
 	video_info->fourcc = id;
 	video_info->width = width;
 	video_info->height = height;
-	video_info->drawable = drawable;
+	set_drawable(video_info, drawable);
 
 	/* Failure here means simply that there is nothing to draw */
 	if (!clip_image_to_fit(pScrn,
@@ -1645,6 +2164,13 @@ static int omap_video_putimage(ScrnInfoPtr pScrn,
 
 	video_info->clone_crtc = get_clone_crtc(pScrn, video_info);
 
+	clone_blit = video_info->clone_crtc && can_clone_blit(video_info);
+	if (clone_blit != video_info->clone_blit) {
+		video_info->clone_blit = clone_blit;
+		video_info->clone_pending = -1;
+		video_info->update_clone = TRUE;
+	}
+
 	if (!crtc) {
 		/* Make sure we update the old position */
 		push_update(pScrn, video_info, NULL);
@@ -1660,6 +2186,13 @@ static int omap_video_putimage(ScrnInfoPtr pScrn,
 
 	init_update_region(pScrn, &old, video_info);
 
+	/*
+	 * Stage the overlay setup and the flip so that
+	 * the kernel sees only the final state.
+	 */
+	old_buffer = video_info->buffer;
+	omap_overlay_begin();
+
 	if (is_dirty(video_info, id,
 		     src_x, src_y, dst_x, dst_y,
 		     src_w, src_h, dst_w, dst_h)) {
@@ -1671,6 +2204,7 @@ static int omap_video_putimage(ScrnInfoPtr pScrn,
 			       "from %dx%d+%d+%d to %dx%d+%d+%d on plane %d\n",
 			       src_w, src_h, src_x, src_y,
 			       dst_w, dst_h, dst_x, dst_y, video_info->id);
+			omap_overlay_commit(NULL);
 			stop_video(video_info);
 			put_overlay(video_info);
 			/* FIXME error value? */
@@ -1690,6 +2224,13 @@ static int omap_video_putimage(ScrnInfoPtr pScrn,
 		video_info->update_clone = TRUE;
 	}
 
+	/*
+	 * Nothing changed since the last frame. Handle it like
+	 * a ReputImage, no need to copy or flip anything.
+	 */
+	if (buf && !frame_changed(video_info, id, buf, width, height))
+		buf = NULL;
+
 	/*
 	 * If buf==NULL this is a ReputImage,
 	 * so the fb already has the correct data.
@@ -1706,50 +2247,40 @@ static int omap_video_putimage(ScrnInfoPtr pScrn,
 			}
 		}
 
-		switch (id) {
-		case FOURCC_RV32:
-		case FOURCC_AV32:
-			omap_copy_32(buf, mem,
-				     OMAP_RV32_PITCH(width),
-				     video_info->pitch,
-				     width, height, 0, 0,
-				     width, height);
-			break;
-
-		case FOURCC_RV12:
-		case FOURCC_RV16:
-		case FOURCC_AV12:
-			omap_copy_16(buf, mem,
-				     OMAP_RV16_PITCH(width),
-				     video_info->pitch,
-				     width, height, 0, 0,
-				     width, height);
-			break;
-
-		case FOURCC_UYVY:
-		case FOURCC_YUY2:
-			omap_copy_packed(buf, mem,
-					 OMAP_YUY2_PITCH(width),
-					 video_info->pitch,
-					 width, height, 0, 0,
-					 width, height);
-			break;
+		/* The GPU clone may still be reading the back buffer */
+		if (video_info->clone_blit)
+			pvr2dCloneWaitSrc(video_info->fbdev->pvr2d,
+					  video_info->clone_src);
 
-		case FOURCC_YV12:
-		case FOURCC_I420:
-			omap_copy_planar(buf, mem,
-					 OMAP_YV12_PITCH_LUMA(width),
-					 OMAP_YV12_PITCH_CHROMA(width),
-					 video_info->pitch,
-					 width, height, 0, 0,
-					 width, height, id);
-			break;
-		}
+		copy_frame(video_info, id, buf, mem, width, height);
 
 		if (video_info->double_buffer)
 			flip_plane(video_info);
 	}
 
+	commit_ok = omap_overlay_commit(&ioctls);
+
+	PERF_INCREMENT(ovl_commits);
+	PERF_INCREMENT2(ovl_ioctls, ioctls);
+
+	/*
+	 * The staged setup and flip only hit the hardware here, so
+	 * this is where they fail. The overlay is still showing the
+	 * old buffer.
+	 */
+	if (!commit_ok) {
+		ErrorF("omap/putimage: failed to set up overlay: "
+		       "from %dx%d+%d+%d to %dx%d+%d+%d on plane %d\n",
+		       src_w, src_h, src_x, src_y,
+		       dst_w, dst_h, dst_x, dst_y, video_info->id);
+		video_info->buffer = old_buffer;
+		stop_video(video_info);
+		put_overlay(video_info);
+		/* FIXME error value? */
+		ret = BadValue;
+		goto out;
+	}
+
 	rearm_ckey_timer(video_info);
 
 	if (enable) {
@@ -1758,9 +2289,21 @@ static int omap_video_putimage(ScrnInfoPtr pScrn,
 		omap_overlay_enable(video_info->ovl);
 	}
 
-	omap_fill_color_key(pScrn, drawable, video_info, clip_boxes);
+	RegionNull(&painted);
 
-	push_update(pScrn, video_info, &old);
+	omap_fill_color_key(pScrn, drawable, video_info, clip_boxes, &painted);
+
+	/*
+	 * The overlay only needs to be pushed to the display if it
+	 * moved or got a new frame. Otherwise only the freshly painted
+	 * colorkey areas, if any, need an update.
+	 */
+	if (buf || enable)
+		push_update(pScrn, video_info, &old);
+	else if (RegionNotEmpty(&painted))
+		ExtFBDamage(pScrn, &painted);
+
+	RegionUninit(&painted);
  out:
 	clone_update(pScrn);
 
@@ -1780,6 +2323,12 @@ static int omap_video_reputimage(ScrnInfoPtr pScrn,
 {
 	struct omap_video_info *video_info = (struct omap_video_info *)data;
 
+	/*
+	 * We get here when the clip list changed, so the colorkey
+	 * may have been overwritten anywhere. Repaint all of it.
+	 */
+	video_info->changed_ckey = TRUE;
+
 	return omap_video_putimage(pScrn,
 				   src_x, src_y, dst_x, dst_y,
 				   src_w, src_h, dst_w, dst_h,
@@ -1827,7 +2376,7 @@ static int omap_video_putvideo(ScrnInfoPtr pScrn,
 	video_info->fourcc = 0;
 	video_info->width = width;
 	video_info->height = height;
-	video_info->drawable = drawable;
+	set_drawable(video_info, drawable);
 
 	if (video_info->dirty)
 		enable = TRUE;
@@ -1867,6 +2416,12 @@ static int omap_video_putvideo(ScrnInfoPtr pScrn,
 
 	video_info->clone_crtc = get_clone_crtc(pScrn, video_info);
 
+	/* No GPU clone for XvPutVideo */
+	if (video_info->clone_blit) {
+		video_info->clone_blit = FALSE;
+		video_info->update_clone = TRUE;
+	}
+
 	if (!crtc) {
 		/* Make sure we update the old position */
 		push_update(pScrn, video_info, NULL);
@@ -1915,7 +2470,7 @@ static int omap_video_putvideo(ScrnInfoPtr pScrn,
 		omap_overlay_enable(video_info->ovl);
 	}
 
-	omap_fill_color_key(pScrn, drawable, video_info, clip_boxes);
+	omap_fill_color_key(pScrn, drawable, video_info, clip_boxes, NULL);
 
 	push_update(pScrn, video_info, &old);
  out:
@@ -2086,7 +2641,10 @@ static Bool omap_video_setup_private(ScreenPtr pScreen,
 	video_info->ckey = default_ckey(pScrn);
 	video_info->overlay_alpha = 255;
 	video_info->clone = TRUE;
+	video_info->clone_pending = -1;
 	video_info->rotation = RR_Rotate_0;
+	video_info->changed_ckey = TRUE;
+	RegionNull(&video_info->ckey_region);
 
 	LEAVE();
 
@@ -2101,6 +2659,10 @@ static void omap_video_free_adaptor(FBDevPtr fbdev, XF86VideoAdaptorPtr adapt)
 	if (adapt->pPortPrivates)
 		for (i = 0; i < fbdev->num_video_ports; ++i) {
 			video_info = adapt->pPortPrivates[i].ptr;
+			if (video_info) {
+				free_row_sigs(video_info);
+				RegionUninit(&video_info->ckey_region);
+			}
 			free(video_info);
 		}
 	free(adapt->pPortPrivates);
@@ -2193,6 +2755,7 @@ omap_video_setup_adaptor(ScreenPtr pScreen,
 	xv_omap_fbdev_sync = MAKE_ATOM("XV_OMAP_FBDEV_SYNC");
 	xv_stacking = MAKE_ATOM("XV_STACKING");
 	xv_rotation = MAKE_ATOM("XV_ROTATION");
+	xv_dirty_rows = MAKE_ATOM("XV_DIRTY_ROWS");
 	_omap_video_overlay = MAKE_ATOM("_OMAP_VIDEO_OVERLAY");
 
 	return adapt;
@@ -2216,9 +2779,12 @@ Bool fbdev_init_video(ScreenPtr pScreen, unsigned int num_video_ports, ...)
 
 	fbdev->screen = pScreen;
 
+	fbdev->copy_pool = omap_copy_pool_create(pScrn,
+						 fbdev->conf.video_copy_threads);
+
 	adaptors = realloc(adaptors, (i + 1) * sizeof(XF86VideoAdaptorPtr));
 	if (!adaptors)
-		return FALSE;
+		goto error;
 
 	va_start(ap, num_video_ports);
 
@@ -2232,7 +2798,7 @@ Bool fbdev_init_video(ScreenPtr pScreen, unsigned int num_video_ports, ...)
 
 	adaptors = realloc(adaptors, (i + 1) * sizeof(XF86VideoAdaptorPtr));
 	if (!adaptors)
-		return FALSE;
+		goto error;
 
 	if ((adaptor = pvr2dSetupTexturedVideo(pScreen))) {
 		adaptors[i] = adaptor;
@@ -2251,6 +2817,11 @@ Bool fbdev_init_video(ScreenPtr pScreen, unsigned int num_video_ports, ...)
 		free(adaptors);
 
 	return TRUE;
+
+ error:
+	omap_copy_pool_destroy(fbdev->copy_pool);
+	fbdev->copy_pool = NULL;
+	return FALSE;
 }
 
 /**
@@ -2270,4 +2841,7 @@ void fbdev_fini_video(ScreenPtr pScreen)
 	omap_video_free_adaptor(fbdev, fbdev->overlay_adaptor);
 	fbdev->overlay_adaptor = NULL;
 	fbdev->num_video_ports = 0;
+
+	omap_copy_pool_destroy(fbdev->copy_pool);
+	fbdev->copy_pool = NULL;
 }
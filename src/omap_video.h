@@ -129,7 +129,8 @@ Bool omap_video_clone(ScrnInfoPtr pScrn, xf86CrtcPtr crtc,
 		      unsigned int *buffer,
 		      unsigned int *sx, unsigned int *sy,
 		      unsigned int *sw, unsigned int *sh,
-		      unsigned int *dw, unsigned int *dh);
+		      unsigned int *dw, unsigned int *dh,
+		      Bool *blit);
 
 Bool omap_video_clone_active(ScrnInfoPtr pScrn, xf86CrtcPtr crtc);
 
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2010  Nokia Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Xv frame copies are split into row bands which are copied in parallel
+ * by a small pool of worker threads and the server thread itself.
+ *
+ * The source of the copy is the client's request or SHM buffer, which is
+ * only guaranteed to stay valid until the request has been processed. So
+ * the server thread always waits for the last band before returning,
+ * and anything depending on the new frame contents (plane flips, GPU
+ * blits) simply happens after omap_copy_pool_run() returns.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <signal.h>
+
+#include "fbdev.h"
+#include "omap_video_copy.h"
+
+/* Frames smaller than this are not worth the thread wakeups. */
+#define OMAP_COPY_MIN_BYTES (64 * 1024)
+
+struct omap_copy_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+
+	pthread_t *threads;
+	int num_threads;
+	Bool quit;
+
+	/* current frame */
+	omap_copy_band_func func;
+	void *data;
+	int rows;
+	int band_rows;
+	int num_bands;
+	int next_band;
+	int bands_pending;
+};
+
+/* Called with the pool lock held, returns with the pool lock held. */
+static void run_bands(struct omap_copy_pool *pool)
+{
+	while (pool->next_band < pool->num_bands) {
+		int band = pool->next_band++;
+		int y1 = band * pool->band_rows;
+		int y2 = min(y1 + pool->band_rows, pool->rows);
+
+		pthread_mutex_unlock(&pool->lock);
+
+		if (y1 < y2)
+			pool->func(pool->data, y1, y2);
+
+		pthread_mutex_lock(&pool->lock);
+
+		if (--pool->bands_pending == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	struct omap_copy_pool *pool = arg;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (!pool->quit) {
+		if (pool->next_band >= pool->num_bands) {
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+			continue;
+		}
+
+		run_bands(pool);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+void omap_copy_pool_run(struct omap_copy_pool *pool,
+			int rows, int row_align, unsigned int bytes,
+			omap_copy_band_func func, void *data)
+{
+	int num_bands;
+
+	if (rows <= 0)
+		return;
+
+	if (!pool || bytes < OMAP_COPY_MIN_BYTES) {
+		func(data, 0, rows);
+		return;
+	}
+
+	num_bands = pool->num_threads + 1;
+
+	pthread_mutex_lock(&pool->lock);
+
+	assert(pool->bands_pending == 0);
+
+	pool->func = func;
+	pool->data = data;
+	pool->rows = rows;
+	pool->band_rows = ALIGN((rows + num_bands - 1) / num_bands, row_align);
+	pool->num_bands = num_bands;
+	pool->next_band = 0;
+	pool->bands_pending = num_bands;
+
+	pthread_cond_broadcast(&pool->work_cond);
+
+	/* Do our share of the work instead of just sitting idle. */
+	run_bands(pool);
+
+	while (pool->bands_pending)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+
+	pool->func = NULL;
+	pool->data = NULL;
+	pool->num_bands = 0;
+	pool->next_band = 0;
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void stop_threads(struct omap_copy_pool *pool, int num_threads)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = TRUE;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+}
+
+struct omap_copy_pool *omap_copy_pool_create(ScrnInfoPtr pScrn,
+					     int num_threads)
+{
+	struct omap_copy_pool *pool;
+	sigset_t mask, old_mask;
+	int i;
+
+	if (num_threads <= 0)
+		return NULL;
+
+	pool = calloc(1, sizeof *pool);
+	if (!pool)
+		return NULL;
+
+	pool->threads = calloc(num_threads, sizeof pool->threads[0]);
+	if (!pool->threads)
+		goto error_free;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	/*
+	 * The threads inherit the signal mask. Keep the server's signal
+	 * handlers (SIGIO input, SIGALRM scheduling) on the main thread.
+	 */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   worker_thread, pool)) {
+			pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+			xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+				   "omap/video: Unable to create copy thread\n");
+			goto error_stop;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	pool->num_threads = num_threads;
+
+	return pool;
+
+ error_stop:
+	stop_threads(pool, i);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+ error_free:
+	free(pool);
+
+	return NULL;
+}
+
+void omap_copy_pool_destroy(struct omap_copy_pool *pool)
+{
+	if (!pool)
+		return;
+
+	stop_threads(pool, pool->num_threads);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+
+	free(pool->threads);
+	free(pool);
+}
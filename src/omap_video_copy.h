@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2010  Nokia Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef OMAP_VIDEO_COPY_H
+#define OMAP_VIDEO_COPY_H
+
+struct omap_copy_pool;
+
+/*
+ * Copies rows [y1, y2) of the frame described by data. Called from
+ * worker threads, so it must not touch any server state.
+ */
+typedef void (*omap_copy_band_func)(void *data, int y1, int y2);
+
+struct omap_copy_pool *omap_copy_pool_create(ScrnInfoPtr pScrn,
+					     int num_threads);
+void omap_copy_pool_destroy(struct omap_copy_pool *pool);
+
+/*
+ * Splits the rows of a frame into bands and copies them using the
+ * worker threads and the calling thread. Each band starts at a multiple
+ * of row_align rows. Returns once the whole frame has been copied.
+ * pool may be NULL in which case the copy is done synchronously.
+ */
+void omap_copy_pool_run(struct omap_copy_pool *pool,
+			int rows, int row_align, unsigned int bytes,
+			omap_copy_band_func func, void *data);
+
+#endif /* OMAP_VIDEO_COPY_H */
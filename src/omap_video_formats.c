@@ -37,6 +37,7 @@
 
 /**
  * Copy YUV422/YUY2 data with no scaling.
+ * Only the w x h rectangle at left,top is copied.
  */
 void omap_copy_packed(CARD8 * src, CARD8 * dst,
 		      int srcPitch, int dstPitch,
@@ -45,19 +46,51 @@ void omap_copy_packed(CARD8 * src, CARD8 * dst,
 		      int w, int h)
 {
 	src += top * srcPitch + (left << 1);
+	dst += top * dstPitch + (left << 1);
 
 	/* memcpy FTW on ARM. */
-	if (srcPitch == dstPitch && !left) {
-		memcpy(dst, src, srcH * srcPitch);
+	if (srcPitch == dstPitch && !left && w == srcW) {
+		memcpy(dst, src, h * srcPitch);
 	} else {
-		while (srcH--) {
-			memcpy(dst, src, srcW << 1);
+		while (h--) {
+			memcpy(dst, src, w << 1);
 			src += srcPitch;
 			dst += dstPitch;
 		}
 	}
 }
 
+static void copy_planar_rows(CARD8 * src1, CARD8 * src2, CARD8 * src3,
+			     CARD8 * dst1,
+			     int srcPitch, int srcPitch2, int dstPitch,
+			     int srcW, int rows)
+{
+	int i, j;
+
+	srcW >>= 1;
+	for (j = 0; j < rows; j++) {
+		CARD32 *dst = (CARD32 *) dst1;
+		CARD16 *s1 = (CARD16 *) src1;
+		CARD8 *s2 = src2;
+		CARD8 *s3 = src3;
+
+		for (i = 0; i < srcW; i++) {
+			*dst++ =
+			    (*s1 & 0x00ff) | ((*s1 & 0xff00) << 8) | (*s3 << 8)
+			    | (*s2 << 24);
+			s1++;
+			s2++;
+			s3++;
+		}
+		src1 += srcPitch;
+		dst1 += dstPitch;
+		if (j & 1) {
+			src2 += srcPitch2;
+			src3 += srcPitch2;
+		}
+	}
+}
+
 /**
  * Copy I420/YV12 data to YUY2, with no scaling.  Originally from kxv.c.
  */
@@ -68,8 +101,7 @@ void omap_copy_planar(CARD8 * src, CARD8 * dst,
 		      int w, int h,
 		      int id)
 {
-	int i, j;
-	CARD8 *src1, *src2, *src3, *dst1;
+	CARD8 *src1, *src2, *src3;
 
 	/* compute source data pointers */
 	src1 = src;
@@ -86,34 +118,45 @@ void omap_copy_planar(CARD8 * src, CARD8 * dst,
 		src2 = srct;
 	}
 
-	dst1 = dst;
+	copy_planar_rows(src1, src2, src3, dst,
+			 srcPitch, srcPitch2, dstPitch, srcW, srcH);
+}
 
-	srcW >>= 1;
-	for (j = 0; j < srcH; j++) {
-		CARD32 *dst = (CARD32 *) dst1;
-		CARD16 *s1 = (CARD16 *) src1;
-		CARD8 *s2 = src2;
-		CARD8 *s3 = src3;
+/**
+ * Copy rows [y1, y2) of an I420/YV12 image of height h to YUY2.
+ * y1 must be even so that the chroma rows line up.
+ */
+void omap_copy_planar_rows(CARD8 * src, CARD8 * dst,
+			   int srcPitch, int srcPitch2, int dstPitch,
+			   int srcW, int h, int y1, int y2,
+			   int id)
+{
+	CARD8 *src1, *src2, *src3;
 
-		for (i = 0; i < srcW; i++) {
-			*dst++ =
-			    (*s1 & 0x00ff) | ((*s1 & 0xff00) << 8) | (*s3 << 8)
-			    | (*s2 << 24);
-			s1++;
-			s2++;
-			s3++;
-		}
-		src1 += srcPitch;
-		dst1 += dstPitch;
-		if (j & 1) {
-			src2 += srcPitch2;
-			src3 += srcPitch2;
-		}
+	assert(!(y1 & 1));
+
+	src1 = src;
+	src2 = src1 + h * srcPitch;
+	src3 = src2 + (h >> 1) * srcPitch2;
+
+	if (id == FOURCC_I420) {
+		CARD8 *srct = src3;
+		src3 = src2;
+		src2 = srct;
 	}
+
+	src1 += y1 * srcPitch;
+	src2 += (y1 >> 1) * srcPitch2;
+	src3 += (y1 >> 1) * srcPitch2;
+	dst += y1 * dstPitch;
+
+	copy_planar_rows(src1, src2, src3, dst,
+			 srcPitch, srcPitch2, dstPitch, srcW, y2 - y1);
 }
 
 /**
  * Copy 16 bpp data with no scaling.
+ * Only the w x h rectangle at left,top is copied.
  */
 void omap_copy_16(CARD8 * src, CARD8 * dst,
 		  int srcPitch, int dstPitch,
@@ -122,13 +165,14 @@ void omap_copy_16(CARD8 * src, CARD8 * dst,
 		  int w, int h)
 {
 	src += top * srcPitch + (left << 1);
+	dst += top * dstPitch + (left << 1);
 
 	/* memcpy FTW on ARM. */
-	if (srcPitch == dstPitch && !left) {
-		memcpy(dst, src, srcH * srcPitch);
+	if (srcPitch == dstPitch && !left && w == srcW) {
+		memcpy(dst, src, h * srcPitch);
 	} else {
-		while (srcH--) {
-			memcpy(dst, src, srcW << 1);
+		while (h--) {
+			memcpy(dst, src, w << 1);
 			src += srcPitch;
 			dst += dstPitch;
 		}
@@ -137,6 +181,7 @@ void omap_copy_16(CARD8 * src, CARD8 * dst,
 
 /**
  * Copy 32 bpp data with no scaling.
+ * Only the w x h rectangle at left,top is copied.
  */
 void omap_copy_32(CARD8 * src, CARD8 * dst,
 		  int srcPitch, int dstPitch,
@@ -145,13 +190,14 @@ void omap_copy_32(CARD8 * src, CARD8 * dst,
 		  int w, int h)
 {
 	src += top * srcPitch + (left << 2);
+	dst += top * dstPitch + (left << 2);
 
 	/* memcpy FTW on ARM. */
-	if (srcPitch == dstPitch && !left) {
-		memcpy(dst, src, srcH * srcPitch);
+	if (srcPitch == dstPitch && !left && w == srcW) {
+		memcpy(dst, src, h * srcPitch);
 	} else {
-		while (srcH--) {
-			memcpy(dst, src, srcW << 2);
+		while (h--) {
+			memcpy(dst, src, w << 2);
 			src += srcPitch;
 			dst += dstPitch;
 		}
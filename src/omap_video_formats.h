@@ -39,6 +39,13 @@ void omap_copy_planar(CARD8 * src, CARD8 * dst,
 		      int w, int h,
 		      int id);
 
+/**
+ * Copy rows [y1, y2) of an I420/YV12 image of height h to YUY2.
+ */
+void omap_copy_planar_rows(CARD8 * src, CARD8 * dst,
+			   int srcPitch, int srcPitch2, int dstPitch,
+			   int srcW, int h, int y1, int y2,
+			   int id);
 
 void omap_copy_16(CARD8 * src, CARD8 * dst,
 		  int srcPitch, int dstPitch,
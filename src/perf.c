@@ -49,6 +49,7 @@ static CARD32 perfCountersCallback(OsTimerPtr timer, CARD32 time, pointer arg)
 {
 	ScrnInfoPtr pScrn = arg;
 	FBDevPtr fbdev = FBDEVPTR(pScrn);
+	unsigned long blts;
 	int i, t;
 
 	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
@@ -68,6 +69,38 @@ static CARD32 perfCountersCallback(OsTimerPtr timer, CARD32 time, pointer arg)
 	                    (perf_counters.malloc_segments +
 	                    perf_counters.shm_segments)) / (1024 * 1024));
 
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Pixmem:       %8ld REUSED\n", perf_counters.pixmem_reused);
+	for (i = 0; i < SGX_PIXMEM_CLASSES; i++)
+		if (perf_counters.pixmem_segments[i] ||
+		    perf_counters.pixmem_cached[i])
+			xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+				   "        %8u: %8ld USED      %8ld FREE\n",
+				   sgx_pixmem_class_size(i),
+				   perf_counters.pixmem_segments[i],
+				   perf_counters.pixmem_cached[i]);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Slabs:        %8ld ARENAS    %8ld PIXMAPS   %8ld KiB   %8ld MOVED\n",
+		   perf_counters.slab_arenas, perf_counters.slab_pixmaps,
+		   perf_counters.slab_bytes >> 10, perf_counters.slab_moved);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Promotion:    %8ld PROMOTED  %8ld DEMOTED   %8ld KiB\n",
+		   perf_counters.promoted, perf_counters.demoted,
+		   perf_counters.promoted_bytes >> 10);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Locked:       %8ld KiB       %8d KiB LIMIT %8ld RECLAIM   %8ld REFUSED\n",
+		   perf_counters.locked_bytes >> 10,
+		   fbdev->conf.locked_memory << 10,
+		   perf_counters.locked_reclaim, perf_counters.locked_refused);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Huge pages:   %8ld SEGMENTS  %8ld KiB       %8ld ADVISED\n",
+		   perf_counters.huge_segments, perf_counters.huge_bytes >> 10,
+		   perf_counters.huge_advised);
+
 	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
 		   "Solid:        %8ld HW        %8ld SW        %8ld ALL\n",
 		   perf_counters.hw_solid, perf_counters.sw_solid,
@@ -89,8 +122,69 @@ static CARD32 perfCountersCallback(OsTimerPtr timer, CARD32 time, pointer arg)
 				   perf_counters.copy_alu[i]);
 
 	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-		   "Cache:        %8ld FLUSH     %8ld INVAL\n",
-		   perf_counters.cache_flush, perf_counters.cache_inval);
+		   "Composite:    %8ld HW        %8ld SW\n",
+		   perf_counters.hw_composite, perf_counters.sw_composite);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Glyphs:       %8ld HIT       %8ld MISS      %8ld EVICT\n",
+		   perf_counters.glyph_hit, perf_counters.glyph_miss,
+		   perf_counters.glyph_evict);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Glyphs:       %8ld HW        %8ld SW        %8ld FALLBACK RUNS\n",
+		   perf_counters.glyph_hw, perf_counters.glyph_sw,
+		   perf_counters.glyph_fallback);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Deferred:     %8ld REQUESTS\n", perf_counters.client_wait);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Cache:        %8ld FLUSH     %8ld INVAL     %8ld KiB FLUSHED\n",
+		   perf_counters.cache_flush, perf_counters.cache_inval,
+		   perf_counters.cache_flush_bytes >> 10);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Transfer:     %8ld UP  %8ld KiB %8ld DOWN %8ld KiB\n",
+		   perf_counters.upload, perf_counters.upload_bytes >> 10,
+		   perf_counters.download, perf_counters.download_bytes >> 10);
+
+	blts = perf_counters.blt_cache_hit + perf_counters.blt_cache_miss;
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Blit cache:   %8ld HIT       %8ld MISS      %7ld%% HIT\n",
+		   perf_counters.blt_cache_hit, perf_counters.blt_cache_miss,
+		   blts ? perf_counters.blt_cache_hit * 100 / blts : 0);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Overlay:      %8ld COMMIT    %8ld IOCTL\n",
+		   perf_counters.ovl_commits, perf_counters.ovl_ioctls);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Cursor:       %8ld MOVES     %8ld EVICTED\n",
+		   perf_counters.cursor_moves, perf_counters.cursor_evicted);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Ovl swap:     %8ld SWAPS     %8ld BLITS     %8ld EVICTED\n",
+		   perf_counters.ovl_swaps, perf_counters.ovl_swap_blits,
+		   perf_counters.ovl_swap_evicted);
+
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Back pool:    %8ld HIT       %8ld MISS      %8ld TRIMMED\n",
+		   perf_counters.back_pool_hit, perf_counters.back_pool_miss,
+		   perf_counters.back_pool_trimmed);
+
+	for (i = 0; i < ARRAY_SIZE(fbdev->fb); i++) {
+		struct omap_fb_stats stats;
+
+		omap_fb_get_stats(fbdev->fb[i], &stats);
+		if (!stats.size)
+			continue;
+
+		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+			   "FB%d: %6u KiB %6u USED %6u SLACK %8lu RESIZE %8lu REALLOC\n",
+			   i, stats.size >> 10, stats.used >> 10,
+			   (stats.size - stats.used) >> 10,
+			   stats.resizes, stats.reallocs);
+	}
 
 	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
 		   "Fallback: %8ld GXcopy %8ld bitsPerPixel %8ld isSolid\n",
@@ -104,12 +198,25 @@ static CARD32 perfCountersCallback(OsTimerPtr timer, CARD32 time, pointer arg)
 		   perf_counters.fallback_solid_getFormatDst);
 
 	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-		   "Fallback: Copy: %8ld validateSrc %8ld validateDst %8ld getFormatSrc %8ld getFormatDst\n\n",
+		   "Fallback: Copy: %8ld validateSrc %8ld validateDst %8ld getFormatSrc %8ld getFormatDst\n",
 		   perf_counters.fallback_copy_validateSrc,
 		   perf_counters.fallback_copy_validateDst,
 		   perf_counters.fallback_copy_getFormatSrc,
 		   perf_counters.fallback_copy_getFormatDst);
 
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Fallback: Composite: %8ld op %8ld format %8ld filter %8ld transform %8ld componentAlpha %8ld alphaMap %8ld sourcePict %8ld maskIsSource %8ld validate %8ld prepare\n\n",
+		   perf_counters.fallback_composite_op,
+		   perf_counters.fallback_composite_format,
+		   perf_counters.fallback_composite_filter,
+		   perf_counters.fallback_composite_transform,
+		   perf_counters.fallback_composite_componentAlpha,
+		   perf_counters.fallback_composite_alphaMap,
+		   perf_counters.fallback_composite_sourcePict,
+		   perf_counters.fallback_composite_maskIsSource,
+		   perf_counters.fallback_composite_validate,
+		   perf_counters.fallback_composite_prepare);
+
 	if (xf86IsOptionSet(fbdev->Options, OPTION_PERF_RESET))
 		memset(&perf_counters, 0, sizeof(struct sgx_perf_counters));
 
@@ -24,6 +24,7 @@
 #define PERF_H
 
 #include "fbdev.h"
+#include "sgx_pixmem.h"
 
 #ifdef PERF
 #define PERF_INCREMENT(x)	(perf_counters.x++)
@@ -42,8 +43,25 @@ struct sgx_perf_counters {
 	unsigned long sw_solid;	/* software solid fill operation */
 	unsigned long hw_copy;	/* hardware copy operation */
 	unsigned long sw_copy;	/* software copy operation */
+	unsigned long hw_composite;	/* hardware composite operation */
+	unsigned long sw_composite;	/* composite left to software by cost */
 	unsigned long cache_flush;	/* cache flush operation */
 	unsigned long cache_inval;	/* cache invalidate operation */
+	unsigned long cache_flush_bytes;
+	unsigned long upload;	/* UploadToScreen operation */
+	unsigned long upload_bytes;
+	unsigned long download;	/* DownloadFromScreen operation */
+	unsigned long download_bytes;
+	unsigned long blt_cache_hit;	/* prepared blit descriptor reused */
+	unsigned long blt_cache_miss;	/* blit descriptor prepared */
+	/* glyph atlas */
+	unsigned long glyph_hit;	/* glyph found in the atlas */
+	unsigned long glyph_miss;	/* glyph copied into the atlas */
+	unsigned long glyph_evict;	/* glyph replaced in the atlas */
+	unsigned long glyph_hw;	/* glyph added to a mask by the GPU */
+	unsigned long glyph_sw;	/* glyph added to a mask by the CPU */
+	unsigned long glyph_fallback;	/* glyph run left to EXA */
+	unsigned long client_wait;	/* request deferred until the GPU is done */
 	/* solid fill and copy ALU operation counters */
 	unsigned long solid_alu[GXset + 1];
 	unsigned long copy_alu[GXset + 1];
@@ -60,11 +78,51 @@ struct sgx_perf_counters {
 	unsigned long fallback_copy_validateDst;
 	unsigned long fallback_copy_getFormatDst;
 
+	unsigned long fallback_composite_op;
+	unsigned long fallback_composite_format;
+	unsigned long fallback_composite_filter;
+	unsigned long fallback_composite_transform;
+	unsigned long fallback_composite_componentAlpha;
+	unsigned long fallback_composite_alphaMap;
+	unsigned long fallback_composite_sourcePict;
+	unsigned long fallback_composite_maskIsSource;
+	unsigned long fallback_composite_validate;
+	unsigned long fallback_composite_prepare;
+
 	/* system resource counters */
 	unsigned long malloc_bytes;
 	unsigned long malloc_segments;
 	unsigned long shm_bytes;
 	unsigned long shm_segments;
+	/* malloc() pixmap memory by size class */
+	unsigned long pixmem_segments[SGX_PIXMEM_CLASSES];	/* in use */
+	unsigned long pixmem_cached[SGX_PIXMEM_CLASSES];	/* free */
+	unsigned long pixmem_reused;	/* allocation served from a free list */
+	unsigned long slab_arenas;
+	unsigned long slab_pixmaps;
+	unsigned long slab_bytes;
+	unsigned long slab_moved;	/* pixmap moved out of its arena */
+	unsigned long promoted;	/* malloc() pixmap moved to SHM */
+	unsigned long promoted_bytes;
+	unsigned long demoted;	/* promoted pixmap moved back */
+	unsigned long locked_bytes;	/* SHM_LOCKed memory */
+	unsigned long locked_reclaim;	/* locked memory budget exceeded */
+	unsigned long locked_refused;	/* SHM refused after reclaiming */
+	unsigned long huge_segments;	/* SHM from the huge page pool */
+	unsigned long huge_bytes;
+	unsigned long huge_advised;	/* transparent huge pages requested */
+
+	/* overlay state commits and the ioctls they issued */
+	unsigned long ovl_commits;
+	unsigned long ovl_ioctls;
+	unsigned long cursor_moves;	/* cursor overlay moved */
+	unsigned long cursor_evicted;	/* cursor overlay taken by others */
+	unsigned long ovl_swaps;	/* DRI2 swaps done by panning an overlay */
+	unsigned long ovl_swap_blits;	/* overlay swap buffers copied instead */
+	unsigned long ovl_swap_evicted;	/* DRI2 swap overlay taken by others */
+	unsigned long back_pool_hit;	/* DRI2 back buffer taken from the pool */
+	unsigned long back_pool_miss;
+	unsigned long back_pool_trimmed;	/* pooled back buffer freed */
 };
 
 extern struct sgx_perf_counters perf_counters;
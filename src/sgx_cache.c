@@ -24,27 +24,15 @@
 #include "sgx_pvr2d.h"
 #include <services.h>
 #include "sgx_pvr2d_alloc.h"
+#include "sgx_pixmem.h"
+#include "perf.h"
 
-typedef struct _segments {
-	int count;		//current number of elements on the list;
-	int maxsize;		//maximum number of elements on the list
-	struct PVR2DPixmap *table;
-} cache_segment;
-
-/*
- * we keep a pool of SHM segments for a few, small and frequently used segment
- * sizes
- */
-#define NUM_CACHE_SEGS	2
-static cache_segment segments[NUM_CACHE_SEGS];
-static int default_window_size;
-
-static unsigned CacheSegmentGetId(int size)
+static unsigned CacheSegmentGetId(struct sgx_cache *cache, int size)
 {
 
-	if (size == default_window_size) {
+	if (size == cache->default_window_size) {
 		return 0;
-	} else if (size == 2*default_window_size) {
+	} else if (size == 2*cache->default_window_size) {
 		return 1;
 	}
 	return (unsigned)-1;
@@ -69,13 +57,23 @@ static void CleanupCacheSegment(cache_segment * seg)
 		if (seg->table[i].shmaddr) {
 			shmdt(seg->table[i].shmaddr);
 			shmctl(seg->table[i].shmid, IPC_RMID, NULL);
+			PVR2DUnlockSHM(seg->table[i].screen,
+				       seg->table[i].shmsize);
+			PERF_DECREMENT2(shm_bytes, seg->table[i].shmsize);
+			PERF_DECREMENT(shm_segments);
+			if (seg->table[i].huge) {
+				PERF_DECREMENT2(huge_bytes,
+						seg->table[i].shmsize);
+				PERF_DECREMENT(huge_segments);
+			}
 		}
 		if (seg->table[i].pvr2dmem) {
-			PVR2DMemFree(pvr2d_get_screen()->context,
+			PVR2DMemFree(seg->table[i].screen->context,
 				     seg->table[i].pvr2dmem);
 		}
 		if (seg->table[i].mallocaddr) {
-			free(seg->table[i].mallocaddr);
+			sgx_pixmem_free(seg->table[i].mallocaddr,
+					seg->table[i].mallocsize);
 		}
 	}
 	seg->count = 0;
@@ -94,36 +92,36 @@ static void DeInitCacheSegment(cache_segment * seg)
 	seg->maxsize = 0;
 }
 
-void SetWindowSizeSharedSegments(int window_size)
+void SetWindowSizeSharedSegments(struct sgx_cache *cache, int window_size)
 {
-	default_window_size = ALIGN(window_size, page_size);
+	cache->default_window_size = ALIGN(window_size, page_size);
 }
 
-int InitSharedSegments(void)
+int InitSharedSegments(struct sgx_cache *cache)
 {
 	int i;
 	int ret = 0;
 
 	for (i = 0; i < NUM_CACHE_SEGS; i++)
-		ret |= InitCacheSegment(&segments[i], 6);
+		ret |= InitCacheSegment(&cache->segments[i], 6);
 
 	return ret;
 }
 
-void DeInitSharedSegments(void)
+void DeInitSharedSegments(struct sgx_cache *cache)
 {
 	int i;
 
 	for (i = 0; i < NUM_CACHE_SEGS; i++)
-		DeInitCacheSegment(&segments[i]);
+		DeInitCacheSegment(&cache->segments[i]);
 }
 
-void CleanupSharedSegments(void)
+void CleanupSharedSegments(struct sgx_cache *cache)
 {
 	int i;
 
 	for (i = 0; i < NUM_CACHE_SEGS; i++)
-		CleanupCacheSegment(&segments[i]);
+		CleanupCacheSegment(&cache->segments[i]);
 }
 
 /*
@@ -134,9 +132,9 @@ void CleanupSharedSegments(void)
  * 	0:	SHM has not been added
  * 	1:	SHM has been stored in cache
  */
-int AddToCache(struct PVR2DPixmap *ppix)
+int AddToCache(struct sgx_cache *cache, struct PVR2DPixmap *ppix)
 {
-	unsigned cache_id = CacheSegmentGetId(ppix->shmsize);
+	unsigned cache_id = CacheSegmentGetId(cache, ppix->shmsize);
 	CALLTRACE("%s: Start %i\n", __func__, cache_id);
 	if ((ppix->shmid < 0) || (!ppix->shmaddr))
 		return 0;
@@ -155,7 +153,7 @@ int AddToCache(struct PVR2DPixmap *ppix)
 	CALLTRACE("%s: Mid 1\n", __func__);
 	CALLTRACE("%s: Mid 2\n", __func__);
 
-	cache_segment *seg = &segments[cache_id];
+	cache_segment *seg = &cache->segments[cache_id];
 	CALLTRACE("%s: Seg %p \n", __func__, seg);
 	CALLTRACE("%s: count %i, maxsize %i\n", __func__, seg->count,
 		  seg->maxsize);
@@ -180,9 +178,9 @@ int AddToCache(struct PVR2DPixmap *ppix)
  *      1:      a segment has been found and the outputs have been filled
  */
 
-int GetFromCache(struct PVR2DPixmap *ppix)
+int GetFromCache(struct sgx_cache *cache, struct PVR2DPixmap *ppix)
 {
-	unsigned cache_id = CacheSegmentGetId(ppix->shmsize);
+	unsigned cache_id = CacheSegmentGetId(cache, ppix->shmsize);
 	CALLTRACE("%s: Start %i\n", __func__, cache_id);
 
 	// check if segments of this size are cached
@@ -193,7 +191,7 @@ int GetFromCache(struct PVR2DPixmap *ppix)
 
 	CALLTRACE("%s: Mid %i\n", __func__, cache_id);
 	CALLTRACE("%s: Mid 2 %i\n", __func__, cache_id);
-	cache_segment *seg = &segments[cache_id];
+	cache_segment *seg = &cache->segments[cache_id];
 	CALLTRACE("%s: Seg %p \n", __func__, seg);
 	CALLTRACE("%s: count %i, maxsize %i\n", __func__, seg->count, seg->maxsize);
 
@@ -25,11 +25,29 @@
 #define SGX_CACHE_H 1
 
 struct PVR2DPixmap;
-int InitSharedSegments(void);
-void SetWindowSizeSharedSegments(int window_size);
-void DeInitSharedSegments(void);
-void CleanupSharedSegments(void);
-int AddToCache(struct PVR2DPixmap *ppix);
-int GetFromCache(struct PVR2DPixmap *ppix);
+
+typedef struct _segments {
+	int count;		//current number of elements on the list;
+	int maxsize;		//maximum number of elements on the list
+	struct PVR2DPixmap *table;
+} cache_segment;
+
+/*
+ * we keep a pool of SHM segments for a few, small and frequently used segment
+ * sizes
+ */
+#define NUM_CACHE_SEGS	2
+
+struct sgx_cache {
+	cache_segment segments[NUM_CACHE_SEGS];
+	int default_window_size;
+};
+
+int InitSharedSegments(struct sgx_cache *cache);
+void SetWindowSizeSharedSegments(struct sgx_cache *cache, int window_size);
+void DeInitSharedSegments(struct sgx_cache *cache);
+void CleanupSharedSegments(struct sgx_cache *cache);
+int AddToCache(struct sgx_cache *cache, struct PVR2DPixmap *ppix);
+int GetFromCache(struct sgx_cache *cache, struct PVR2DPixmap *ppix);
 
 #endif /* SGX_CACHE_H */
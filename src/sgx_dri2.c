@@ -26,6 +26,7 @@
 
 #include <dri2.h>
 #include <pvr2d.h>
+#include <X11/extensions/dpmsconst.h>
 
 #include "extfb.h"
 #include "sgx_dri2.h"
@@ -36,6 +37,7 @@
 #include "sgx_exa_user.h"
 #include "extfb.h"
 #include "flip_stats.h"
+#include "perf.h"
 #include "linux/omapfb.h"
 
 #include <stdbool.h>
@@ -53,6 +55,81 @@ struct pvr2d_buf_priv {
 struct dri2_swap_request *swap_reqs_head;
 struct dri2_swap_request *swap_reqs_tail;
 
+/*
+ * Private back buffers given up by drawables, most recently used
+ * first. They are already in SHM and wrapped for the GPU, so a new
+ * back buffer of the same size is just taken from here. This saves
+ * the allocation and the SHM migration copy when windows are resized
+ * or move in and out of fullscreen.
+ */
+#define BACK_POOL_SIZE 4
+
+static PixmapPtr back_pool[BACK_POOL_SIZE];
+
+static PixmapPtr back_pool_get(DrawablePtr draw)
+{
+	PixmapPtr pixmap;
+	int i;
+
+	for (i = 0; i < BACK_POOL_SIZE && back_pool[i]; i++) {
+		pixmap = back_pool[i];
+
+		if (pixmap->drawable.width == draw->width &&
+		    pixmap->drawable.height == draw->height &&
+		    pixmap->drawable.depth == draw->depth)
+			break;
+	}
+
+	if (i == BACK_POOL_SIZE || !back_pool[i]) {
+		PERF_INCREMENT(back_pool_miss);
+		return NULL;
+	}
+
+	memmove(&back_pool[i], &back_pool[i + 1],
+		(BACK_POOL_SIZE - i - 1) * sizeof(back_pool[0]));
+	back_pool[BACK_POOL_SIZE - 1] = NULL;
+
+	PERF_INCREMENT(back_pool_hit);
+
+	return pixmap;
+}
+
+/* Releases the back buffer pixmap, keeping it for reuse if possible */
+static void back_pool_put(PixmapPtr pixmap)
+{
+	ScreenPtr pScreen = pixmap->drawable.pScreen;
+
+	/* Page flip and overlay swap buffers are referenced elsewhere */
+	if (pixmap->refcnt != 1) {
+		(*pScreen->DestroyPixmap)(pixmap);
+		return;
+	}
+
+	/* Drop the least recently used one */
+	if (back_pool[BACK_POOL_SIZE - 1]) {
+		(*pScreen->DestroyPixmap)(back_pool[BACK_POOL_SIZE - 1]);
+		PERF_INCREMENT(back_pool_trimmed);
+	}
+
+	memmove(&back_pool[1], &back_pool[0],
+		(BACK_POOL_SIZE - 1) * sizeof(back_pool[0]));
+	back_pool[0] = pixmap;
+}
+
+/* Gives the pooled back buffers back, the locked memory may be needed */
+void dri2_back_pool_trim(void)
+{
+	int i;
+
+	for (i = 0; i < BACK_POOL_SIZE && back_pool[i]; i++) {
+		ScreenPtr pScreen = back_pool[i]->drawable.pScreen;
+
+		(*pScreen->DestroyPixmap)(back_pool[i]);
+		back_pool[i] = NULL;
+		PERF_INCREMENT(back_pool_trimmed);
+	}
+}
+
 static PixmapPtr get_drawable_pixmap(DrawablePtr draw)
 {
 	ScreenPtr screen = draw->pScreen;
@@ -77,17 +154,21 @@ static int pvr2d_dri2_get_non_sys_buf(DrawablePtr draw,
 	if (buf->attachment == DRI2BufferFrontLeft) {
 		priv->pixmap = get_drawable_pixmap(draw);
 		priv->pixmap->refcnt++;
-	} else
-		priv->pixmap = (*screen->CreatePixmap)(screen,
+	} else {
+		priv->pixmap = back_pool_get(draw);
+		if (!priv->pixmap)
+			priv->pixmap = (*screen->CreatePixmap)(screen,
 					draw->width, draw->height,
 					draw->depth,
 					CREATE_PIXMAP_USAGE_BACKING_PIXMAP);
+	}
 
 	if (!priv->pixmap)
 		return 1;
 
 	pix = exaGetPixmapDriverPrivate(priv->pixmap);
 
+	/* Cheap for a pooled pixmap, unless its GPU mapping was reclaimed */
 	if (!pvr2d_dri2_migrate_pixmap(priv->pixmap, pix)) {
 		/* clean up pixmaps we might have allocated */
 		(*screen->DestroyPixmap)(priv->pixmap);
@@ -106,7 +187,8 @@ static int pvr2d_dri2_get_non_sys_buf(DrawablePtr draw,
 static void pvr2d_dri2_get_sys_buf(DrawablePtr draw,
 				   DRI2BufferPtr buf)
 {
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
+	struct pvr2d_page_flip *page_flip =
+		&pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen))->page_flip;
 	struct pvr2d_buf_priv *priv = buf->driverPrivate;
 
 	if (buf->attachment == DRI2BufferFrontLeft) {
@@ -155,6 +237,8 @@ static void kill_swap_req(struct dri2_swap_request *req);
 static void swap_reqs_drop_last(void);
 static struct dri2_swap_request *swap_reqs_find_by_update(unsigned int idx);
 static Bool swap_req_dequeue(struct dri2_swap_request *req);
+static void ovl_swap_kill_reqs(ScrnInfoPtr pScrn);
+static void ovl_swap_queue(ScrnInfoPtr pScrn, struct dri2_swap_request *req);
 static void pvr2d_dri2_update_front(struct pvr2d_page_flip *page_flip,
 				    ScrnInfoPtr pScrn,
 				    unsigned int new_front_idx);
@@ -255,7 +339,10 @@ static void pvr2d_dri2_migrate_to_fs(DrawablePtr draw, DRI2BufferPtr buf)
 				    &priv->pixmap->drawable);
 	}
 
-	(*draw->pScreen->DestroyPixmap)(old_pixmap);
+	if (buf->attachment == DRI2BufferBackLeft)
+		back_pool_put(old_pixmap);
+	else
+		(*draw->pScreen->DestroyPixmap)(old_pixmap);
 }
 
 static bool page_flip_possible(struct pvr2d_page_flip *page_flip,
@@ -278,38 +365,549 @@ static DrawablePtr pvr2d_dri2_choose_drawable(DrawablePtr draw,
 	return &priv->pixmap->drawable;
 }
 
-static void poison_buffer(DrawablePtr draw, DRI2BufferPtr buffer,
-			  CARD8 red, CARD8 green, CARD8 blue)
+/* Fills a drawable sized area at the top left corner of dst */
+static void fill_drawable(DrawablePtr draw, DrawablePtr dst, CARD32 pixel)
 {
-	ScreenPtr pScreen = draw->pScreen;
-	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	xRectangle rect = {
 		.width = draw->width,
 		.height = draw->height,
 	};
 	ChangeGCVal val = {
-		.val = fbdev_rgb_to_pixel(pScrn, red, green, blue),
+		.val = pixel,
 	};
 	GCPtr gc;
 
-	draw = pvr2d_dri2_choose_drawable(draw, buffer);
-
-	gc = GetScratchGC(draw->depth, pScreen);
+	gc = GetScratchGC(dst->depth, dst->pScreen);
 	ChangeGC(NullClient, gc, GCForeground, &val);
-	ValidateGC(draw, gc);
+	ValidateGC(dst, gc);
 
-	(*gc->ops->PolyFillRect)(draw, gc, 1, &rect);
+	(*gc->ops->PolyFillRect)(dst, gc, 1, &rect);
 
 	FreeScratchGC(gc);
 }
 
+static void poison_buffer(DrawablePtr draw, DRI2BufferPtr buffer,
+			  CARD8 red, CARD8 green, CARD8 blue)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(draw->pScreen);
+
+	fill_drawable(draw, pvr2d_dri2_choose_drawable(draw, buffer),
+		      fbdev_rgb_to_pixel(pScrn, red, green, blue));
+}
+
+/*
+ * Overlay swaps. A window which isn't fullscreen, but is unobscured and
+ * covers most of a CRTC, renders into buffers in the framebuffer memory
+ * which a video overlay scans out on top of the window. Swapping just
+ * points the overlay at the new back buffer. The window itself holds
+ * the colorkey meanwhile and only gets a real frame when the drawable
+ * moves off the overlay.
+ */
+
+/* Same as the Xv default so that both can use the output colorkey */
+static CARD32 ovl_ckey(ScrnInfoPtr pScrn)
+{
+	return fbdev_rgb_to_pixel(pScrn, 0x00, 0xff, 0x00);
+}
+
+static Bool ovl_xv_active(FBDevPtr fbdev)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fbdev->ovl_usage); i++)
+		if (fbdev->ovl_usage[i] == FBDEV_OVERLAY_USAGE_XV ||
+		    fbdev->ovl_usage[i] == FBDEV_OVERLAY_USAGE_XV1 ||
+		    fbdev->ovl_usage[i] == FBDEV_OVERLAY_USAGE_XV2)
+			return TRUE;
+
+	return FALSE;
+}
+
+/*
+ * Consider if the given drawable can be scanned out by an overlay.
+ * Returns the CRTC it is on, or NULL.
+ */
+static xf86CrtcPtr pvr2d_dri2_ovl_capable(struct pvr2d_page_flip *ovl_swap,
+					  DrawablePtr draw)
+{
+	ScreenPtr pScreen = draw->pScreen;
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	FBDevPtr fbdev = FBDEVPTR(pScrn);
+	xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(pScrn);
+	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen(pScrn)->page_flip;
+	RegionPtr clip;
+	BoxRec box;
+	int i;
+
+	if (!ovl_swap->num_bufs)
+		return NULL;
+
+	if (fbdev->conf.swap_control != DRI2_SWAP_CONTROL_FLIP)
+		return NULL;
+
+	if (draw->type != DRAWABLE_WINDOW || draw->depth != pScrn->depth)
+		return NULL;
+
+	/* Fullscreen windows get flipped instead */
+	if (pvr2d_dri2_fs_flip_capable(page_flip, draw))
+		return NULL;
+
+	/* Redirected windows aren't on the screen */
+	if (get_drawable_pixmap(draw) != (*pScreen->GetScreenPixmap)(pScreen))
+		return NULL;
+
+	box.x1 = draw->x;
+	box.y1 = draw->y;
+	box.x2 = draw->x + draw->width;
+	box.y2 = draw->y + draw->height;
+
+	/* Nothing may be on top of the window */
+	clip = &((WindowPtr)draw)->clipList;
+	if (RegionNumRects(clip) != 1 ||
+	    memcmp(RegionExtents(clip), &box, sizeof(box)))
+		return NULL;
+
+	for (i = 0; i < config->num_crtc; i++) {
+		xf86CrtcPtr crtc = config->crtc[i];
+		struct fbdev_crtc *crtc_priv = crtc->driver_private;
+		int w, h;
+
+		if (!crtc->enabled || crtc_priv->dpms != DPMSModeOn)
+			continue;
+
+		w = xf86ModeWidth(&crtc->mode, crtc->rotation);
+		h = xf86ModeHeight(&crtc->mode, crtc->rotation);
+
+		if (box.x1 < crtc->x || box.y1 < crtc->y ||
+		    box.x2 > crtc->x + w || box.y2 > crtc->y + h)
+			continue;
+
+		/* Smaller windows are cheap enough to copy */
+		if (2 * draw->width * draw->height < w * h)
+			continue;
+
+		return crtc;
+	}
+
+	return NULL;
+}
+
+static bool ovl_swap_possible(struct pvr2d_page_flip *ovl_swap,
+			      DrawablePtr draw)
+{
+	return (!ovl_swap->user_priv || ovl_swap->user_priv == draw) &&
+		pvr2d_dri2_ovl_capable(ovl_swap, draw);
+}
+
+static Bool dri2_buffer_is_ovl(struct pvr2d_page_flip *ovl_swap,
+			       DRI2BufferPtr buffer)
+{
+	return buffer->attachment == DRI2BufferBackLeft &&
+		buffer == ovl_swap->bufs[ovl_swap->back_idx].user_priv;
+}
+
+static Bool ovl_plane_get(ScrnInfoPtr pScrn)
+{
+	struct sgx_ovl_plane *plane = &pvr2d_get_screen(pScrn)->ovl_plane;
+	FBDevPtr fbdev = FBDEVPTR(pScrn);
+
+	if (plane->ovl)
+		return TRUE;
+
+	plane->ovl = fbdev_get_overlay(pScrn, FBDEV_OVERLAY_USAGE_DRI2);
+	if (!plane->ovl)
+		return FALSE;
+
+	if (!omap_fb_assign_overlay(fbdev->fb[0], plane->ovl) ||
+	    !omap_overlay_global_alpha(plane->ovl, 255)) {
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			   "Unable to set up DRI2 swap overlay\n");
+		fbdev_put_overlay(pScrn, plane->ovl);
+		plane->ovl = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void ovl_plane_hide(ScrnInfoPtr pScrn)
+{
+	struct sgx_ovl_plane *plane = &pvr2d_get_screen(pScrn)->ovl_plane;
+	xf86OutputPtr output;
+
+	if (!plane->crtc)
+		return;
+
+	omap_overlay_disable(plane->ovl);
+
+	/* Xv may still need the colorkey */
+	output = fbdev_crtc_get_output(plane->crtc);
+	if (output && plane->ckey && !ovl_xv_active(FBDEVPTR(pScrn))) {
+		struct fbdev_output *output_priv = output->driver_private;
+
+		omap_output_color_key(output_priv->out, false, 0);
+	}
+
+	fbdev_update_outputs(pScrn, &plane->box);
+
+	plane->crtc = NULL;
+	plane->ckey = FALSE;
+}
+
+static void ovl_plane_put(ScrnInfoPtr pScrn)
+{
+	struct sgx_ovl_plane *plane = &pvr2d_get_screen(pScrn)->ovl_plane;
+
+	if (!plane->ovl)
+		return;
+
+	ovl_plane_hide(pScrn);
+
+	fbdev_put_overlay(pScrn, plane->ovl);
+	plane->ovl = NULL;
+}
+
+/* Shows overlay swap buffer idx on top of the drawable */
+static Bool ovl_plane_show(ScrnInfoPtr pScrn, DrawablePtr draw,
+			   xf86CrtcPtr crtc, unsigned int idx)
+{
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
+	xf86OutputPtr output = fbdev_crtc_get_output(crtc);
+	struct fbdev_output *output_priv;
+	enum omap_mirror mirror = OMAP_MIRROR_NONE;
+	enum omap_rotate rotate = OMAP_ROTATE_0;
+	unsigned int buffer = screen->ovl_swap_fb_idx + idx;
+	unsigned int dx, dy, dw, dh;
+	BoxRec box;
+
+	if (!output || !ovl_plane_get(pScrn))
+		return FALSE;
+
+	output_priv = output->driver_private;
+
+	box.x1 = draw->x;
+	box.y1 = draw->y;
+	box.x2 = draw->x + draw->width;
+	box.y2 = draw->y + draw->height;
+
+	if (plane->crtc != crtc) {
+		ovl_plane_hide(pScrn);
+
+		if (!omap_output_assign_overlay(output_priv->out,
+						plane->ovl))
+			goto error;
+
+		plane->crtc = crtc;
+
+		/* With alpha blending the overlay is on top anyway */
+		if (!output_priv->alpha_mode) {
+			CARD32 key = ovl_ckey(pScrn) & (pScrn->mask.red |
+							pScrn->mask.green |
+							pScrn->mask.blue);
+
+			if (!omap_output_color_key(output_priv->out,
+						   true, key))
+				goto error;
+
+			plane->ckey = TRUE;
+			plane->ckey_dirty = TRUE;
+		}
+	}
+
+	if (omap_overlay_enabled(plane->ovl) &&
+	    !memcmp(&box, &plane->box, sizeof(box))) {
+		if (!omap_overlay_pan(plane->ovl, buffer, 0, 0,
+				      draw->width, draw->height))
+			goto error;
+	} else {
+		/* Same as the CRTC overlay, see crtc_set_mode_major() */
+		if (!fbdev_output_check_rotation(output, crtc->rotation)) {
+			mirror = fbdev_rr_to_omap_mirror(crtc->rotation);
+			rotate = fbdev_rr_to_omap_rotate(crtc->rotation);
+		}
+
+		fbdev_crtc_output_coords(crtc, &box, &dx, &dy, &dw, &dh);
+
+		if (!omap_overlay_setup(plane->ovl, buffer, 0, 0,
+					draw->width, draw->height,
+					dx, dy, dw, dh, mirror, rotate))
+			goto error;
+
+		if (!omap_overlay_enabled(plane->ovl) &&
+		    !omap_overlay_enable(plane->ovl))
+			goto error;
+	}
+
+	plane->box = box;
+
+	fbdev_update_outputs(pScrn, &box);
+
+	return TRUE;
+
+ error:
+	xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+		   "Unable to show DRI2 swap overlay\n");
+	ovl_plane_hide(pScrn);
+	return FALSE;
+}
+
+/* Copies the latest frame into the window */
+static void ovl_swap_restore(ScrnInfoPtr pScrn)
+{
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
+	struct pvr2d_page_flip *ovl_swap = &screen->ovl_swap;
+	DrawablePtr draw = ovl_swap->user_priv;
+	RegionRec reg;
+
+	if (!draw || !plane->stale)
+		return;
+
+	sgx_exa_set_reg(draw, &reg);
+	sgx_exa_copy_region(draw, &reg,
+			    &ovl_swap->bufs[ovl_swap->front_idx].pixmap->drawable,
+			    draw);
+
+	plane->stale = FALSE;
+	plane->ckey_dirty = TRUE;
+}
+
+static Bool ovl_swap_restore_work(ClientPtr client, pointer closure)
+{
+	struct sgx_ovl_plane *plane = &pvr2d_get_screen(closure)->ovl_plane;
+
+	if (!plane->restore_queued)
+		return TRUE;
+
+	plane->restore_queued = FALSE;
+
+	/* Back on the overlay already? */
+	if (!plane->crtc)
+		ovl_swap_restore(closure);
+
+	return TRUE;
+}
+
+/*
+ * Window trees are being validated, or an overlay is being taken,
+ * when the drawable is forced off the overlay. Fix up the window
+ * contents once that's done.
+ */
+static void ovl_swap_queue_restore(ScrnInfoPtr pScrn)
+{
+	struct sgx_ovl_plane *plane = &pvr2d_get_screen(pScrn)->ovl_plane;
+
+	if (!plane->stale || plane->restore_queued)
+		return;
+
+	if (QueueWorkProc(ovl_swap_restore_work, NULL, pScrn))
+		plane->restore_queued = TRUE;
+}
+
+static void pvr2d_dri2_get_ovl_buf(DrawablePtr draw, DRI2BufferPtr buf)
+{
+	struct pvr2d_page_flip *ovl_swap =
+		&pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen))->ovl_swap;
+	struct pvr2d_buf_priv *priv = buf->driverPrivate;
+
+	assert(buf->attachment == DRI2BufferBackLeft);
+
+	buf->name = (unsigned) ovl_swap->bufs[ovl_swap->back_idx].mem_handle;
+	ovl_swap->bufs[ovl_swap->back_idx].user_priv = buf;
+	ovl_swap->user_priv = draw;
+
+	priv->pixmap = ovl_swap->bufs[ovl_swap->back_idx].pixmap;
+	priv->pixmap->refcnt++;
+
+	/* Same as the fullscreen flip buffers */
+	buf->flags = PVR2D_MEMORY;
+	buf->pitch = ovl_swap->stride;
+	buf->cpp = ovl_swap->bpp / 8;
+}
+
+/*
+ * Try to copy the contents of the private back buffer into the overlay
+ * swap back buffer and release the private one.
+ */
+static void pvr2d_dri2_migrate_to_ovl(DrawablePtr draw, DRI2BufferPtr buf)
+{
+	struct pvr2d_buf_priv *priv = buf->driverPrivate;
+	PixmapPtr old_pixmap = priv->pixmap;
+
+	pvr2d_dri2_get_ovl_buf(draw, buf);
+
+	/* There is nothing to do if one fails in the copy. */
+	if (priv->reserved) {
+		RegionRec reg;
+
+		sgx_exa_set_reg(draw, &reg);
+		sgx_exa_copy_region(draw, &reg,
+				    &old_pixmap->drawable,
+				    &priv->pixmap->drawable);
+	}
+
+	back_pool_put(old_pixmap);
+}
+
+/*
+ * The drawable gives up the overlay swap buffers. Swaps still in flight
+ * are completed and the window gets the latest frame.
+ */
+static void ovl_swap_detach(ScrnInfoPtr pScrn)
+{
+	struct pvr2d_page_flip *ovl_swap = &pvr2d_get_screen(pScrn)->ovl_swap;
+
+	ovl_swap_kill_reqs(pScrn);
+	ovl_plane_hide(pScrn);
+	ovl_swap_restore(pScrn);
+
+	ovl_swap->bufs[ovl_swap->back_idx].user_priv = NULL;
+	ovl_swap->user_priv = NULL;
+}
+
+/*
+ * Release the overlay swap buffers. The window gets the frame that was
+ * on the overlay and the back buffer becomes a private pixmap again.
+ */
+static int pvr2d_dri2_migrate_from_ovl(ScrnInfoPtr pScrn)
+{
+	struct pvr2d_page_flip *ovl_swap = &pvr2d_get_screen(pScrn)->ovl_swap;
+	DRI2BufferPtr back = ovl_swap->bufs[ovl_swap->back_idx].user_priv;
+	DrawablePtr draw = ovl_swap->user_priv;
+	struct pvr2d_buf_priv *priv;
+	PixmapPtr old_pixmap;
+
+	if (!draw)
+		return 0;
+
+	ovl_swap_detach(pScrn);
+
+	priv = back->driverPrivate;
+	old_pixmap = priv->pixmap;
+
+	if (pvr2d_dri2_get_non_sys_buf(draw, back)) {
+		(*draw->pScreen->DestroyPixmap)(old_pixmap);
+		free(back->driverPrivate);
+		(void)memset(back, 0, sizeof(DRI2BufferRec));
+		return 1;
+	}
+
+	/* There is nothing to be done if one fails in the copy. */
+	if (priv->reserved) {
+		RegionRec reg;
+
+		sgx_exa_set_reg(draw, &reg);
+		sgx_exa_copy_region(draw, &reg,
+				    &old_pixmap->drawable,
+				    &priv->pixmap->drawable);
+	}
+
+	(*draw->pScreen->DestroyPixmap)(old_pixmap);
+
+	return 0;
+}
+
+/* Called before the framebuffer, and so the overlay swap buffers, go away */
+void dri2_ovl_swap_release(ScrnInfoPtr pScrn)
+{
+	struct omap_overlay *ovl = pvr2d_get_screen(pScrn)->ovl_plane.ovl;
+
+	if (pvr2d_dri2_migrate_from_ovl(pScrn))
+		FatalError("Failed to migrate from overlay");
+
+	if (ovl) {
+		ovl_plane_put(pScrn);
+		omap_overlay_wait(ovl);
+	}
+}
+
+/*
+ * Gives the overlay back for other use. Returns FALSE if it wasn't
+ * taken. The drawable keeps the buffers but is copied until it can
+ * get an overlay again.
+ */
+Bool dri2_ovl_swap_put_overlay(ScrnInfoPtr pScrn)
+{
+	struct sgx_ovl_plane *plane = &pvr2d_get_screen(pScrn)->ovl_plane;
+
+	if (!plane->ovl)
+		return FALSE;
+
+	ovl_plane_put(pScrn);
+	ovl_swap_queue_restore(pScrn);
+
+	PERF_INCREMENT(ovl_swap_evicted);
+
+	return TRUE;
+}
+
+static void pvr2d_dri2_clip_notify(WindowPtr win, int dx, int dy)
+{
+	ScreenPtr pScreen = win->drawable.pScreen;
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
+	struct pvr2d_page_flip *ovl_swap = &screen->ovl_swap;
+	DrawablePtr draw = &win->drawable;
+	xf86CrtcPtr crtc;
+
+	pScreen->ClipNotify = plane->ClipNotify;
+	if (pScreen->ClipNotify)
+		(*pScreen->ClipNotify)(win, dx, dy);
+	plane->ClipNotify = pScreen->ClipNotify;
+	pScreen->ClipNotify = pvr2d_dri2_clip_notify;
+
+	if (draw != ovl_swap->user_priv || !plane->crtc)
+		return;
+
+	/* Exposures paint over the colorkey */
+	plane->ckey_dirty = TRUE;
+
+	/* Follow the window around, the colorkey moves along with it */
+	crtc = pvr2d_dri2_ovl_capable(ovl_swap, draw);
+	if (crtc && plane->shown_idx != SWAP_INVALID_IDX &&
+	    ovl_plane_show(pScrn, draw, crtc, plane->shown_idx))
+		return;
+
+	ovl_plane_hide(pScrn);
+	ovl_swap_queue_restore(pScrn);
+}
+
+static Bool pvr2d_dri2_unrealize_window(WindowPtr win)
+{
+	ScreenPtr pScreen = win->drawable.pScreen;
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
+	struct pvr2d_page_flip *ovl_swap = &screen->ovl_swap;
+	Bool ret;
+
+	pScreen->UnrealizeWindow = plane->UnrealizeWindow;
+	ret = (*pScreen->UnrealizeWindow)(win);
+	plane->UnrealizeWindow = pScreen->UnrealizeWindow;
+	pScreen->UnrealizeWindow = pvr2d_dri2_unrealize_window;
+
+	if (&win->drawable == ovl_swap->user_priv) {
+		ovl_plane_hide(pScrn);
+
+		/* Nothing to restore in an unmapped window */
+		plane->stale = FALSE;
+		plane->ckey_dirty = TRUE;
+	}
+
+	return ret;
+}
+
 static DRI2BufferPtr pvr2d_dri2_create_buf(DrawablePtr draw,
 				unsigned int attachment, unsigned int format)
 {
 	FBDevPtr fbdev = FBDEVPTR(xf86ScreenToScrn(draw->pScreen));
 	DRI2BufferPtr buffer;
 	struct pvr2d_buf_priv *priv;
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen));
+	struct pvr2d_page_flip *page_flip = &screen->page_flip;
 
 	/*
 	 * No special formats supported. Buffer format
@@ -367,7 +965,10 @@ static DRI2BufferPtr pvr2d_dri2_create_buf(DrawablePtr draw,
 		return buffer;
 	}
 
-	if (pvr2d_dri2_get_non_sys_buf(draw, buffer))
+	if (attachment == DRI2BufferBackLeft &&
+	    ovl_swap_possible(&screen->ovl_swap, draw))
+		pvr2d_dri2_get_ovl_buf(draw, buffer);
+	else if (pvr2d_dri2_get_non_sys_buf(draw, buffer))
 		goto err;
 
 	if (attachment == DRI2BufferBackLeft) {
@@ -395,13 +996,22 @@ static Bool dri2_buffer_is_fs(struct pvr2d_page_flip *page_flip,
 
 static void  pvr2d_dri2_reuse_buf(DrawablePtr draw, DRI2BufferPtr buffer)
 {
-	FBDevPtr fbdev = FBDEVPTR(xf86ScreenToScrn(draw->pScreen));
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(draw->pScreen);
+	FBDevPtr fbdev = FBDEVPTR(pScrn);
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct pvr2d_page_flip *page_flip = &screen->page_flip;
+	struct pvr2d_page_flip *ovl_swap = &screen->ovl_swap;
 	struct pvr2d_buf_priv *priv = buffer->driverPrivate;
 
 	switch (buffer->attachment) {
 	case DRI2BufferFrontLeft:
 	case DRI2BufferBackLeft:
+		/* Migrate itself off the overlay? */
+		if (dri2_buffer_is_ovl(ovl_swap, buffer) &&
+		    !pvr2d_dri2_ovl_capable(ovl_swap, draw) &&
+		    pvr2d_dri2_migrate_from_ovl(pScrn))
+			FatalError("Failed to migrate from overlay");
+
 		/* Migrate itself out of fullscreen? */
 		if (page_flip->user_priv == draw &&
 		    !pvr2d_dri2_fs_flip_capable(page_flip, draw)) {
@@ -426,6 +1036,12 @@ static void  pvr2d_dri2_reuse_buf(DrawablePtr draw, DRI2BufferPtr buffer)
 				page_flip_buf_reserve(page_flip, buffer);
 		}
 
+		if (buffer->attachment == DRI2BufferBackLeft &&
+		    page_flip->user_priv != draw &&
+		    !dri2_buffer_is_ovl(ovl_swap, buffer) &&
+		    ovl_swap_possible(ovl_swap, draw))
+			pvr2d_dri2_migrate_to_ovl(draw, buffer);
+
 		if (buffer->attachment == DRI2BufferBackLeft) {
 			if (!priv->reserved && fbdev->conf.poison_getbuffers)
 				poison_buffer(draw, buffer, 0xff, 0x00, 0x00);
@@ -440,15 +1056,26 @@ static void  pvr2d_dri2_reuse_buf(DrawablePtr draw, DRI2BufferPtr buffer)
 static void pvr2d_dri2_destroy_buf(DrawablePtr draw, DRI2BufferPtr buffer)
 {
 	ScreenPtr screen = draw->pScreen;
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(screen);
 	struct pvr2d_buf_priv *priv;
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
+	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen(pScrn)->page_flip;
+	struct pvr2d_page_flip *ovl_swap = &pvr2d_get_screen(pScrn)->ovl_swap;
 
 	if (!buffer)
 		return;
 
 	priv = buffer->driverPrivate;
 
-	if (priv->pixmap)
+	/*
+	 * Only the current back buffer holds the overlay swap buffers.
+	 * A new one of the same drawable may have taken them over already.
+	 */
+	if (dri2_buffer_is_ovl(ovl_swap, buffer))
+		ovl_swap_detach(pScrn);
+
+	if (priv->pixmap && buffer->attachment == DRI2BufferBackLeft)
+		back_pool_put(priv->pixmap);
+	else if (priv->pixmap)
 		(*screen->DestroyPixmap)(priv->pixmap);
 
 	if (page_flip->user_priv == draw) {
@@ -489,7 +1116,8 @@ static void pvr2d_dri2_destroy_buf(DrawablePtr draw, DRI2BufferPtr buffer)
 static void pvr2d_check_front(DrawablePtr draw, DRI2BufferPtr src_buf,
 				DRI2BufferPtr dst_buf)
 {
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
+	struct pvr2d_page_flip *page_flip =
+		&pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen))->page_flip;
 	ScreenPtr screen = draw->pScreen;
 	struct pvr2d_buf_priv *priv;
 	PixmapPtr pixmap;
@@ -523,9 +1151,81 @@ static void pvr2d_check_front(DrawablePtr draw, DRI2BufferPtr src_buf,
 	}
 }
 
+/* The overlay swap buffer that is neither the front nor the back one */
+static unsigned int ovl_swap_spare_idx(struct pvr2d_page_flip *ovl_swap)
+{
+	unsigned int i;
+
+	for (i = 0; i < ovl_swap->num_bufs; i++) {
+		if (i != ovl_swap->front_idx && i != ovl_swap->back_idx)
+			break;
+	}
+
+	return i;
+}
+
+/*
+ * A partial swap of a drawable on the overlay. The window only has the
+ * colorkey, so the region goes into the spare overlay buffer on top of
+ * the current frame and that buffer is queued like a swap. This way
+ * nothing is drawn into the buffer being scanned out.
+ */
+static void pvr2d_dri2_ovl_copy_region(DrawablePtr draw, RegionPtr reg,
+				       DrawablePtr src_draw)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(draw->pScreen);
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct pvr2d_page_flip *ovl_swap = &screen->ovl_swap;
+	unsigned int idx = ovl_swap_spare_idx(ovl_swap);
+	DrawablePtr front = &ovl_swap->bufs[ovl_swap->front_idx].pixmap->drawable;
+	DrawablePtr spare;
+	struct dri2_swap_request *req = NULL;
+	RegionRec rest;
+
+	if (!RegionNotEmpty(reg))
+		return;
+
+	/*
+	 * A busy spare buffer means the swap to the front buffer hasn't
+	 * been picked up by the overlay yet, so the front buffer can take
+	 * the region itself.
+	 */
+	if (!ovl_swap->bufs[idx].busy)
+		req = calloc(1, sizeof *req);
+
+	if (!req) {
+		sgx_exa_copy_region(draw, reg, src_draw, front);
+		return;
+	}
+
+	spare = &ovl_swap->bufs[idx].pixmap->drawable;
+
+	sgx_exa_set_reg(draw, &rest);
+	RegionSubtract(&rest, &rest, reg);
+	sgx_exa_copy_region(draw, &rest, front, spare);
+	RegionUninit(&rest);
+
+	sgx_exa_copy_region(draw, reg, src_draw, spare);
+
+	/* nothing to complete for the client */
+	req->drawable_id = draw->id;
+	req->screen = draw->pScreen;
+	req->front_idx = idx;
+	req->back_idx = SWAP_INVALID_IDX;
+	req->complete_done = true;
+
+	ovl_swap->front_idx = idx;
+
+	ovl_swap_queue(pScrn, req);
+}
+
 static void pvr2d_dri2_copy_region(DrawablePtr draw, RegionPtr reg,
 				DRI2BufferPtr dst_buf, DRI2BufferPtr src_buf)
 {
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen));
+	struct pvr2d_page_flip *ovl_swap = &screen->ovl_swap;
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
 	DrawablePtr src_draw;
 	DrawablePtr dst_draw;
 
@@ -534,7 +1234,19 @@ static void pvr2d_dri2_copy_region(DrawablePtr draw, RegionPtr reg,
 	src_draw = pvr2d_dri2_choose_drawable(draw, src_buf);
 	dst_draw = pvr2d_dri2_choose_drawable(draw, dst_buf);
 
+	if (dst_buf->attachment == DRI2BufferFrontLeft &&
+	    dri2_buffer_is_ovl(ovl_swap, src_buf) &&
+	    (plane->crtc || plane->reqs_head)) {
+		pvr2d_dri2_ovl_copy_region(draw, reg, src_draw);
+		return;
+	}
+
 	sgx_exa_copy_region(draw, reg, src_draw, dst_draw);
+
+	/* Copied over the colorkey? */
+	if (dst_buf->attachment == DRI2BufferFrontLeft &&
+	    ovl_swap->user_priv == draw)
+		plane->ckey_dirty = TRUE;
 }
 
 /*
@@ -548,7 +1260,8 @@ static void pvr2d_dri2_exchange_bufs(DrawablePtr draw,
 				     DRI2BufferPtr front, DRI2BufferPtr back)
 {
 	ScreenPtr pScreen = draw->pScreen;
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
+	struct pvr2d_page_flip *page_flip =
+		&pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen))->page_flip;
 	struct pvr2d_buf_priv *front_priv = front->driverPrivate;
 	struct pvr2d_buf_priv *back_priv = back->driverPrivate;
 
@@ -712,7 +1425,8 @@ static void free_swap_req(struct dri2_swap_request *req)
 
 static void kill_swap_req(struct dri2_swap_request *req)
 {
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
+	struct pvr2d_page_flip *page_flip =
+		&pvr2d_get_screen(xf86ScreenToScrn(req->screen))->page_flip;
 
 	if (!req->complete_done) {
 		DrawablePtr draw;
@@ -769,7 +1483,8 @@ static void complete_swap_req(struct dri2_swap_request *req,
 			      unsigned int tv_usec)
 {
 	DrawablePtr draw;
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
+	struct pvr2d_page_flip *page_flip =
+		&pvr2d_get_screen(xf86ScreenToScrn(req->screen))->page_flip;
 
 	assert(!req->complete_done);
 	assert(!req->dead);
@@ -801,6 +1516,7 @@ static void pvr2d_dri2_issue_flip(ScrnInfoPtr screen_info,
 	}
 	if (req->display_update_idx != SWAP_INVALID_IDX) {
 		/* Start the update for the new front buffer */
+		flip_stats_display_update();
 		fbdev_update_outputs(screen_info, NULL);
 	} else {
 		RegionRec reg;
@@ -828,15 +1544,264 @@ static bool pvr2d_dri2_is_overlay_manual_update(FBDevPtr fbdev,
 	return update == OMAP_OUTPUT_UPDATE_MANUAL;
 }
 
+/*
+ * Overlay swaps (OverlaySwap) have a queue of their own. A request puts
+ * a buffer on the overlay once its rendering is done, and the buffer it
+ * replaces stays busy until the flip event says the overlay has picked
+ * up the new one. A swap completes once the back buffer the client
+ * renders into next is no longer busy, like page flips do.
+ */
+
+static void ovl_swap_complete(struct dri2_swap_request *req,
+			      unsigned int tv_sec, unsigned int tv_usec)
+{
+	DrawablePtr draw;
+
+	req->complete_done = true;
+
+	if (dixLookupDrawable(&draw, req->drawable_id, serverClient, M_ANY,
+			      DixWriteAccess) != Success)
+		return;
+
+	DRI2SwapComplete(req->client, draw, 0, tv_sec, tv_usec,
+			 DRI2_EXCHANGE_COMPLETE, req->event_complete,
+			 req->event_data);
+}
+
+/* Completes the swaps, in order, whose next back buffer is free */
+static void ovl_swap_complete_reqs(struct pvr2d_screen *screen,
+				   unsigned int tv_sec, unsigned int tv_usec)
+{
+	struct dri2_swap_request *req;
+
+	for (req = screen->ovl_plane.reqs_head; req; req = req->next) {
+		if (req->complete_done)
+			continue;
+
+		if (screen->ovl_swap.bufs[req->back_idx].busy)
+			break;
+
+		ovl_swap_complete(req, tv_sec, tv_usec);
+	}
+}
+
+/* Drops the overlay swaps in flight, completing them for the client */
+static void ovl_swap_kill_reqs(ScrnInfoPtr pScrn)
+{
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
+	struct dri2_swap_request *req;
+	unsigned int i;
+
+	while ((req = plane->reqs_head)) {
+		plane->reqs_head = req->next;
+		req->next = NULL;
+
+		if (!req->complete_done)
+			ovl_swap_complete(req, 0, 0);
+
+		/* The window has to get the frame instead */
+		if (!req->flip_issued)
+			plane->stale = TRUE;
+
+		/* The event handlers free it, see kill_swap_req() */
+		if (!req->render_done || req->flip_issued)
+			req->dead = true;
+		else
+			free_swap_req(req);
+	}
+	plane->reqs_tail = NULL;
+
+	for (i = 0; i < screen->ovl_swap.num_bufs; i++)
+		screen->ovl_swap.bufs[i].busy = FALSE;
+	plane->shown_idx = SWAP_INVALID_IDX;
+}
+
+/* Asks for an event once the overlay has picked up its new setup */
+static Bool ovl_swap_event_req(ScrnInfoPtr pScrn,
+			       struct dri2_swap_request *req)
+{
+	FBDevPtr fbdev = FBDEVPTR(pScrn);
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fbdev->ovl); i++) {
+		if (fbdev->ovl[i] != screen->ovl_plane.ovl)
+			continue;
+
+		req->num_flips_pending = 1;
+
+		/* Same as flip_swap_req() */
+		if (pvr2d_dri2_is_overlay_manual_update(fbdev, i) &&
+		    PVR2DUpdateEventReq(screen->context, i, req) == PVR2D_OK)
+			return TRUE;
+
+		return PVR2DFlipEventReq(screen->context, i, req) == PVR2D_OK;
+	}
+
+	return FALSE;
+}
+
+static void ovl_swap_issue(ScrnInfoPtr pScrn, struct dri2_swap_request *req);
+
+/*
+ * The overlay shows the request's buffer, or the buffer was copied
+ * into the window. The one shown before is free again.
+ */
+static void ovl_swap_flip_done(ScrnInfoPtr pScrn,
+			       struct dri2_swap_request *req,
+			       unsigned int tv_sec, unsigned int tv_usec)
+{
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
+	struct dri2_swap_request *next;
+
+	assert(req == plane->reqs_head);
+	assert(req->flip_issued && !req->flip_done);
+
+	req->flip_done = true;
+
+	if (req->prev_idx != SWAP_INVALID_IDX &&
+	    req->prev_idx != req->front_idx)
+		screen->ovl_swap.bufs[req->prev_idx].busy = FALSE;
+
+	ovl_swap_complete_reqs(screen, tv_sec, tv_usec);
+	if (!req->complete_done)
+		ovl_swap_complete(req, tv_sec, tv_usec);
+
+	plane->reqs_head = req->next;
+	if (!plane->reqs_head)
+		plane->reqs_tail = NULL;
+
+	free_swap_req(req);
+
+	next = plane->reqs_head;
+	if (next && next->render_done)
+		ovl_swap_issue(pScrn, next);
+}
+
+/* Puts the rendered buffer on the overlay, or copies it to the window */
+static void ovl_swap_issue(ScrnInfoPtr pScrn, struct dri2_swap_request *req)
+{
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
+	struct pvr2d_page_flip *ovl_swap = &screen->ovl_swap;
+	xf86CrtcPtr crtc = NULL;
+	DrawablePtr draw;
+	RegionRec reg;
+
+	assert(req == plane->reqs_head);
+	assert(req->render_done && !req->flip_issued);
+
+	req->flip_issued = true;
+	req->prev_idx = plane->shown_idx;
+	plane->shown_idx = req->front_idx;
+
+	if (dixLookupDrawable(&draw, req->drawable_id, serverClient, M_ANY,
+			      DixWriteAccess) != Success)
+		draw = NULL;
+
+	/* Obscured windows, or no free overlay, fall back to copying */
+	if (draw)
+		crtc = pvr2d_dri2_ovl_capable(ovl_swap, draw);
+
+	if (!crtc || !ovl_plane_show(pScrn, draw, crtc, req->front_idx)) {
+		ovl_plane_hide(pScrn);
+
+		if (draw) {
+			sgx_exa_set_reg(draw, &reg);
+			sgx_exa_copy_region(draw, &reg,
+				&ovl_swap->bufs[req->front_idx].pixmap->drawable,
+				draw);
+		}
+
+		plane->stale = FALSE;
+		plane->ckey_dirty = TRUE;
+		PERF_INCREMENT(ovl_swap_blits);
+
+		ovl_swap_flip_done(pScrn, req, 0, 0);
+		return;
+	}
+
+	if (plane->ckey && plane->ckey_dirty) {
+		fill_drawable(draw, draw, ovl_ckey(pScrn));
+		plane->ckey_dirty = FALSE;
+	}
+	plane->stale = TRUE;
+
+	PERF_INCREMENT(ovl_swaps);
+
+	if (!ovl_swap_event_req(pScrn, req)) {
+		/* The previous buffer is free once the setup is picked up */
+		omap_overlay_wait(plane->ovl);
+		ovl_swap_flip_done(pScrn, req, 0, 0);
+	}
+}
+
+static void ovl_swap_sync_handler(struct dri2_swap_request *req)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(req->screen);
+	struct sgx_ovl_plane *plane = &pvr2d_get_screen(pScrn)->ovl_plane;
+
+	assert(!req->render_done);
+
+	if (req->dead) {
+		free_swap_req(req);
+		return;
+	}
+
+	req->render_done = true;
+
+	/* issue the swap if we're next in line */
+	if (req == plane->reqs_head)
+		ovl_swap_issue(pScrn, req);
+}
+
+/* Queues the request and asks for an event once the buffer is rendered */
+static void ovl_swap_queue(ScrnInfoPtr pScrn, struct dri2_swap_request *req)
+{
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
+
+	req->type = SWAP_OVL;
+	req->prev_idx = SWAP_INVALID_IDX;
+	req->display_update_idx = SWAP_INVALID_IDX;
+	RegionNull(&req->update_region);
+
+	if (plane->reqs_tail)
+		plane->reqs_tail->next = req;
+	else
+		plane->reqs_head = req;
+	plane->reqs_tail = req;
+
+	screen->ovl_swap.bufs[req->front_idx].busy = TRUE;
+
+	ovl_swap_complete_reqs(screen, 0, 0);
+
+	if (!FBDEVPTR(pScrn)->conf.render_sync ||
+	    PVR2DSyncEventReq(screen->context,
+			      screen->ovl_swap.bufs[req->front_idx].mem_info,
+			      req, PVR2D_WAIT_SYNC_EVENT) != PVR2D_OK)
+		ovl_swap_sync_handler(req);
+}
+
 static void pvr2d_dri2_flip_handler(int fd, unsigned overlay,
 			unsigned tv_sec, unsigned tv_usec,
 			unsigned long user_data)
 {
 	struct dri2_swap_request *next_flip, *req =
 		(struct dri2_swap_request *)user_data;
-	struct pvr2d_screen *screen = pvr2d_get_screen();
-	struct pvr2d_page_flip *page_flip = &screen->page_flip;
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(req->screen);
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct pvr2d_page_flip *page_flip = &screen->page_flip;
+
+	if (req->type == SWAP_OVL) {
+		if (req->dead)
+			free_swap_req(req);
+		else
+			ovl_swap_flip_done(pScrn, req, tv_sec, tv_usec);
+		return;
+	}
 
 	/* Wait until all CRTCs have flipped */
 	if (--req->num_flips_pending > 0)
@@ -916,6 +1881,11 @@ static void pvr2d_dri2_sync_handler(int fd, const void *sync_info,
 {
 	struct dri2_swap_request *req = (struct dri2_swap_request *)user_data;
 
+	if (req->type == SWAP_OVL) {
+		ovl_swap_sync_handler(req);
+		return;
+	}
+
 	assert(!req->render_done);
 	assert(!req->flip_issued);
 	assert(!req->flip_done);
@@ -940,9 +1910,9 @@ static void pvr2d_dri2_sync_handler(int fd, const void *sync_info,
 
 static void flip_swap_req(struct dri2_swap_request *req)
 {
-	struct pvr2d_screen *screen = pvr2d_get_screen();
-	struct pvr2d_page_flip *page_flip = &screen->page_flip;
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(req->screen);
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct pvr2d_page_flip *page_flip = &screen->page_flip;
 	FBDevPtr fbdev = FBDEVPTR(pScrn);
 	int i;
 
@@ -1000,7 +1970,7 @@ static void pvr2d_dri2_update_front(struct pvr2d_page_flip *page_flip,
 		ScrnInfoPtr pScrn,
 		unsigned int new_front_idx)
 {
-	pvr2d_get_screen()->sys_mem_info =
+	pvr2d_get_screen(pScrn)->sys_mem_info =
 		page_flip->bufs[new_front_idx].mem_info;
 
 	SysMemInfoChanged(pScrn);
@@ -1013,7 +1983,8 @@ static int pvr2d_dri2_sync_req(ClientPtr client, DrawablePtr draw,
 				DRI2SwapEventPtr func, void *data)
 {
 	struct dri2_swap_request *req;
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen));
 	struct pvr2d_page_flip *page_flip = &screen->page_flip;
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(draw->pScreen);
 	FBDevPtr fbdev = FBDEVPTR(pScrn);
@@ -1092,7 +2063,8 @@ static void pvr2d_dri2_no_swap(ClientPtr client, DrawablePtr draw,
 				DRI2BufferPtr front, DRI2BufferPtr back,
 				DRI2SwapEventPtr func, void *data)
 {
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen));
 	struct pvr2d_page_flip *page_flip = &screen->page_flip;
 	struct pvr2d_buf_priv *priv = back->driverPrivate;
 	RegionRec reg;
@@ -1122,10 +2094,96 @@ static void pvr2d_dri2_no_swap(ClientPtr client, DrawablePtr draw,
 			func, data);
 }
 
+/* Rotate the overlay swap buffers, the front stays the window pixmap */
+static void pvr2d_dri2_ovl_exchange(DrawablePtr draw, DRI2BufferPtr back)
+{
+	ScreenPtr pScreen = draw->pScreen;
+	struct pvr2d_page_flip *ovl_swap =
+		&pvr2d_get_screen(xf86ScreenToScrn(pScreen))->ovl_swap;
+	struct pvr2d_buf_priv *back_priv = back->driverPrivate;
+	unsigned int next_idx;
+
+	assert(back->name == (unsigned)
+	       ovl_swap->bufs[ovl_swap->back_idx].mem_handle);
+
+	ovl_swap->bufs[ovl_swap->back_idx].user_priv = NULL;
+
+	/* The old front may still be on the overlay, skip it */
+	next_idx = ovl_swap_spare_idx(ovl_swap);
+	ovl_swap->front_idx = ovl_swap->back_idx;
+	ovl_swap->back_idx = next_idx;
+
+	back->name = (unsigned)
+		ovl_swap->bufs[ovl_swap->back_idx].mem_handle;
+	ovl_swap->bufs[ovl_swap->back_idx].user_priv = back;
+
+	(*pScreen->DestroyPixmap)(back_priv->pixmap);
+	back_priv->pixmap = ovl_swap->bufs[ovl_swap->back_idx].pixmap;
+	back_priv->pixmap->refcnt++;
+}
+
+/*
+ * Point the overlay at the back buffer instead of copying it into the
+ * window. The overlay is panned once the rendering is done, and the
+ * swap completes once the next back buffer is off the overlay, see
+ * ovl_swap_issue() and ovl_swap_flip_done().
+ */
+static void pvr2d_dri2_ovl_swap(ClientPtr client, DrawablePtr draw,
+				DRI2BufferPtr front, DRI2BufferPtr back,
+				DRI2SwapEventPtr func, void *data)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(draw->pScreen);
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
+	struct pvr2d_page_flip *ovl_swap = &screen->ovl_swap;
+	struct pvr2d_buf_priv *priv = back->driverPrivate;
+	struct dri2_swap_request *req;
+
+	/*
+	 * Obscured windows, or no free overlay, fall back to copying.
+	 * With swaps in flight the frames have to stay in order, those
+	 * get copied once it's their turn.
+	 */
+	if (!plane->reqs_head && !pvr2d_dri2_ovl_capable(ovl_swap, draw))
+		goto copy;
+
+	req = calloc(1, sizeof *req);
+	if (!req) {
+		ovl_swap_kill_reqs(pScrn);
+		goto copy;
+	}
+
+	req->drawable_id = draw->id;
+	req->client = client;
+	req->screen = draw->pScreen;
+	req->event_complete = func;
+	req->event_data = data;
+	req->front = front;
+	req->back = back;
+	req->front_idx = ovl_swap->back_idx;
+
+	assert(priv->reserved);
+	priv->reserved = FALSE;
+
+	pvr2d_dri2_ovl_exchange(draw, back);
+	req->back_idx = ovl_swap->back_idx;
+
+	ovl_swap_queue(pScrn, req);
+	return;
+
+ copy:
+	ovl_plane_hide(pScrn);
+	pvr2d_dri2_no_swap(client, draw, front, back, func, data);
+	plane->stale = FALSE;
+	plane->ckey_dirty = TRUE;
+	PERF_INCREMENT(ovl_swap_blits);
+}
+
 bool pvr2d_dri2_schedule_damage(DrawablePtr draw, RegionPtr region)
 {
 	struct dri2_swap_request *req;
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen));
 	struct pvr2d_page_flip *page_flip = &screen->page_flip;
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(draw->pScreen);
 
@@ -1176,7 +2234,8 @@ static int pvr2d_dri2_schedule_swap(ClientPtr client, DrawablePtr draw,
 				void *data)
 {
 	FBDevPtr fbdev = FBDEVPTR(xf86ScreenToScrn(draw->pScreen));
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen));
 	struct pvr2d_page_flip *page_flip = &screen->page_flip;
 	struct pvr2d_buf_priv *priv = back->driverPrivate;
 
@@ -1189,6 +2248,11 @@ static int pvr2d_dri2_schedule_swap(ClientPtr client, DrawablePtr draw,
 		return FALSE;
 	}
 
+	if (dri2_buffer_is_ovl(&screen->ovl_swap, back)) {
+		pvr2d_dri2_ovl_swap(client, draw, front, back, func, data);
+		return TRUE;
+	}
+
 	if (!page_flip_possible(page_flip, draw)) {
 		pvr2d_dri2_no_swap(client, draw, front, back, func, data);
 		return TRUE;
@@ -1239,7 +2303,9 @@ static int pvr2d_dri2_auth_magic(int fd, uint32_t magic)
 
 Bool DRI2_Init(ScreenPtr pScreen)
 {
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	struct sgx_ovl_plane *plane = &screen->ovl_plane;
 	DRI2InfoRec info = {
 		.driverName = "pvr2d",
 		.version = DRI2INFOREC_VERSION,
@@ -1261,10 +2327,32 @@ Bool DRI2_Init(ScreenPtr pScreen)
 
 	flip_stats_init(pScreen);
 
+	memset(plane, 0, sizeof(*plane));
+	plane->shown_idx = SWAP_INVALID_IDX;
+	if (FBDEVPTR(pScrn)->conf.overlay_swap) {
+		plane->ClipNotify = pScreen->ClipNotify;
+		pScreen->ClipNotify = pvr2d_dri2_clip_notify;
+		plane->UnrealizeWindow = pScreen->UnrealizeWindow;
+		pScreen->UnrealizeWindow = pvr2d_dri2_unrealize_window;
+	}
+
 	return DRI2ScreenInit(pScreen, &info);
 }
 
 void DRI2_Fini(ScreenPtr pScreen)
 {
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	struct sgx_ovl_plane *plane = &pvr2d_get_screen(pScrn)->ovl_plane;
+
+	if (pScreen->ClipNotify == pvr2d_dri2_clip_notify)
+		pScreen->ClipNotify = plane->ClipNotify;
+	if (pScreen->UnrealizeWindow == pvr2d_dri2_unrealize_window)
+		pScreen->UnrealizeWindow = plane->UnrealizeWindow;
+
+	plane->restore_queued = FALSE;
+	ovl_plane_put(pScrn);
+
+	dri2_back_pool_trim();
+
 	flip_stats_fini(pScreen);
 }
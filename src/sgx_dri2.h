@@ -32,6 +32,7 @@ struct dri2_swap_request {
 	enum {
 		SWAP_FLIP,
 		SWAP_EXTFB,
+		SWAP_OVL,
 	} type;
 	XID drawable_id;
 	ClientPtr client;
@@ -48,6 +49,8 @@ struct dri2_swap_request {
 	unsigned int front_idx;
 	unsigned int back_idx;
 	unsigned int display_update_idx;
+	/* overlay swaps: the buffer shown until front_idx is */
+	unsigned int prev_idx;
 
 	/* track the request's progress */
 	bool render_done;
@@ -81,6 +84,9 @@ extern Bool DRI2_Init(ScreenPtr pScreen);
 extern void DRI2_Fini(ScreenPtr pScreen);
 
 void dri2_kill_swap_reqs(void);
+void dri2_back_pool_trim(void);
+void dri2_ovl_swap_release(ScrnInfoPtr pScrn);
+Bool dri2_ovl_swap_put_overlay(ScrnInfoPtr pScrn);
 
 extern bool pvr2d_dri2_schedule_damage(DrawablePtr draw, RegionPtr region);
 
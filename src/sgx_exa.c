@@ -25,25 +25,68 @@
 #include "sgx_pvr2d.h"
 #include "sgx_pvr2d_alloc.h"
 #include "sgx_dri2.h"
+#include "sgx_glyph.h"
+#include "sgx_pixmem.h"
+#include "sgx_wait.h"
 
 #include <exa.h>
 #include "perf.h"
 #include "x-hash.h"
 
-/* XXX: RENDER acceleration is slow and lockup prone. Enable at your own risk. */
-#undef PVR2D_EXT_BLIT
-
-/* These should really be tracked per screen but are global for now */
-static Bool CreateScreenPixmap;
-static PVR2DBLTINFO pvr2dblt;
-static Pixel colour;
-static x_hash_table *pixmapsHT;
-static Bool OptionCopyOnly;
+static inline struct pvr2d_screen *pixmap_screen(PixmapPtr pPixmap)
+{
+	return pvr2d_get_screen(xf86ScreenToScrn(pPixmap->drawable.pScreen));
+}
 
 static Bool PVR2DPrepareAccess(PixmapPtr pPix, int index);
 
 static void PVR2DFinishAccess(PixmapPtr pPix, int index);
 
+static struct sgx_blt_cache_entry *
+blt_cache_entry(struct sgx_blt_cache_entry *cache,
+		struct PVR2DPixmap *psrc, struct PVR2DPixmap *pdst)
+{
+	/* The privates are malloc()ed, the low bits carry no information */
+	unsigned long key = ((unsigned long)pdst >> 4) ^
+		((unsigned long)psrc >> 6);
+
+	key ^= key >> 8;
+
+	return &cache[key & (SGX_BLT_CACHE_SIZE - 1)];
+}
+
+/*
+ * Has the descriptor been prepared for these pixmaps? If so, the
+ * pixmaps have already been validated and their formats looked up.
+ */
+static Bool blt_cache_lookup(struct sgx_blt_cache_entry *entry,
+			     struct PVR2DPixmap *psrc,
+			     struct PVR2DPixmap *pdst)
+{
+	if (entry->dst != pdst || entry->dst_generation != pdst->generation)
+		return FALSE;
+
+	if (entry->src != psrc ||
+	    (psrc && entry->src_generation != psrc->generation))
+		return FALSE;
+
+	PERF_INCREMENT(blt_cache_hit);
+
+	return TRUE;
+}
+
+static void blt_cache_store(struct sgx_blt_cache_entry *entry,
+			    struct PVR2DPixmap *psrc,
+			    struct PVR2DPixmap *pdst,
+			    const PVR2DBLTINFO *blt)
+{
+	entry->src = psrc;
+	entry->dst = pdst;
+	entry->src_generation = psrc ? psrc->generation : 0;
+	entry->dst_generation = pdst->generation;
+	entry->blt = *blt;
+}
+
 static Bool checkPVR2DBlt(PixmapPtr pPixmap, int alu, Pixel planemask)
 {
 	if (alu != GXcopy) {
@@ -68,6 +111,51 @@ static Bool checkPVR2DBlt(PixmapPtr pPixmap, int alu, Pixel planemask)
 	return TRUE;
 }
 
+/*
+ * malloc() pixmaps can't be used by the GPU. The ones that keep being
+ * asked for accelerated operations are promoted to SHM, bigger ones
+ * need to be asked for a few more times as copying them costs more.
+ */
+#define SGX_PROMOTE_FALLBACKS 8
+
+static void count_fallback(PixmapPtr pPixmap, struct PVR2DPixmap *ppix,
+			   Bool slab, Bool cleanup)
+{
+	if (!ppix || !ppix->mallocaddr || !ppix->screen->promote_pixmaps)
+		return;
+
+	if (++ppix->fallbacks < SGX_PROMOTE_FALLBACKS +
+	    (ppix->mallocsize >> 16))
+		return;
+
+	if (!PVR2DPromotePixmap(pPixmap, ppix, slab, cleanup))
+		ppix->fallbacks = 0;
+}
+
+static Bool PVR2DValidateHot(PixmapPtr pPixmap, struct PVR2DPixmap *ppix,
+			     Bool cleanup)
+{
+	count_fallback(pPixmap, ppix, TRUE, cleanup);
+
+	return PVR2DValidate(pPixmap, ppix, cleanup);
+}
+
+/*
+ * The extended blits have no surface offsets, so slab pixmaps are
+ * moved into a segment of their own before they're used for those.
+ */
+static Bool PVR2DValidateExt(PixmapPtr pPixmap, struct PVR2DPixmap *ppix,
+			     Bool cleanup)
+{
+	count_fallback(pPixmap, ppix, FALSE, cleanup);
+
+	if (ppix && ppix->slab &&
+	    !PVR2DUnslabPixmap(pPixmap, ppix, FALSE, cleanup))
+		return FALSE;
+
+	return PVR2DValidate(pPixmap, ppix, cleanup);
+}
+
 Bool getDrawableInfo(DrawablePtr pDraw, PVR2DMEMINFO ** ppMemInfo, long *pXoff,
 		     long *pYoff)
 {
@@ -77,7 +165,7 @@ Bool getDrawableInfo(DrawablePtr pDraw, PVR2DMEMINFO ** ppMemInfo, long *pXoff,
 	    GetWindowPixmap((WindowPtr) pDraw) : (PixmapPtr) pDraw;
 	struct PVR2DPixmap *ppix = exaGetPixmapDriverPrivate(pPixmap);
 
-	if (!ppix || !PVR2DValidate(pPixmap, ppix, TRUE))
+	if (!ppix || !PVR2DValidateExt(pPixmap, ppix, TRUE))
 		return FALSE;
 
 	*ppMemInfo = ppix->pvr2dmem;
@@ -128,6 +216,76 @@ Bool GetPVR2DFormat(int depth, PVR2DFORMAT * format)
 	}
 }
 
+/*
+ * Software rendering into a GPU owned pixmap leaves it GPU owned. Only
+ * rows y1 to y2 - 1 are invalidated before and cleaned after the access,
+ * the rest of the pixmap needs no cache maintenance. CPU owned pixmaps
+ * just get the rows marked dirty for the next PVR2DFlushCache().
+ */
+static Bool begin_cpu_access(struct PVR2DPixmap *ppix, int pitch,
+			     int y1, int y2)
+{
+	if (ppix->owner == PVR2D_OWNER_CPU)
+		return TRUE;
+
+	if (QueryBlitsComplete(ppix, 0) != PVR2D_OK)
+		QueryBlitsComplete(ppix, 1);
+
+	PVR2DFlushCacheRange(ppix, DRM_PVR2D_CFLUSH_FROM_GPU,
+			     y1 * pitch, (y2 - y1) * pitch);
+
+	return TRUE;
+}
+
+static void end_cpu_access(struct PVR2DPixmap *ppix, int pitch,
+			   int y1, int y2)
+{
+	if (ppix->owner == PVR2D_OWNER_CPU)
+		PVR2DMarkCPUWrites(ppix, y1, y2);
+	else
+		PVR2DFlushCacheRange(ppix, DRM_PVR2D_CFLUSH_TO_GPU,
+				     y1 * pitch, (y2 - y1) * pitch);
+}
+
+/* Maps rows y1 to y2 - 1 of the pixmap for fb */
+static Bool begin_sw_access(PixmapPtr pPix, int y1, int y2)
+{
+	struct PVR2DPixmap *ppix = exaGetPixmapDriverPrivate(pPix);
+
+	pPix->devPrivate.ptr = ppix->mallocaddr ? ppix->mallocaddr :
+		ppix->shmaddr;
+	if (!pPix->devPrivate.ptr)
+		return FALSE;
+
+	return begin_cpu_access(ppix, pPix->devKind, y1, y2);
+}
+
+/* Hands the pixmap to the GPU for a blit */
+static void blit_pixmap(struct PVR2DPixmap *ppix)
+{
+	if (!ppix)
+		return;
+
+	PVR2DPixmapOwnership_GPU(ppix);
+	ppix->gpu_used = TRUE;
+}
+
+/*
+ * returns how many pages of cache maintenance a CPU access to a GPU
+ * owned pixmap costs: the rows are invalidated if the GPU has written
+ * to the pixmap and cleaned again if the CPU writes to them
+ */
+static int GetAccessPages(struct PVR2DPixmap *ppix, int pitch, int rows,
+			  Bool write)
+{
+	int pages = (rows * pitch + 4096 - 1) >> 12;
+
+	if (ppix->shmid < 0)
+		return 0;
+
+	return (PVR2DGetFlushSize(ppix) ? pages : 0) + (write ? pages : 0);
+}
+
 /* Heuristics for choosing between software and hardware rendering.
  * The heuristics will choose the solution that will take less CPU time
  * returns	TRUE  : Software solid fill is faster
@@ -162,7 +320,7 @@ static Bool IsSWSolidFillFaster(struct PVR2DPixmap *pdst, PVR2DBLTINFO * pBlt)
 			/* pixmap owned by CPU and sw_time < hw_time */
 			return TRUE;
 		}
-		pages = (PVR2DGetFlushSize(pdst) + 4096 - 1) >> 12;
+		pages = GetAccessPages(pdst, pBlt->DstStride, pBlt->DSizeY, TRUE);
 		sw_time += pages * flush_penalty;
 		if (sw_time > hw_time) {
 			/* pixmap owned by GPU and sw_time + flush_time > hw_time */
@@ -248,7 +406,10 @@ static void SWSolidFill(PVR2DBLTINFO * pBlt, Pixel colour)
 static Bool PVR2DPrepareSolid(PixmapPtr pPixmap, int alu, Pixel planemask,
 			      Pixel fg)
 {
+	struct sgx_exa_solid *solid = &pixmap_screen(pPixmap)->solid;
+	PVR2DBLTINFO *blt = &solid->blt;
 	struct PVR2DPixmap *pdst = exaGetPixmapDriverPrivate(pPixmap);
+	struct sgx_blt_cache_entry *entry;
 
 	if (alu >= GXclear && alu <= GXset)
 		PERF_INCREMENT(solid_alu[alu]);
@@ -256,14 +417,22 @@ static Bool PVR2DPrepareSolid(PixmapPtr pPixmap, int alu, Pixel planemask,
 	if (!checkPVR2DBlt(pPixmap, alu, planemask))
 		return FALSE;
 
-	if (!PVR2DValidate(pPixmap, pdst, TRUE)) {
+	entry = blt_cache_entry(solid->cache, NULL, pdst);
+	if (pdst && blt_cache_lookup(entry, NULL, pdst)) {
+		*blt = entry->blt;
+		goto colour;
+	}
+
+	PERF_INCREMENT(blt_cache_miss);
+
+	if (!PVR2DValidateHot(pPixmap, pdst, TRUE)) {
 		DBG("%s: FALSE: (!PVR2DValidate(pdst))\n", __func__);
 		PERF_INCREMENT(fallback_solid_validateDst);
 		return FALSE;
 	}
 
-	if (!GetPVR2DFormat(pPixmap->drawable.depth, &pvr2dblt.DstFormat)) {
-		DBG("%s: FALSE: (!GetPVR2DFormat(pPixmap->drawable.depth, &pvr2dblt.DstFormat))\n", __func__);
+	if (!GetPVR2DFormat(pPixmap->drawable.depth, &blt->DstFormat)) {
+		DBG("%s: FALSE: (!GetPVR2DFormat(pPixmap->drawable.depth, &blt->DstFormat))\n", __func__);
 		PERF_INCREMENT(fallback_solid_getFormatDst);
 		return FALSE;
 	}
@@ -274,21 +443,30 @@ static Bool PVR2DPrepareSolid(PixmapPtr pPixmap, int alu, Pixel planemask,
 		DBG("%s: destination owned by GPU\n", __func__);
 	}
 
+	blt->pDstMemInfo = pdst->pvr2dmem;
+	blt->DstOffset = pdst->offset;
+	blt->DstSurfWidth = pPixmap->drawable.width;
+	blt->DstSurfHeight = pPixmap->drawable.height;
+	blt->DstStride = pPixmap->devKind;
+
+	blt_cache_store(entry, NULL, pdst, blt);
+
+ colour:
 	switch (pPixmap->drawable.depth) {
 	case 32:
 	case 24:
-		pvr2dblt.Colour = fg;
+		blt->Colour = fg;
 		break;
 	case 16:
-		pvr2dblt.Colour =
+		blt->Colour =
 		    ((fg & 0xf800) << 8) | ((fg & 0x7e0) << 5) | ((fg & 0x1f) << 3) | 0x70307;
 		break;
 	case 15:
-		pvr2dblt.Colour =
+		blt->Colour =
 		    ((fg & 0x7c00) << 9) | ((fg & 0x3e0) << 6) | ((fg & 0x1f) << 3) | 0x70707;
 		break;
 	case 8:
-		pvr2dblt.Colour = fg & 0xff;
+		blt->Colour = fg & 0xff;
 		break;
 	default:
 		DBG("%s: depth %d not supported for solid fill on SGX\n",
@@ -296,15 +474,7 @@ static Bool PVR2DPrepareSolid(PixmapPtr pPixmap, int alu, Pixel planemask,
 		return FALSE;
 	}
 
-	pvr2dblt.CopyCode = PVR2DPATROPcopy;
-	pvr2dblt.BlitFlags = PVR2D_BLIT_DISABLE_ALL;
-
-	pvr2dblt.pDstMemInfo = pdst->pvr2dmem;
-	pvr2dblt.DstSurfWidth = pPixmap->drawable.width;
-	pvr2dblt.DstSurfHeight = pPixmap->drawable.height;
-	pvr2dblt.DstStride = pPixmap->devKind;
-
-	colour = fg;
+	solid->colour = fg;
 	return TRUE;
 }
 
@@ -312,23 +482,24 @@ static void PVR2DSolid(PixmapPtr pDstPixmap, int x1, int y1, int x2, int y2)
 {
 	PVR2DERROR result;
 	struct PVR2DPixmap *pdst = exaGetPixmapDriverPrivate(pDstPixmap);
+	struct pvr2d_screen *screen = pdst->screen;
+	PVR2DBLTINFO *blt = &screen->solid.blt;
 
-	pvr2dblt.DSizeX = x2 - x1;
-	pvr2dblt.DSizeY = y2 - y1;
-	pvr2dblt.DstX = x1;
-	pvr2dblt.DstY = y1;
+	blt->DSizeX = x2 - x1;
+	blt->DSizeY = y2 - y1;
+	blt->DstX = x1;
+	blt->DstY = y1;
 
-	if (IsSWSolidFillFaster(pdst, &pvr2dblt)) {
-		if (!PVR2DPixmapOwnership_CPU(pdst)) {
+	if (IsSWSolidFillFaster(pdst, blt)) {
+		if (!begin_cpu_access(pdst, blt->DstStride, y1, y2))
 			return;
-		}
-		SWSolidFill(&pvr2dblt, colour);
-		pdst->bCPUWrites = TRUE;
+		SWSolidFill(blt, screen->solid.colour);
+		end_cpu_access(pdst, blt->DstStride, y1, y2);
 		DBG("%s SW(%p, %d, %d, %d, %d)\n", __func__, pDstPixmap, x1, y1, x2, y2);
 		PERF_INCREMENT(sw_solid);
 	} else {
-		PVR2DPixmapOwnership_GPU(pdst);
-		result = PVR2DBlt(pvr2d_get_screen()->context, &pvr2dblt);
+		blit_pixmap(pdst);
+		result = PVR2DBlt(screen->context, blt);
 		DBG("%s HW(%p, %d, %d, %d, %d) => %d\n", __func__, pDstPixmap, x1, y1, x2, y2, result);
 		PERF_INCREMENT(hw_solid);
                 (void)result;
@@ -392,16 +563,22 @@ static Bool IsSWCopyFaster(struct PVR2DPixmap *psrc, struct PVR2DPixmap *pdst,
 	int sw_time = pixels >> 5;
 	int pages_src, pages_dst;
 
-	pages_dst = (PVR2DGetFlushSize(pdst) + 4096 - 1) >> 12;
-	pages_src = (PVR2DGetFlushSize(psrc) + 4096 - 1) >> 12;
-	if (pdst->owner == PVR2D_OWNER_CPU)
+	if (pdst->owner == PVR2D_OWNER_CPU) {
+		pages_dst = (PVR2DGetFlushSize(pdst) + 4096 - 1) >> 12;
 		hw_time += pages_dst * flush_penalty;
-	else
+	} else {
+		pages_dst = GetAccessPages(pdst, pBlt->DstStride,
+					   pBlt->DSizeY, TRUE);
 		sw_time += pages_dst * flush_penalty;
-	if (psrc->owner == PVR2D_OWNER_CPU)
+	}
+	if (psrc->owner == PVR2D_OWNER_CPU) {
+		pages_src = (PVR2DGetFlushSize(psrc) + 4096 - 1) >> 12;
 		hw_time += pages_src * flush_penalty;
-	else
+	} else {
+		pages_src = GetAccessPages(psrc, pBlt->SrcStride,
+					   pBlt->SizeY, FALSE);
 		sw_time += pages_src * flush_penalty;
+	}
 	if (hw_time < sw_time) {
 		/* use HW rendering */
 		return FALSE;
@@ -416,15 +593,15 @@ static Bool IsSWCopyFaster(struct PVR2DPixmap *psrc, struct PVR2DPixmap *pdst,
 	return TRUE;
 }
 
-/* Variables needed for software copy */
-PixmapPtr pSourcePixmap;
-GCPtr pGC;
-
 static Bool PVR2DPrepareCopy(PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap, int dx,
 			     int dy, int alu, Pixel planemask)
 {
+	struct sgx_exa_copy *copy = &pixmap_screen(pDstPixmap)->copy;
+	PVR2DBLTINFO *blt = &copy->blt;
 	struct PVR2DPixmap *psrc = exaGetPixmapDriverPrivate(pSrcPixmap);
 	struct PVR2DPixmap *pdst = exaGetPixmapDriverPrivate(pDstPixmap);
+	struct sgx_blt_cache_entry *entry;
+	Bool dst_valid, src_valid;
 
 	if (alu >= GXclear && alu <= GXset)
 		PERF_INCREMENT(copy_alu[alu]);
@@ -432,26 +609,38 @@ static Bool PVR2DPrepareCopy(PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap, int dx,
 	if (!checkPVR2DBlt(pDstPixmap, alu, planemask))
 		return FALSE;
 
-	if (!PVR2DValidate(pDstPixmap, pdst, TRUE)) {
+	entry = blt_cache_entry(copy->cache, psrc, pdst);
+	if (psrc && pdst && blt_cache_lookup(entry, psrc, pdst)) {
+		*blt = entry->blt;
+		goto done;
+	}
+
+	PERF_INCREMENT(blt_cache_miss);
+
+	/* validate both, so that both get counted for promotion */
+	dst_valid = PVR2DValidateHot(pDstPixmap, pdst, TRUE);
+	src_valid = PVR2DValidateHot(pSrcPixmap, psrc, FALSE);
+
+	if (!dst_valid) {
 		DBG("%s: FALSE: (!PVR2DValidate(pdst))\n", __func__);
 		PERF_INCREMENT(fallback_copy_validateDst);
 		return FALSE;
 	}
 
-	if (!PVR2DValidate(pSrcPixmap, psrc, FALSE)) {
+	if (!src_valid) {
 		DBG("%s: FALSE: (!PVR2DValidate(psrc))\n", __func__);
 		PERF_INCREMENT(fallback_copy_validateSrc);
 		return FALSE;
 	}
 
-	if (!GetPVR2DFormat(pDstPixmap->drawable.depth, &pvr2dblt.DstFormat)) {
-		DBG("%s: FALSE: (!GetPVR2DFormat(pDstPixmap->drawable.depth, &pvr2dblt.DstFormat))\n", __func__);
+	if (!GetPVR2DFormat(pDstPixmap->drawable.depth, &blt->DstFormat)) {
+		DBG("%s: FALSE: (!GetPVR2DFormat(pDstPixmap->drawable.depth, &blt->DstFormat))\n", __func__);
 		PERF_INCREMENT(fallback_copy_getFormatDst);
 		return FALSE;
 	}
 
-	if (!GetPVR2DFormat(pSrcPixmap->drawable.depth, &pvr2dblt.SrcFormat)) {
-		DBG("%s: FALSE: (!GetPVR2DFormat(pSrcPixmap->drawable.depth, &pvr2dblt.SrcFormat))\n", __func__);
+	if (!GetPVR2DFormat(pSrcPixmap->drawable.depth, &blt->SrcFormat)) {
+		DBG("%s: FALSE: (!GetPVR2DFormat(pSrcPixmap->drawable.depth, &blt->SrcFormat))\n", __func__);
 		PERF_INCREMENT(fallback_copy_getFormatSrc);
 		return FALSE;
 	}
@@ -462,24 +651,26 @@ static Bool PVR2DPrepareCopy(PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap, int dx,
 		DBG("%s: destination owned by GPU\n", __func__);
 	}
 
-	pvr2dblt.CopyCode = PVR2DROPcopy;
-	pvr2dblt.BlitFlags = PVR2D_BLIT_DISABLE_ALL;
+	blt->pDstMemInfo = pdst->pvr2dmem;
+	blt->DstOffset = pdst->offset;
+	blt->DstSurfWidth = pDstPixmap->drawable.width;
+	//blt->DstSurfWidth =  pDstPixmap->devKind * 8 / pDstPixmap->drawable.depth ;
+	blt->DstSurfHeight = pDstPixmap->drawable.height;
+	blt->DstStride = pDstPixmap->devKind;
 
-	pvr2dblt.pDstMemInfo = pdst->pvr2dmem;
-	pvr2dblt.DstSurfWidth = pDstPixmap->drawable.width;
-	//pvr2dblt.DstSurfWidth =  pDstPixmap->devKind * 8 / pDstPixmap->drawable.depth ;
-	pvr2dblt.DstSurfHeight = pDstPixmap->drawable.height;
-	pvr2dblt.DstStride = pDstPixmap->devKind;
+	blt->pSrcMemInfo = psrc->pvr2dmem;
+	blt->SrcOffset = psrc->offset;
+	blt->SrcSurfWidth = pSrcPixmap->drawable.width;
+	//blt->SrcSurfWidth =  pSrcPixmap->devKind * 8 / pSrcPixmap->drawable.depth ;
+	blt->SrcSurfHeight = pSrcPixmap->drawable.height;
+	blt->SrcStride = pSrcPixmap->devKind;
 
-	pvr2dblt.pSrcMemInfo = psrc->pvr2dmem;
-	pvr2dblt.SrcSurfWidth = pSrcPixmap->drawable.width;
-	//pvr2dblt.SrcSurfWidth =  pSrcPixmap->devKind * 8 / pSrcPixmap->drawable.depth ; 
-	pvr2dblt.SrcSurfHeight = pSrcPixmap->drawable.height;
-	pvr2dblt.SrcStride = pSrcPixmap->devKind;
+	DBG("%s: pSrcPixmap=%p, BlitFlags=0x%x, DstFormat=0x%x, SrcFormat=0x%x\n", __func__, pSrcPixmap, blt->BlitFlags, blt->DstFormat, blt->SrcFormat);
 
-	DBG("%s: pSrcPixmap=%p, BlitFlags=0x%x, DstFormat=0x%x, SrcFormat=0x%x\n", __func__, pSrcPixmap, pvr2dblt.BlitFlags, pvr2dblt.DstFormat, pvr2dblt.SrcFormat);
+	blt_cache_store(entry, psrc, pdst, blt);
 
-	pSourcePixmap = pSrcPixmap;
+ done:
+	copy->src = pSrcPixmap;
 
 	return TRUE;
 }
@@ -487,38 +678,47 @@ static Bool PVR2DPrepareCopy(PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap, int dx,
 static void PVR2DCopy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX,
 		      int dstY, int width, int height)
 {
-	PVR2DCONTEXTHANDLE context = pvr2d_get_screen()->context;
+	struct PVR2DPixmap *pdst = exaGetPixmapDriverPrivate(pDstPixmap);
+	struct pvr2d_screen *screen = pdst->screen;
+	struct sgx_exa_copy *copy = &screen->copy;
+	PVR2DBLTINFO *blt = &copy->blt;
+	PixmapPtr pSrcPixmap = copy->src;
 	PVR2DERROR result;
 	RegionPtr pReg;
 
-	pvr2dblt.SizeX = pvr2dblt.DSizeX = width;
-	pvr2dblt.SizeY = pvr2dblt.DSizeY = height;
-	pvr2dblt.DstX = dstX;
-	pvr2dblt.DstY = dstY;
-	pvr2dblt.SrcX = srcX;
-	pvr2dblt.SrcY = srcY;
-
-	if (IsSWCopyFaster(exaGetPixmapDriverPrivate(pSourcePixmap), exaGetPixmapDriverPrivate(pDstPixmap), &pvr2dblt)) {
-		if (!pGC) {
-			pGC = GetScratchGC(pDstPixmap->drawable.depth, pDstPixmap->drawable.pScreen);
-			ValidateGC(&pDstPixmap->drawable, pGC);
+	blt->SizeX = blt->DSizeX = width;
+	blt->SizeY = blt->DSizeY = height;
+	blt->DstX = dstX;
+	blt->DstY = dstY;
+	blt->SrcX = srcX;
+	blt->SrcY = srcY;
+
+	if (IsSWCopyFaster(exaGetPixmapDriverPrivate(pSrcPixmap), pdst, blt)) {
+		if (!copy->gc) {
+			copy->gc = GetScratchGC(pDstPixmap->drawable.depth, pDstPixmap->drawable.pScreen);
+			ValidateGC(&pDstPixmap->drawable, copy->gc);
+		}
+		if (!begin_sw_access(pSrcPixmap, srcY, srcY + height) ||
+		    !begin_sw_access(pDstPixmap, dstY, dstY + height)) {
+			pSrcPixmap->devPrivate.ptr = NULL;
+			pDstPixmap->devPrivate.ptr = NULL;
+			return;
 		}
-		PVR2DPrepareAccess(pDstPixmap, EXA_PREPARE_DEST);
-		PVR2DPrepareAccess(pSourcePixmap, EXA_PREPARE_SRC);
 		pReg =
-		    fbCopyArea(&pSourcePixmap->drawable, &pDstPixmap->drawable,
-			       pGC, srcX, srcY, width, height, dstX, dstY);
+		    fbCopyArea(&pSrcPixmap->drawable, &pDstPixmap->drawable,
+			       copy->gc, srcX, srcY, width, height, dstX, dstY);
 		if (pReg)
 			RegionDestroy(pReg);
-		PVR2DFinishAccess(pSourcePixmap, EXA_PREPARE_SRC);
-		PVR2DFinishAccess(pDstPixmap, EXA_PREPARE_DEST);
+		end_cpu_access(pdst, pDstPixmap->devKind, dstY, dstY + height);
+		pSrcPixmap->devPrivate.ptr = NULL;
+		pDstPixmap->devPrivate.ptr = NULL;
 		DBG("%s SW(%p, %d, %d, %d, %d, %d, %d)\n", __func__, pDstPixmap,
 		    srcX, srcY, dstX, dstY, width, height);
 		PERF_INCREMENT(sw_copy);
 	} else {
-		PVR2DPixmapOwnership_GPU(exaGetPixmapDriverPrivate(pDstPixmap));
-		PVR2DPixmapOwnership_GPU(exaGetPixmapDriverPrivate(pSourcePixmap));
-		result = PVR2DBlt(context, &pvr2dblt);
+		blit_pixmap(pdst);
+		blit_pixmap(exaGetPixmapDriverPrivate(pSrcPixmap));
+		result = PVR2DBlt(screen->context, blt);
 		DBG("%s HW(%p, %d, %d, %d, %d, %d, %d) => %d\n", __func__,
 		    pDstPixmap, srcX, srcY, dstX, dstY, width, height, result);
 		PERF_INCREMENT(hw_copy);
@@ -526,53 +726,56 @@ static void PVR2DCopy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX,
 	}
 
 	DBG("%s (pDstMemInfo = %p, DstSurfWidth = %lu, DstSurfHeight = %lu, DstStride = %ld)\n",
-	    __func__, pvr2dblt.pDstMemInfo, pvr2dblt.DstSurfWidth,
-	    pvr2dblt.DstSurfHeight, pvr2dblt.DstStride);
+	    __func__, blt->pDstMemInfo, blt->DstSurfWidth,
+	    blt->DstSurfHeight, blt->DstStride);
 	DBG("%s (pSrcMemInfo = %p, SrcSurfWidth = %lu, SrcSurfHeight = %lu, SrcStride = %ld)\n",
-	    __func__, pvr2dblt.pSrcMemInfo, pvr2dblt.SrcSurfWidth,
-	    pvr2dblt.SrcSurfHeight, pvr2dblt.SrcStride);
+	    __func__, blt->pSrcMemInfo, blt->SrcSurfWidth,
+	    blt->SrcSurfHeight, blt->SrcStride);
 }
 
 static void PVR2DTestCopy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX,
 			  int dstY, int width, int height)
 {
-	PVR2DCONTEXTHANDLE context = pvr2d_get_screen()->context;
 	int i, j;
 	struct PVR2DPixmap *pdst = exaGetPixmapDriverPrivate(pDstPixmap);
-	struct PVR2DPixmap *psrc = exaGetPixmapDriverPrivate(pSourcePixmap);
+	struct pvr2d_screen *screen = pdst->screen;
+	PVR2DCONTEXTHANDLE context = screen->context;
+	PVR2DBLTINFO *blt = &screen->copy.blt;
+	PixmapPtr pSrcPixmap = screen->copy.src;
+	struct PVR2DPixmap *psrc = exaGetPixmapDriverPrivate(pSrcPixmap);
 	unsigned char *line, *p;
 	unsigned int cpp = pDstPixmap->drawable.bitsPerPixel / 8;
 	unsigned long srcCrc = 0, dstCrc = 0;
 
-	if (pvr2dblt.DstFormat != pvr2dblt.SrcFormat) {
+	if (blt->DstFormat != blt->SrcFormat) {
 		ErrorF("%s: %p => %p: DstFormat != SrcFormat\n",
-		       __func__, pSourcePixmap, pDstPixmap);
-		if (!OptionCopyOnly)
+		       __func__, pSrcPixmap, pDstPixmap);
+		if (!screen->test_copy_only)
 			PVR2DCopy(pDstPixmap, srcX, srcY, dstX, dstY, width,
 				  height);
 		return;
 	}
 
-	pvr2dblt.SizeX = pvr2dblt.DSizeX = width;
-	pvr2dblt.SizeY = pvr2dblt.DSizeY = height;
-	pvr2dblt.DstX = dstX;
-	pvr2dblt.DstY = dstY;
-	pvr2dblt.SrcX = srcX;
-	pvr2dblt.SrcY = srcY;
+	blt->SizeX = blt->DSizeX = width;
+	blt->SizeY = blt->DSizeY = height;
+	blt->DstX = dstX;
+	blt->DstY = dstY;
+	blt->SrcX = srcX;
+	blt->SrcY = srcY;
 
 	/* wait for any blits to complete, and flush the pixmap */
 	PVR2DQueryBlitsComplete(context, psrc->pvr2dmem, 1);
 	PVR2DFlushCache(psrc);
 
 	/* write the CRC pattern */
-	p = psrc->pvr2dmem->pBase;
-	p += srcY * pvr2dblt.SrcStride + srcX * cpp;
+	p = (unsigned char *) psrc->pvr2dmem->pBase + psrc->offset;
+	p += srcY * blt->SrcStride + srcX * cpp;
 	line = p;
 	for (j = 0; j < height; j++) {
 		for (i = 0; i < width * cpp; i++) {
 			srcCrc += *p++ ^ i;
 		}
-		p = line += pvr2dblt.SrcStride;
+		p = line += blt->SrcStride;
 	}
 
 	/* wait for any blits to complete, and flush the pixmap */
@@ -580,50 +783,286 @@ static void PVR2DTestCopy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX,
 	PVR2DFlushCache(pdst);
 
 	/* read the CRC pattern */
-	p = pdst->pvr2dmem->pBase;
-	p += dstY * pvr2dblt.DstStride + dstX * cpp;
+	p = (unsigned char *) pdst->pvr2dmem->pBase + pdst->offset;
+	p += dstY * blt->DstStride + dstX * cpp;
 	line = p;
 	for (j = 0; j < height; j++) {
 		for (i = 0; i < width * cpp; i++) {
 			dstCrc += *p++ ^ i;
 		}
-		p = line += pvr2dblt.DstStride;
+		p = line += blt->DstStride;
 	}
 
 	if (srcCrc != dstCrc)
 		ErrorF("%s: %p => %p: CRC failed! %08lx != %08lx\n",
-		       __func__, pSourcePixmap, pDstPixmap, srcCrc, dstCrc);
+		       __func__, pSrcPixmap, pDstPixmap, srcCrc, dstCrc);
 
-	if (!OptionCopyOnly)
+	if (!screen->test_copy_only)
 		PVR2DCopy(pDstPixmap, srcX, srcY, dstX, dstY, width, height);
 }
 
 static void PVR2DDoneCopy(PixmapPtr pDstPixmap)
 {
-	if (pGC) {
-		FreeScratchGC(pGC);
-		pGC = NULL;
+	struct sgx_exa_copy *copy = &pixmap_screen(pDstPixmap)->copy;
+
+	if (copy->gc) {
+		FreeScratchGC(copy->gc);
+		copy->gc = NULL;
 	}
+
+	copy->src = NULL;
 }
 
 #ifdef PVR2D_EXT_BLIT
 
-static PVR2DEXTBLTINFO pvr2dextblt;
-static PicturePtr pSrcPict[2];
+/*
+ * The RENDER operations accelerated with the SGX. Only combinations
+ * whose output has been checked against pixman are allowed, all
+ * others fall back to software.
+ */
+#define SGX_COMPOSITE_OPS \
+	((1 << PictOpSrc) | (1 << PictOpOver) | (1 << PictOpAdd))
+
+static const struct {
+	PictFormatShort format;
+	PVR2DFORMAT pvr2d_format;
+	/* can be sampled, ie. has no undefined alpha channel */
+	Bool src;
+} composite_formats[] = {
+	{ PICT_a8r8g8b8, PVR2D_ARGB8888, TRUE },
+	{ PICT_x8r8g8b8, PVR2D_ARGB8888, FALSE },
+	{ PICT_r5g6b5, PVR2D_RGB565, TRUE },
+	{ PICT_a8, PVR2D_ALPHA8, TRUE },
+};
+
+static Bool GetCompositeFormat(PicturePtr pPict, Bool src,
+			       PVR2DFORMAT *format)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(composite_formats); i++) {
+		if (composite_formats[i].format != pPict->format)
+			continue;
+
+		if (src && !composite_formats[i].src)
+			return FALSE;
+
+		if (format)
+			*format = composite_formats[i].pvr2d_format;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static Bool checkCompositePicture(PicturePtr pPict, Bool src)
+{
+	if (!pPict->pDrawable) {
+		DBGCOMPOSITE("%s: FALSE: source picture\n", __func__);
+		PERF_INCREMENT(fallback_composite_sourcePict);
+		return FALSE;
+	}
+
+	if (pPict->alphaMap) {
+		DBGCOMPOSITE("%s: FALSE: alpha map\n", __func__);
+		PERF_INCREMENT(fallback_composite_alphaMap);
+		return FALSE;
+	}
+
+	if (!GetCompositeFormat(pPict, src, NULL)) {
+		DBGCOMPOSITE("%s: FALSE: format 0x%x\n", __func__,
+			     pPict->format);
+		PERF_INCREMENT(fallback_composite_format);
+		return FALSE;
+	}
+
+	if (!src)
+		return TRUE;
+
+	if (pPict->filter != PictFilterNearest &&
+	    pPict->filter != PictFilterBilinear) {
+		DBGCOMPOSITE("%s: FALSE: filter 0x%x\n", __func__,
+			     pPict->filter);
+		PERF_INCREMENT(fallback_composite_filter);
+		return FALSE;
+	}
+
+	/* See PVR2DSetFilterRepeat() */
+	if (pPict->transform && pPict->repeatType == RepeatNone) {
+		DBGCOMPOSITE("%s: FALSE: transform without repeat\n",
+			     __func__);
+		PERF_INCREMENT(fallback_composite_transform);
+		return FALSE;
+	}
+
+	return TRUE;
+}
 
 static Bool PVR2DCheckComposite(int op, PicturePtr pSrc, PicturePtr pMask,
 				PicturePtr pDst)
 {
-	PVR2DFORMAT unused;
-	Bool retValue;
-	retValue = op <= PictOpAdd && pSrc->filter <= PictFilterBilinear
-	    && pDst->pDrawable && pDst->pDrawable->bitsPerPixel >= 8
-	    && GetPVR2DFormat(pDst->pDrawable->depth, &unused)
-	    && pSrc->pDrawable
-	    && GetPVR2DFormat(pSrc->pDrawable->depth, &unused)
-	    && (!pMask || (pMask-> filter <= PictFilterBilinear && pMask-> pDrawable && GetPVR2DFormat (pMask-> pDrawable-> depth, &unused)));
-
-	return retValue;
+	if (op >= 32 || !(SGX_COMPOSITE_OPS & (1 << op))) {
+		DBGCOMPOSITE("%s: FALSE: op %d\n", __func__, op);
+		PERF_INCREMENT(fallback_composite_op);
+		return FALSE;
+	}
+
+	if (pMask && pMask->componentAlpha) {
+		DBGCOMPOSITE("%s: FALSE: component alpha\n", __func__);
+		PERF_INCREMENT(fallback_composite_componentAlpha);
+		return FALSE;
+	}
+
+	return checkCompositePicture(pDst, FALSE) &&
+		checkCompositePicture(pSrc, TRUE) &&
+		(!pMask || checkCompositePicture(pMask, TRUE));
+}
+
+/*
+ * Rows y1 to y2 - 1 of its pixmap which a composite operation reads
+ * from a source picture. Transformed or repeating pictures may be
+ * sampled anywhere.
+ */
+static void composite_src_rows(PicturePtr pPict, PixmapPtr pPix,
+			       int y, int height, int *y1, int *y2)
+{
+	if (pPict->transform || pPict->repeatType != RepeatNone) {
+		*y1 = 0;
+		*y2 = pPix->drawable.height;
+	} else {
+		*y1 = y;
+		*y2 = y + height;
+	}
+}
+
+/* Heuristics for choosing between software and hardware composite.
+ * pix[] are the destination, source and mask pixmaps, y1[] and y2[]
+ * the rows of them the operation touches.
+ * returns	TRUE  : Software composite is faster
+ * 			FALSE : Hardware composite is faster
+ */
+static Bool IsSWCompositeFaster(PixmapPtr pix[3], const int y1[3],
+				const int y2[3], int width, int height)
+{
+	/* flushing a page takes ~31 usec, we want to avoid cache flushing, so give a bigger penalty */
+	const int flush_penalty = 40;
+	/* 3d set-up time is ~160 usec. We round it up a little bit */
+	int hw_time = 200;
+	int pixels = width * height;
+	/* pixman blends roughly 8 px/usec, a quarter of the fill speed */
+	int sw_time = pixels >> 3;
+	struct PVR2DPixmap *ppix;
+	int i, pages;
+
+	for (i = 0; i < 3; i++) {
+		if (!pix[i])
+			continue;
+
+		ppix = exaGetPixmapDriverPrivate(pix[i]);
+		if (ppix->owner == PVR2D_OWNER_CPU) {
+			pages = (PVR2DGetFlushSize(ppix) + 4096 - 1) >> 12;
+			hw_time += pages * flush_penalty;
+		} else {
+			pages = GetAccessPages(ppix, pix[i]->devKind,
+					       y2[i] - y1[i], i == 0);
+			sw_time += pages * flush_penalty;
+		}
+	}
+
+	if (hw_time < sw_time) {
+		/* use HW rendering */
+		return FALSE;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (!pix[i])
+			continue;
+
+		/* surface is busy with SGX, use hardware rendering */
+		ppix = exaGetPixmapDriverPrivate(pix[i]);
+		if (QueryBlitsComplete(ppix, 0) != PVR2D_OK)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Wraps a picture's pixmap for pixman, NULL if it has no CPU mapping */
+static pixman_image_t *composite_image(PicturePtr pPict, PixmapPtr pPix,
+				       Bool src)
+{
+	struct PVR2DPixmap *ppix = exaGetPixmapDriverPrivate(pPix);
+	void *addr = ppix->mallocaddr ? ppix->mallocaddr : ppix->shmaddr;
+	pixman_image_t *image;
+
+	if (!addr)
+		return NULL;
+
+	image = pixman_image_create_bits(pPict->format,
+					 pPix->drawable.width,
+					 pPix->drawable.height,
+					 addr, pPix->devKind);
+	if (!image || !src)
+		return image;
+
+	if (pPict->transform)
+		pixman_image_set_transform(image,
+				(pixman_transform_t *) pPict->transform);
+	/* RENDER and pixman share the repeat values */
+	pixman_image_set_repeat(image, pPict->repeatType);
+	pixman_image_set_filter(image,
+				pPict->filter == PictFilterBilinear ?
+				PIXMAN_FILTER_BILINEAR : PIXMAN_FILTER_NEAREST,
+				NULL, 0);
+
+	return image;
+}
+
+/*
+ * Composites a rectangle of a prepared operation with pixman. Like
+ * software copies, GPU owned pixmaps stay GPU owned and only the rows
+ * used get cache maintenance.
+ */
+static Bool SWComposite(struct sgx_exa_composite *composite,
+			PixmapPtr pix[3], const int y1[3], const int y2[3],
+			int srcX, int srcY, int maskX, int maskY,
+			int dstX, int dstY, int width, int height)
+{
+	PicturePtr pict[3] = {
+		composite->dst, composite->pict[0], composite->pict[1]
+	};
+	pixman_image_t *image[3] = { NULL, NULL, NULL };
+	Bool ret = FALSE;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (pix[i] && !(image[i] = composite_image(pict[i], pix[i],
+							   i > 0)))
+			goto out;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (pix[i] &&
+		    !begin_cpu_access(exaGetPixmapDriverPrivate(pix[i]),
+				      pix[i]->devKind, y1[i], y2[i]))
+			goto out;
+	}
+
+	pixman_image_composite(composite->op, image[1], image[2], image[0],
+			       srcX, srcY, maskX, maskY, dstX, dstY,
+			       width, height);
+
+	end_cpu_access(exaGetPixmapDriverPrivate(pix[0]), pix[0]->devKind,
+		       y1[0], y2[0]);
+	ret = TRUE;
+
+ out:
+	for (i = 0; i < 3; i++) {
+		if (image[i])
+			pixman_image_unref(image[i]);
+	}
+
+	return ret;
 }
 
 static Bool PVR2DSetFilterRepeat(PicturePtr pPict, PVR2DSRCSRFINFO * pSrcInfo)
@@ -666,7 +1105,6 @@ static Bool PVR2DSetFilterRepeat(PicturePtr pPict, PVR2DSRCSRFINFO * pSrcInfo)
 		return FALSE;
 	}
 
-	colour = fg;
 	return TRUE;
 }
 
@@ -674,94 +1112,102 @@ static Bool PVR2DPrepareComposite(int op, PicturePtr pSrc, PicturePtr pMask,
 				  PicturePtr pDst, PixmapPtr pSrcPixmap,
 				  PixmapPtr pMaskPixmap, PixmapPtr pDstPixmap)
 {
+	struct pvr2d_screen *screen = pixmap_screen(pDstPixmap);
+	struct sgx_exa_composite *composite = &screen->composite;
+	PVR2DEXTBLTINFO *blt = &composite->blt;
 	struct PVR2DPixmap *psrc = exaGetPixmapDriverPrivate(pSrcPixmap);
 	struct PVR2DPixmap *pmsk =
 	    pMask ? exaGetPixmapDriverPrivate(pMaskPixmap) : NULL;
 	struct PVR2DPixmap *pdst = exaGetPixmapDriverPrivate(pDstPixmap);
 
 	/*
-	 * There is a bug when Mask == Source. As a workaround turn mask off
-	 * and use a set filters which uses Source as a Mask.
-	 * The downside is when a composite operation MUST requests the same coordinates for
-	 * source and mask or else we will get corrupted output.
-	 *
+	 * PVR2D can't sample the same surface as source and mask. Its
+	 * bDuplicatedSource workaround uses the source coordinates for
+	 * the mask as well, which is only right when they match.
 	 */
-	if (pmsk == psrc) {
-		DBGCOMPOSITE("%s: src == mask unsupported.\n", __func__);
-		pvr2dextblt.bDuplicatedSource = PVR2D_TRUE;
-		pmsk = NULL;
-		//return FALSE;         
-	} else {
-		pvr2dextblt.bDuplicatedSource = PVR2D_FALSE;
+	if (pMask && pMaskPixmap == pSrcPixmap) {
+		DBGCOMPOSITE("%s: FALSE: src == mask\n", __func__);
+		PERF_INCREMENT(fallback_composite_maskIsSource);
+		return FALSE;
 	}
 
-	if (!PVR2DValidate(pDstPixmap, pdst) || !PVR2DValidate(pSrcPixmap, psrc)
-	    || (pmsk && !PVR2DValidate(pMaskPixmap, pmsk))
-	    || !GetPVR2DFormat(pDstPixmap->drawable.depth, &pvr2dextblt.DstFormat)
-	    || !GetPVR2DFormat(pSrcPixmap->drawable.depth, &pvr2dextblt.SrcSurface[0].SrcFormat)
-	    || (pmsk && !GetPVR2DFormat(pMaskPixmap->drawable.depth, &pvr2dextblt.SrcSurface[1].SrcFormat))
-	    || !PVR2DSetFilterRepeat(pSrc, &pvr2dextblt.SrcSurface[0])
-	    || (pmsk && !PVR2DSetFilterRepeat(pMask, &pvr2dextblt.SrcSurface[1])))
-	{
-		DBGCOMPOSITE("%s: prerequisities failed\n", __func__);
+	blt->bDuplicatedSource = PVR2D_FALSE;
+
+	if (!PVR2DValidateExt(pDstPixmap, pdst, TRUE)
+	    || !PVR2DValidateExt(pSrcPixmap, psrc, FALSE)
+	    || (pmsk && !PVR2DValidateExt(pMaskPixmap, pmsk, FALSE))) {
+		DBGCOMPOSITE("%s: FALSE: validation failed\n", __func__);
+		PERF_INCREMENT(fallback_composite_validate);
 		return FALSE;
 	}
 
-	PVR2DPixmapOwnership_GPU(pdst);
-	PVR2DPixmapOwnership_GPU(psrc);
-	PVR2DPixmapOwnership_GPU(pmsk);
+	if (!GetCompositeFormat(pDst, FALSE, &blt->DstFormat)
+	    || !GetCompositeFormat(pSrc, TRUE, &blt->SrcSurface[0].SrcFormat)
+	    || (pmsk && !GetCompositeFormat(pMask, TRUE,
+					    &blt->SrcSurface[1].SrcFormat))
+	    || !PVR2DSetFilterRepeat(pSrc, &blt->SrcSurface[0])
+	    || (pmsk && !PVR2DSetFilterRepeat(pMask, &blt->SrcSurface[1]))) {
+		DBGCOMPOSITE("%s: prerequisities failed\n", __func__);
+		PERF_INCREMENT(fallback_composite_format);
+		return FALSE;
+	}
 
-	pvr2dextblt.BlitFlags = PVR2D_BLIT_DISABLE_ALL;
+	blt->BlitFlags = PVR2D_BLIT_DISABLE_ALL;
 
-	pvr2dextblt.pDstMemInfo = pdst->pvr2dmem;
-	pvr2dextblt.DstSurfWidth = pDstPixmap->drawable.width;
-	pvr2dextblt.DstSurfHeight = pDstPixmap->drawable.height;
-	pvr2dextblt.DstStride = pDstPixmap->devKind;
+	blt->pDstMemInfo = pdst->pvr2dmem;
+	blt->DstSurfWidth = pDstPixmap->drawable.width;
+	blt->DstSurfHeight = pDstPixmap->drawable.height;
+	blt->DstStride = pDstPixmap->devKind;
 
-	pvr2dextblt.SrcSurface[0].pSrcMemInfo = psrc->pvr2dmem;
-	pvr2dextblt.SrcSurface[0].SrcSurfWidth = pSrcPixmap->drawable.width;
-	pvr2dextblt.SrcSurface[0].SrcSurfHeight = pSrcPixmap->drawable.height;
-	pvr2dextblt.SrcSurface[0].SrcStride = pSrcPixmap->devKind;
+	blt->SrcSurface[0].pSrcMemInfo = psrc->pvr2dmem;
+	blt->SrcSurface[0].SrcSurfWidth = pSrcPixmap->drawable.width;
+	blt->SrcSurface[0].SrcSurfHeight = pSrcPixmap->drawable.height;
+	blt->SrcSurface[0].SrcStride = pSrcPixmap->devKind;
 
 	if (pmsk) {
-		pvr2dextblt.SrcSurface[1].pSrcMemInfo = pmsk->pvr2dmem;
-		pvr2dextblt.SrcSurface[1].SrcSurfWidth =
+		blt->SrcSurface[1].pSrcMemInfo = pmsk->pvr2dmem;
+		blt->SrcSurface[1].SrcSurfWidth =
 		    pMaskPixmap->drawable.width;
-		pvr2dextblt.SrcSurface[1].SrcSurfHeight =
+		blt->SrcSurface[1].SrcSurfHeight =
 		    pMaskPixmap->drawable.height;
-		pvr2dextblt.SrcSurface[1].SrcStride = pMaskPixmap->devKind;
-		pvr2dextblt.SrcSurface[1].SrcTexCoord = 1;
+		blt->SrcSurface[1].SrcStride = pMaskPixmap->devKind;
+		blt->SrcSurface[1].SrcTexCoord = 1;
 	} else
-		pvr2dextblt.SrcSurface[1].pSrcMemInfo = NULL;
+		blt->SrcSurface[1].pSrcMemInfo = NULL;
 
 	DBGCOMPOSITE
 	    ("%s: pSrcPixmap=%p, BlitFlags=0x%x, DstFormat=0x%x, SrcFormat=0x%x, op=%i\n",
-	     __func__, pSrcPixmap, pvr2dextblt.BlitFlags, pvr2dextblt.DstFormat,
-	     pvr2dextblt.SrcSurface[0].SrcFormat, op);
+	     __func__, pSrcPixmap, blt->BlitFlags, blt->DstFormat,
+	     blt->SrcSurface[0].SrcFormat, op);
 	DBGCOMPOSITE("%s: DST, width = %i, height=%i, stride=%i\n", __func__,
-		     pvr2dextblt.DstSurfWidth, pvr2dextblt.DstSurfHeight,
-		     pvr2dextblt.DstStride);
+		     blt->DstSurfWidth, blt->DstSurfHeight,
+		     blt->DstStride);
 	DBGCOMPOSITE("%s: SRC, width = %i, height=%i, stride=%i\n", __func__,
-		     pvr2dextblt.SrcSurface[0].SrcSurfWidth,
-		     pvr2dextblt.SrcSurface[0].SrcSurfHeight,
-		     pvr2dextblt.SrcSurface[0].SrcStride);
+		     blt->SrcSurface[0].SrcSurfWidth,
+		     blt->SrcSurface[0].SrcSurfHeight,
+		     blt->SrcSurface[0].SrcStride);
 	if (pmsk) {
 		DBGCOMPOSITE("%s: MskFormat=0x%x\n", __func__,
-			     pvr2dextblt.SrcSurface[1].SrcFormat);
+			     blt->SrcSurface[1].SrcFormat);
 		DBGCOMPOSITE("%s: Mask, width = %i, height=%i, stride=%i\n",
-			     __func__, pvr2dextblt.SrcSurface[1].SrcSurfWidth,
-			     pvr2dextblt.SrcSurface[1].SrcSurfHeight,
-			     pvr2dextblt.SrcSurface[1].SrcStride);
+			     __func__, blt->SrcSurface[1].SrcSurfWidth,
+			     blt->SrcSurface[1].SrcSurfHeight,
+			     blt->SrcSurface[1].SrcStride);
 	}
 
-	if (PVR2DPrepareCompositeBlt(pvr2d_get_screen()->context, &pvr2dextblt,
+	if (PVR2DPrepareCompositeBlt(screen->context, blt,
 		op) != PVR2D_OK) {
 		ErrorF("PVR2DPrepareCompositeBlt() failed\n");
+		PERF_INCREMENT(fallback_composite_prepare);
 		return FALSE;
 	}
 
-	pSrcPict[0] = pSrc;
-	pSrcPict[1] = (pmsk ? pMask : NULL);
+	composite->pict[0] = pSrc;
+	composite->pict[1] = (pmsk ? pMask : NULL);
+	composite->pixmap[0] = pSrcPixmap;
+	composite->pixmap[1] = (pmsk ? pMaskPixmap : NULL);
+	composite->dst = pDst;
+	composite->op = op;
 
 	return TRUE;
 }
@@ -783,20 +1229,48 @@ static inline void transformPoint(PictTransform * transform,
 static void PVR2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX,
 			   int maskY, int dstX, int dstY, int width, int height)
 {
+	struct pvr2d_screen *screen = pixmap_screen(pDst);
+	struct sgx_exa_composite *composite = &screen->composite;
+	PVR2DEXTBLTINFO *blt = &composite->blt;
+	PixmapPtr pix[3] = {
+		pDst, composite->pixmap[0], composite->pixmap[1]
+	};
+	int y1[3], y2[3];
 	float vertices[4 * 3 * 2];
 	float *coord = vertices;
 	xPointFixed srcTopLeft, srcBottomLeft, srcTopRight, srcBottomRight;
 	xPointFixed maskTopLeft, maskBottomLeft, maskTopRight, maskBottomRight;
 
-	float srcW = (float)pvr2dextblt.SrcSurface[0].SrcSurfWidth;
-	float srcH = (float)pvr2dextblt.SrcSurface[0].SrcSurfHeight;
-	float maskW = (float)pvr2dextblt.SrcSurface[1].SrcSurfWidth;
-	float maskH = (float)pvr2dextblt.SrcSurface[1].SrcSurfHeight;
+	float srcW = (float)blt->SrcSurface[0].SrcSurfWidth;
+	float srcH = (float)blt->SrcSurface[0].SrcSurfHeight;
+	float maskW = (float)blt->SrcSurface[1].SrcSurfWidth;
+	float maskH = (float)blt->SrcSurface[1].SrcSurfHeight;
 
 	DBGCOMPOSITE
 	    ("%s: src=(%i,%i),mask=(%i,%i),dst=(%i,%i), width=%i, height=%i\n",
 	     __func__, srcX, srcY, maskX, maskY, dstX, dstY, width, height);
 
+	y1[0] = dstY;
+	y2[0] = dstY + height;
+	composite_src_rows(composite->pict[0], pix[1], srcY, height,
+			   &y1[1], &y2[1]);
+	if (pix[2])
+		composite_src_rows(composite->pict[1], pix[2], maskY, height,
+				   &y1[2], &y2[2]);
+
+	if (IsSWCompositeFaster(pix, y1, y2, width, height) &&
+	    SWComposite(composite, pix, y1, y2, srcX, srcY, maskX, maskY,
+			dstX, dstY, width, height)) {
+		DBGCOMPOSITE("%s: software is faster\n", __func__);
+		PERF_INCREMENT(sw_composite);
+		return;
+	}
+
+	blit_pixmap(exaGetPixmapDriverPrivate(pix[0]));
+	blit_pixmap(exaGetPixmapDriverPrivate(pix[1]));
+	if (pix[2])
+		blit_pixmap(exaGetPixmapDriverPrivate(pix[2]));
+
 	srcTopLeft.x = IntToxFixed(srcX);
 	srcTopLeft.y = IntToxFixed(srcY);
 	srcBottomLeft.x = IntToxFixed(srcX);
@@ -806,14 +1280,14 @@ static void PVR2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX,
 	srcBottomRight.x = IntToxFixed(srcX + width);
 	srcBottomRight.y = IntToxFixed(srcY + height);
 
-	if (pSrcPict[0]->transform) {
-		transformPoint(pSrcPict[0]->transform, &srcTopLeft);
-		transformPoint(pSrcPict[0]->transform, &srcBottomLeft);
-		transformPoint(pSrcPict[0]->transform, &srcTopRight);
-		transformPoint(pSrcPict[0]->transform, &srcBottomRight);
+	if (composite->pict[0]->transform) {
+		transformPoint(composite->pict[0]->transform, &srcTopLeft);
+		transformPoint(composite->pict[0]->transform, &srcBottomLeft);
+		transformPoint(composite->pict[0]->transform, &srcTopRight);
+		transformPoint(composite->pict[0]->transform, &srcBottomRight);
 	}
 
-	if (pSrcPict[1]) {
+	if (composite->pict[1]) {
 		maskTopLeft.x = IntToxFixed(maskX);
 		maskTopLeft.y = IntToxFixed(maskY);
 		maskBottomLeft.x = IntToxFixed(maskX);
@@ -823,11 +1297,11 @@ static void PVR2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX,
 		maskBottomRight.x = IntToxFixed(maskX + width);
 		maskBottomRight.y = IntToxFixed(maskY + height);
 
-		if (pSrcPict[1]->transform) {
-			transformPoint(pSrcPict[1]->transform, &maskTopLeft);
-			transformPoint(pSrcPict[1]->transform, &maskBottomLeft);
-			transformPoint(pSrcPict[1]->transform, &maskTopRight);
-			transformPoint(pSrcPict[1]->transform,
+		if (composite->pict[1]->transform) {
+			transformPoint(composite->pict[1]->transform, &maskTopLeft);
+			transformPoint(composite->pict[1]->transform, &maskBottomLeft);
+			transformPoint(composite->pict[1]->transform, &maskTopRight);
+			transformPoint(composite->pict[1]->transform,
 				       &maskBottomRight);
 		}
 	}
@@ -836,7 +1310,7 @@ static void PVR2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX,
 	*coord++ = (float)dstY;
 	*coord++ = xFixedToFloat(srcTopLeft.x) / srcW;
 	*coord++ = xFixedToFloat(srcTopLeft.y) / srcH;
-	if (pvr2dextblt.SrcSurface[1].pSrcMemInfo) {
+	if (blt->SrcSurface[1].pSrcMemInfo) {
 		*coord++ = xFixedToFloat(maskTopLeft.x) / maskW;
 		*coord++ = xFixedToFloat(maskTopLeft.y) / maskH;
 	}
@@ -845,7 +1319,7 @@ static void PVR2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX,
 	*coord++ = (float)(dstY + height);
 	*coord++ = xFixedToFloat(srcBottomLeft.x) / srcW;
 	*coord++ = xFixedToFloat(srcBottomLeft.y) / srcH;
-	if (pvr2dextblt.SrcSurface[1].pSrcMemInfo) {
+	if (blt->SrcSurface[1].pSrcMemInfo) {
 		*coord++ = xFixedToFloat(maskBottomLeft.x) / maskW;
 		*coord++ = xFixedToFloat(maskBottomLeft.y) / maskH;
 	}
@@ -854,7 +1328,7 @@ static void PVR2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX,
 	*coord++ = (float)dstY;
 	*coord++ = xFixedToFloat(srcTopRight.x) / srcW;
 	*coord++ = xFixedToFloat(srcTopRight.y) / srcH;
-	if (pvr2dextblt.SrcSurface[1].pSrcMemInfo) {
+	if (blt->SrcSurface[1].pSrcMemInfo) {
 		*coord++ = xFixedToFloat(maskTopRight.x) / maskW;
 		*coord++ = xFixedToFloat(maskTopRight.y) / maskH;
 	}
@@ -863,28 +1337,165 @@ static void PVR2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX,
 	*coord++ = (float)(dstY + height);
 	*coord++ = xFixedToFloat(srcBottomRight.x) / srcW;
 	*coord++ = xFixedToFloat(srcBottomRight.y) / srcH;
-	if (pvr2dextblt.SrcSurface[1].pSrcMemInfo) {
+	if (blt->SrcSurface[1].pSrcMemInfo) {
 		*coord++ = xFixedToFloat(maskBottomRight.x) / maskW;
 		*coord++ = xFixedToFloat(maskBottomRight.y) / maskH;
 	}
 
-	if (PVR2DCompositeBlt(pvr2d_get_screen()->context, &pvr2dextblt,
+	if (PVR2DCompositeBlt(screen->context, blt,
 		vertices) != PVR2D_OK) {
 		ErrorF("PVR2DCompositeBlt() failed\n");
+		return;
 	}
+
+	PERF_INCREMENT(hw_composite);
 }
 
 static void PVR2DDoneComposite(PixmapPtr pDst)
 {
+	struct pvr2d_screen *screen = pixmap_screen(pDst);
+	PVR2DEXTBLTINFO *blt = &screen->composite.blt;
+
 	DBGCOMPOSITE("%s\n", __func__);
-	if (PVR2DFinishCompositeBlt(pvr2d_get_screen()->context, &pvr2dextblt)
+	if (PVR2DFinishCompositeBlt(screen->context, blt)
 		!= PVR2D_OK) {
 		ErrorF("PVR2DFinishComposite() failed\n");
 	}
 }
 
+/*
+ * Composites a batch of rectangles between two pictures of driver
+ * pixmaps with the driver hooks directly, without EXA. Returns FALSE
+ * without rendering anything if the operation isn't accelerated.
+ */
+Bool PVR2DCompositeRects(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+			 int nrect, const struct sgx_composite_rect *rects)
+{
+	PixmapPtr pSrcPixmap = (PixmapPtr) pSrc->pDrawable;
+	PixmapPtr pDstPixmap = (PixmapPtr) pDst->pDrawable;
+	int i;
+
+	if (pSrc->pDrawable->type != DRAWABLE_PIXMAP ||
+	    pDst->pDrawable->type != DRAWABLE_PIXMAP)
+		return FALSE;
+
+	if (!PVR2DCheckComposite(op, pSrc, NULL, pDst) ||
+	    !PVR2DPrepareComposite(op, pSrc, NULL, pDst,
+				   pSrcPixmap, NULL, pDstPixmap))
+		return FALSE;
+
+	for (i = 0; i < nrect; i++)
+		PVR2DComposite(pDstPixmap, rects[i].src_x, rects[i].src_y,
+			       0, 0, rects[i].dst_x, rects[i].dst_y,
+			       rects[i].width, rects[i].height);
+
+	PVR2DDoneComposite(pDstPixmap);
+
+	return TRUE;
+}
+
 #endif
 
+static void copy_rect(CARD8 *dst, int dst_pitch,
+		      const CARD8 *src, int src_pitch,
+		      int bytes, int height)
+{
+	if (dst_pitch == bytes && src_pitch == bytes) {
+		memcpy(dst, src, bytes * height);
+		return;
+	}
+
+	while (height--) {
+		memcpy(dst, src, bytes);
+		dst += dst_pitch;
+		src += src_pitch;
+	}
+}
+
+/*
+ * Transfers between client memory and a pixmap. Only the rectangle is
+ * touched: the CPU cache is maintained for the rectangle alone and a
+ * GPU owned pixmap stays GPU owned, so the next blit doesn't need to
+ * flush the whole pixmap.
+ */
+static Bool PVR2DUploadToScreen(PixmapPtr pDst, int x, int y, int w, int h,
+				char *src, int src_pitch)
+{
+	struct PVR2DPixmap *pdst = exaGetPixmapDriverPrivate(pDst);
+	int cpp = pDst->drawable.bitsPerPixel / 8;
+	int pitch = pDst->devKind;
+	unsigned int offset, length;
+	CARD8 *dst;
+
+	if (!pdst || pDst->drawable.bitsPerPixel < 8)
+		return FALSE;
+
+	dst = pdst->mallocaddr ? pdst->mallocaddr : pdst->shmaddr;
+	if (!dst)
+		return FALSE;
+
+	offset = y * pitch + x * cpp;
+	length = (h - 1) * pitch + w * cpp;
+
+	if (pdst->owner == PVR2D_OWNER_GPU) {
+		if (QueryBlitsComplete(pdst, 0) != PVR2D_OK)
+			QueryBlitsComplete(pdst, 1);
+
+		/* Partially written cache lines must not hold stale data */
+		PVR2DFlushCacheRange(pdst, DRM_PVR2D_CFLUSH_FROM_GPU,
+				     offset, length);
+	}
+
+	copy_rect(dst + offset, pitch, (CARD8 *) src, src_pitch,
+		  w * cpp, h);
+
+	if (pdst->owner == PVR2D_OWNER_GPU)
+		PVR2DFlushCacheRange(pdst, DRM_PVR2D_CFLUSH_TO_GPU,
+				     offset, length);
+	else
+		PVR2DMarkCPUWrites(pdst, y, y + h);
+
+	PERF_INCREMENT(upload);
+	PERF_INCREMENT2(upload_bytes, w * cpp * h);
+
+	return TRUE;
+}
+
+static Bool PVR2DDownloadFromScreen(PixmapPtr pSrc, int x, int y, int w,
+				    int h, char *dst, int dst_pitch)
+{
+	struct PVR2DPixmap *psrc = exaGetPixmapDriverPrivate(pSrc);
+	int cpp = pSrc->drawable.bitsPerPixel / 8;
+	int pitch = pSrc->devKind;
+	unsigned int offset;
+	CARD8 *src;
+
+	if (!psrc || pSrc->drawable.bitsPerPixel < 8)
+		return FALSE;
+
+	src = psrc->mallocaddr ? psrc->mallocaddr : psrc->shmaddr;
+	if (!src)
+		return FALSE;
+
+	offset = y * pitch + x * cpp;
+
+	if (psrc->owner == PVR2D_OWNER_GPU) {
+		if (QueryBlitsComplete(psrc, 0) != PVR2D_OK)
+			QueryBlitsComplete(psrc, 1);
+
+		PVR2DFlushCacheRange(psrc, DRM_PVR2D_CFLUSH_FROM_GPU, offset,
+				     (h - 1) * pitch + w * cpp);
+	}
+
+	copy_rect((CARD8 *) dst, dst_pitch, src + offset, pitch,
+		  w * cpp, h);
+
+	PERF_INCREMENT(download);
+	PERF_INCREMENT2(download_bytes, w * cpp * h);
+
+	return TRUE;
+}
+
 static void PVR2DWaitMarker(ScreenPtr pScreen, int marker)
 {
 }
@@ -893,6 +1504,8 @@ static void *PVR2DCreatePixmap2(ScreenPtr pScreen, int width, int height,
 				int depth, int usage_hint, int bitsPerPixel,
 				int *new_fb_pitch)
 {
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(pScreen));
 	struct PVR2DPixmap *ppix = calloc(1, sizeof(struct PVR2DPixmap));
 	int pitch;
 	int devKind;
@@ -906,17 +1519,17 @@ static void *PVR2DCreatePixmap2(ScreenPtr pScreen, int width, int height,
 
 	*new_fb_pitch = pitch;
 
+	ppix->screen = screen;
 	ppix->shmid = -1;
+	PVR2DPixmapChanged(ppix);
 
-	if (CreateScreenPixmap) {
-		struct pvr2d_screen *screen = pvr2d_get_screen();
-
+	if (screen->create_screen_pixmap) {
 		ppix->pvr2dmem = screen->sys_mem_info;
 		ppix->shmaddr = screen->sys_mem_info->pBase;
-		CreateScreenPixmap = FALSE;
+		screen->create_screen_pixmap = FALSE;
 	}
-	if (pixmapsHT)
-		x_hash_table_insert(pixmapsHT, ppix, ppix);
+	if (screen->pixmaps)
+		x_hash_table_insert(screen->pixmaps, ppix, ppix);
 
 	DBG("%s(%p, %d, %d, %d, %d, %d) => %p\n", __func__, pScreen, width,
 	    height, depth, usage_hint, bitsPerPixel, ppix);
@@ -930,10 +1543,11 @@ static void PVR2DDestroyPixmap(ScreenPtr pScreen, void *driverPriv)
 
 	DBG("%s(%p)\n", __func__, ppix);
 
-	if (pixmapsHT)
-		x_hash_table_remove(pixmapsHT, ppix);
+	if (ppix && ppix->screen->pixmaps)
+		x_hash_table_remove(ppix->screen->pixmaps, ppix);
 
 	if (ppix) {
+		PVR2DPixmapChanged(ppix);
 		DestroyPVR2DMemory(pScreen, ppix);
 		free(ppix);
 	}
@@ -944,7 +1558,7 @@ static Bool PVR2DModifyPixmapHeader(PixmapPtr pPixmap, int width, int height,
 				    pointer pPixData)
 {
 	struct PVR2DPixmap *ppix = exaGetPixmapDriverPrivate(pPixmap);
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	struct pvr2d_screen *screen = pixmap_screen(pPixmap);
 	int pitch;
 
 	if (!ppix)
@@ -1004,8 +1618,14 @@ static Bool PVR2DModifyPixmapHeader(PixmapPtr pPixmap, int width, int height,
 			return FALSE;
 	}
 
-	return miModifyPixmapHeader(pPixmap, width, height, depth, bitsPerPixel,
-				    pitch, NULL);
+	if (!miModifyPixmapHeader(pPixmap, width, height, depth, bitsPerPixel,
+				  pitch, NULL))
+		return FALSE;
+
+	/* Cached blit descriptors have the old geometry */
+	PVR2DPixmapChanged(ppix);
+
+	return TRUE;
 }
 
 static Bool PVR2DPrepareAccess(PixmapPtr pPix, int index)
@@ -1033,7 +1653,7 @@ static Bool PVR2DPrepareAccess(PixmapPtr pPix, int index)
 	/* only flush when the pixmap memory is written; ignore all other
 	 * accesses. */
 	if (index == EXA_PREPARE_DEST || index == EXA_PREPARE_AUX_DEST)
-		ppix->bCPUWrites = TRUE;
+		ppix->cpu_dirty = PVR2D_ALL_BANDS;
 
 	return TRUE;
 }
@@ -1065,6 +1685,15 @@ static void unmapCallback(void *k, void *v, void *data)
 	/* check if pixmap is used by GPU */
 	if (PVR2D_OK != QueryBlitsComplete(ppix, 0))
 		return;
+	/*
+	 * Promoted pixmaps the GPU hasn't used since the last time go
+	 * back to malloc() memory. The pixmap being validated has no
+	 * mapping yet and is left alone.
+	 */
+	if (ppix->promoted_size && ppix->pvr2dmem && !ppix->gpu_used &&
+	    PVR2DDemotePixmap(ppix))
+		return;
+	ppix->gpu_used = FALSE;
 	PVR2DInvalidate(ppix);
 }
 
@@ -1072,10 +1701,24 @@ static void unmapCallback(void *k, void *v, void *data)
  * Attempt to unmap all pixmaps from GPU.
  * Don't unmap pixmaps in use
  */
-void PVR2DUnmapAllPixmaps(void)
+void PVR2DUnmapAllPixmaps(struct pvr2d_screen *screen)
 {
-	if (pixmapsHT)
-		x_hash_table_foreach(pixmapsHT, unmapCallback, NULL);
+	if (screen->pixmaps)
+		x_hash_table_foreach(screen->pixmaps, unmapCallback, NULL);
+
+	sgx_slab_trim(screen, FALSE);
+}
+
+/* Fill in the parts of the blit descriptors that never change */
+static void init_descriptors(struct pvr2d_screen *screen)
+{
+	screen->solid.blt.CopyCode = PVR2DPATROPcopy;
+	screen->solid.blt.BlitFlags = PVR2D_BLIT_DISABLE_ALL;
+
+	screen->copy.blt.CopyCode = PVR2DROPcopy;
+	screen->copy.blt.BlitFlags = PVR2D_BLIT_DISABLE_ALL;
+
+	screen->composite.blt.BlitFlags = PVR2D_BLIT_DISABLE_ALL;
 }
 
 Bool EXA_Init(ScreenPtr pScreen)
@@ -1087,6 +1730,7 @@ Bool EXA_Init(ScreenPtr pScreen)
 	int errmaj, errmin;
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	FBDevPtr fbdev = FBDEVPTR(pScrn);
+	struct pvr2d_screen *screen;
 
 	if (!LoadSubModule
 	    (pScrn->module, "exa", NULL, NULL, NULL, &exaReq, &errmaj,
@@ -1102,8 +1746,6 @@ Bool EXA_Init(ScreenPtr pScreen)
 		return FALSE;
 	}
 
-	OptionCopyOnly = xf86IsOptionSet(fbdev->Options, OPTION_TEST_COPY_ONLY);
-
 	exa->exa_major = EXA_VERSION_MAJOR;
 	exa->exa_minor = EXA_VERSION_MINOR;
 	exa->flags = EXA_OFFSCREEN_PIXMAPS | EXA_HANDLES_PIXMAPS | EXA_SUPPORTS_PREPARE_AUX;
@@ -1124,12 +1766,17 @@ Bool EXA_Init(ScreenPtr pScreen)
 	exa->DoneCopy = PVR2DDoneCopy;
 
 #ifdef PVR2D_EXT_BLIT
-	exa->CheckComposite = PVR2DCheckComposite;
-	exa->PrepareComposite = PVR2DPrepareComposite;
-	exa->Composite = PVR2DComposite;
-	exa->DoneComposite = PVR2DDoneComposite;
+	if (fbdev->conf.accel_composite) {
+		exa->CheckComposite = PVR2DCheckComposite;
+		exa->PrepareComposite = PVR2DPrepareComposite;
+		exa->Composite = PVR2DComposite;
+		exa->DoneComposite = PVR2DDoneComposite;
+	}
 #endif
 
+	exa->UploadToScreen = PVR2DUploadToScreen;
+	exa->DownloadFromScreen = PVR2DDownloadFromScreen;
+
 	exa->WaitMarker = PVR2DWaitMarker;
 
 	exa->PrepareAccess = PVR2DPrepareAccess;
@@ -1141,36 +1788,68 @@ Bool EXA_Init(ScreenPtr pScreen)
 	exa->DestroyPixmap = PVR2DDestroyPixmap;
 	exa->ModifyPixmapHeader = PVR2DModifyPixmapHeader;
 
-	if (!exaDriverInit(pScreen, exa)) {
-		FatalError("exaDriverInit() failed\n");
+	/* The per-screen state must exist before the first pixmap */
+	if (!PVR2D_Init(pScrn)) {
+		FatalError("PVR2D_Init() failed\n");
 		return FALSE;
 	}
 
-	if (!PVR2D_Init(pScrn)) {
-		FatalError("PVR2D_Init() failed\n");
+	screen = pvr2d_get_screen(pScrn);
+
+	screen->test_copy_only =
+		xf86IsOptionSet(fbdev->Options, OPTION_TEST_COPY_ONLY);
+	screen->slabs.enabled = fbdev->conf.pixmap_slabs;
+	screen->promote_pixmaps = fbdev->conf.promote_pixmaps;
+	screen->locked_limit = (unsigned long) fbdev->conf.locked_memory << 20;
+	if (fbdev->conf.huge_pages) {
+		screen->huge_page_size = PVR2DHugePageSize();
+		if (!screen->huge_page_size)
+			xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+				   "Huge pages are not available\n");
+	}
+	init_descriptors(screen);
+
+	if (!exaDriverInit(pScreen, exa)) {
+		FatalError("exaDriverInit() failed\n");
 		return FALSE;
 	}
 
-	CreateScreenPixmap = TRUE;
+	screen->create_screen_pixmap = TRUE;
+
+	if (fbdev->conf.accel_composite && !sgx_glyph_init(pScreen))
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+			   "Glyph atlas initialization failed\n");
+
+	if (fbdev->conf.async_wait && !sgx_wait_init(pScreen))
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+			   "Asynchronous GPU waits initialization failed\n");
 
 	if (!DRI2_Init(pScreen))
 		FatalError("DRI2_Init() failed\n");
 
 	PVR2D_PerfInit(pScreen);
 
-	pixmapsHT = x_hash_table_new(NULL, NULL, NULL, NULL);
+	screen->pixmaps = x_hash_table_new(NULL, NULL, NULL, NULL);
 
 	return TRUE;
 }
 
 void EXA_Fini(ScreenPtr pScreen)
 {
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+
+	sgx_glyph_fini(pScreen);
+	sgx_wait_fini(pScreen);
+
 	PVR2DDelayedMemDestroy(TRUE);
-	PVR2D_DeInit();
+	sgx_pixmem_trim();
+	PVR2D_DeInit(pScrn);
 	PVR2D_PerfFini(pScreen);
 
 	DRI2_Fini(pScreen);
 
-	if (pixmapsHT)
-		x_hash_table_free(pixmapsHT);
+	if (screen->pixmaps)
+		x_hash_table_free(screen->pixmaps);
+	screen->pixmaps = NULL;
 }
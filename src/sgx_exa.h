@@ -31,7 +31,16 @@
  * Compare to CREATE_PIXMAP_USAGE_* in the server.
  */
 enum {
-	SGX_EXA_CREATE_PIXMAP_FLIP = 0x10000000
+	SGX_EXA_CREATE_PIXMAP_FLIP = 0x10000000,
+	/* driver internal pixmap used as a GPU source or destination */
+	SGX_EXA_CREATE_PIXMAP_GPU,
+};
+
+/* A rectangle of a batch composite */
+struct sgx_composite_rect {
+	short src_x, src_y;
+	short dst_x, dst_y;
+	unsigned short width, height;
 };
 
 extern Bool getDrawableInfo(DrawablePtr pDraw, PVR2DMEMINFO ** ppMemInfo,
@@ -41,7 +50,13 @@ extern int getSGXPitchAlign(int width);
 
 extern Bool GetPVR2DFormat(int depth, PVR2DFORMAT * format);
 
-extern void PVR2DUnmapAllPixmaps(void);
+extern void PVR2DUnmapAllPixmaps(struct pvr2d_screen *screen);
+
+#ifdef PVR2D_EXT_BLIT
+extern Bool PVR2DCompositeRects(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+				int nrect,
+				const struct sgx_composite_rect *rects);
+#endif
 
 extern Bool EXA_Init(ScreenPtr pScreen);
 
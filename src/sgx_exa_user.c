@@ -32,16 +32,32 @@ void sgx_exa_copy_region(DrawablePtr draw, RegionPtr reg, DrawablePtr src_draw,
 			DrawablePtr dst_draw)
 {
         ScreenPtr screen = dst_draw->pScreen;
-	RegionPtr copy_clip = RegionCreate(NULL, 0);
+	RegionPtr copy_clip;
+	BoxRec box;
         GCPtr gc;
 
+	if (!RegionNotEmpty(reg))
+		return;
+
+	/* Only the damaged part of the drawable needs to be copied */
+	box = *RegionExtents(reg);
+	box.x1 = max(box.x1, 0);
+	box.y1 = max(box.y1, 0);
+	box.x2 = min(box.x2, draw->width);
+	box.y2 = min(box.y2, draw->height);
+	if (box.x1 >= box.x2 || box.y1 >= box.y2)
+		return;
+
+	copy_clip = RegionCreate(NULL, 0);
+
         gc = GetScratchGC(dst_draw->depth, screen);
 	RegionCopy(copy_clip, reg);
         (*gc->funcs->ChangeClip)(gc, CT_REGION, copy_clip, 0);
         ValidateGC(dst_draw, gc);
 
-        (*gc->ops->CopyArea)(src_draw, dst_draw, gc, 0, 0, draw->width,
-                                draw->height, 0, 0);
+	(*gc->ops->CopyArea)(src_draw, dst_draw, gc, box.x1, box.y1,
+			     box.x2 - box.x1, box.y2 - box.y1,
+			     box.x1, box.y1);
 
         FreeScratchGC(gc);
 }
@@ -75,6 +91,7 @@ Bool sgx_exa_update_pixmap(PixmapPtr pPixmap,
 	if (ret) {
 		priv->pvr2dmem = mem_info;
 		priv->shmaddr = mem_info->pBase;
+		PVR2DPixmapChanged(priv);
 	}
 
 	return ret;
@@ -0,0 +1,616 @@
+/*
+ * Copyright (c) 2010  Nokia Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Glyph atlas for anti-aliased text.
+ *
+ * A8 glyphs are copied once into a couple of GPU mapped A8 atlas
+ * pixmaps, split into fixed size cells which are recycled in least
+ * recently used order. A glyph run is then rendered by adding the
+ * glyphs from the atlas into a mask with one batch of composite blits
+ * per atlas, and compositing the source through the mask into the
+ * destination.
+ *
+ * Runs that can't be handled here (no mask format, ARGB glyphs, big
+ * glyphs, more glyphs than fit into the atlas) go to EXA as before.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "fbdev.h"
+#include "sgx_pvr2d.h"
+#include "sgx_exa.h"
+#include "sgx_glyph.h"
+#include "perf.h"
+
+#include <mipict.h>
+#include <gcstruct.h>
+
+#ifdef PVR2D_EXT_BLIT
+
+#define GLYPH_ATLAS_WIDTH	1024
+#define GLYPH_MASK_MAX_WIDTH	2048
+#define GLYPH_MASK_MAX_HEIGHT	256
+
+struct glyph_slot {
+	GlyphPtr glyph;
+	short x, y;
+	/* glyph run the slot was last used in */
+	unsigned int serial;
+	/* LRU list, most recently used first */
+	struct glyph_slot *prev, *next;
+};
+
+struct glyph_atlas {
+	/* cell size, glyphs up to this size go into the atlas */
+	int cell;
+	int height;
+	int num_slots;
+	struct glyph_slot *slots;
+	/* list head, next is the most and prev the least recently used */
+	struct glyph_slot lru;
+	PicturePtr picture;
+	/* composite rectangles of the current run */
+	struct sgx_composite_rect *rects;
+	int num_rects;
+};
+
+struct sgx_glyph_cache {
+	GlyphsProcPtr glyphs;
+	UnrealizeGlyphProcPtr unrealize_glyph;
+
+	struct glyph_atlas atlas[2];
+	/* GlyphPtr -> struct glyph_slot */
+	x_hash_table *hash;
+	unsigned int serial;
+
+	PicturePtr mask;
+	int mask_width;
+	int mask_height;
+
+	/* the pixmaps couldn't be allocated, don't try again */
+	Bool failed;
+};
+
+static const struct {
+	int cell;
+	int height;
+} atlas_sizes[] = {
+	{ .cell = 16, .height = 128, },
+	{ .cell = 32, .height = 256, },
+};
+
+static struct sgx_glyph_cache *get_cache(ScreenPtr pScreen)
+{
+	return pvr2d_get_screen(xf86ScreenToScrn(pScreen))->glyphs;
+}
+
+static PicturePtr create_a8_picture(ScreenPtr pScreen, int width, int height)
+{
+	PictFormatPtr format = PictureMatchFormat(pScreen, 8, PICT_a8);
+	PixmapPtr pixmap;
+	PicturePtr picture;
+	int error;
+
+	if (!format)
+		return NULL;
+
+	pixmap = (*pScreen->CreatePixmap)(pScreen, width, height, 8,
+					  SGX_EXA_CREATE_PIXMAP_GPU);
+	if (!pixmap)
+		return NULL;
+
+	picture = CreatePicture(0, &pixmap->drawable, format, 0, NULL,
+				serverClient, &error);
+
+	/* the picture holds a reference to the pixmap */
+	(*pScreen->DestroyPixmap)(pixmap);
+
+	return picture;
+}
+
+static void lru_remove(struct glyph_slot *slot)
+{
+	slot->prev->next = slot->next;
+	slot->next->prev = slot->prev;
+}
+
+static void lru_add_head(struct glyph_atlas *atlas, struct glyph_slot *slot)
+{
+	slot->next = atlas->lru.next;
+	slot->prev = &atlas->lru;
+	atlas->lru.next->prev = slot;
+	atlas->lru.next = slot;
+}
+
+static void lru_add_tail(struct glyph_atlas *atlas, struct glyph_slot *slot)
+{
+	slot->prev = atlas->lru.prev;
+	slot->next = &atlas->lru;
+	atlas->lru.prev->next = slot;
+	atlas->lru.prev = slot;
+}
+
+static void atlas_fini(struct glyph_atlas *atlas)
+{
+	if (atlas->picture)
+		FreePicture(atlas->picture, 0);
+	atlas->picture = NULL;
+
+	free(atlas->slots);
+	atlas->slots = NULL;
+
+	free(atlas->rects);
+	atlas->rects = NULL;
+}
+
+static Bool atlas_init(ScreenPtr pScreen, struct glyph_atlas *atlas,
+		       int cell, int height)
+{
+	int columns = GLYPH_ATLAS_WIDTH / cell;
+	int i;
+
+	atlas->cell = cell;
+	atlas->height = height;
+	atlas->num_slots = columns * (height / cell);
+
+	atlas->slots = calloc(atlas->num_slots, sizeof atlas->slots[0]);
+	atlas->rects = calloc(atlas->num_slots, sizeof atlas->rects[0]);
+	if (!atlas->slots || !atlas->rects)
+		goto error_free;
+
+	atlas->picture = create_a8_picture(pScreen, GLYPH_ATLAS_WIDTH, height);
+	if (!atlas->picture)
+		goto error_free;
+
+	atlas->lru.next = atlas->lru.prev = &atlas->lru;
+
+	for (i = 0; i < atlas->num_slots; i++) {
+		struct glyph_slot *slot = &atlas->slots[i];
+
+		slot->x = (i % columns) * cell;
+		slot->y = (i / columns) * cell;
+		lru_add_tail(atlas, slot);
+	}
+
+	return TRUE;
+
+ error_free:
+	atlas_fini(atlas);
+
+	return FALSE;
+}
+
+static Bool cache_realize(ScreenPtr pScreen, struct sgx_glyph_cache *cache)
+{
+	int i;
+
+	if (cache->atlas[0].picture)
+		return TRUE;
+
+	if (cache->failed)
+		return FALSE;
+
+	for (i = 0; i < ARRAY_SIZE(cache->atlas); i++) {
+		if (!atlas_init(pScreen, &cache->atlas[i],
+				atlas_sizes[i].cell, atlas_sizes[i].height))
+			goto error_fini;
+	}
+
+	return TRUE;
+
+ error_fini:
+	while (i--)
+		atlas_fini(&cache->atlas[i]);
+
+	xf86DrvMsg(xf86ScreenToScrn(pScreen)->scrnIndex, X_WARNING,
+		   "Unable to allocate the glyph atlas\n");
+	cache->failed = TRUE;
+
+	return FALSE;
+}
+
+static Bool ensure_mask(ScreenPtr pScreen, struct sgx_glyph_cache *cache,
+			int width, int height)
+{
+	if (width > GLYPH_MASK_MAX_WIDTH || height > GLYPH_MASK_MAX_HEIGHT)
+		return FALSE;
+
+	if (cache->mask && width <= cache->mask_width &&
+	    height <= cache->mask_height)
+		return TRUE;
+
+	if (cache->mask)
+		FreePicture(cache->mask, 0);
+
+	/* Grow in steps to avoid reallocating for every longer line */
+	cache->mask_width = max(ALIGN(width, 256), cache->mask_width);
+	cache->mask_height = max(ALIGN(height, 32), cache->mask_height);
+
+	cache->mask = create_a8_picture(pScreen, cache->mask_width,
+					cache->mask_height);
+	if (!cache->mask) {
+		cache->mask_width = 0;
+		cache->mask_height = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void clear_mask(ScreenPtr pScreen, PicturePtr mask,
+		       int width, int height)
+{
+	xRectangle rect = { .width = width, .height = height };
+	ChangeGCVal gcval = { .val = 0 };
+	GCPtr gc;
+
+	gc = GetScratchGC(mask->pDrawable->depth, pScreen);
+	if (!gc)
+		return;
+
+	ChangeGC(NullClient, gc, GCForeground, &gcval);
+	ValidateGC(mask->pDrawable, gc);
+	(*gc->ops->PolyFillRect)(mask->pDrawable, gc, 1, &rect);
+	FreeScratchGC(gc);
+}
+
+/*
+ * Returns the atlas slot holding the glyph, copying the glyph into
+ * the atlas if needed. Fails if the atlas is full of glyphs of the
+ * current run.
+ */
+static struct glyph_slot *cache_glyph(ScreenPtr pScreen,
+				      struct sgx_glyph_cache *cache,
+				      struct glyph_atlas *atlas,
+				      GlyphPtr glyph)
+{
+	struct glyph_slot *slot;
+
+	slot = x_hash_table_lookup(cache->hash, glyph, NULL);
+	if (slot) {
+		PERF_INCREMENT(glyph_hit);
+		lru_remove(slot);
+		lru_add_head(atlas, slot);
+		slot->serial = cache->serial;
+		return slot;
+	}
+
+	slot = atlas->lru.prev;
+	if (slot->serial == cache->serial && slot->glyph)
+		return NULL;
+
+	if (slot->glyph) {
+		x_hash_table_remove(cache->hash, slot->glyph);
+		PERF_INCREMENT(glyph_evict);
+	}
+
+	PERF_INCREMENT(glyph_miss);
+
+	CompositePicture(PictOpSrc, GlyphPicture(glyph)[pScreen->myNum],
+			 NULL, atlas->picture, 0, 0, 0, 0, slot->x, slot->y,
+			 glyph->info.width, glyph->info.height);
+
+	slot->glyph = glyph;
+	slot->serial = cache->serial;
+	x_hash_table_insert(cache->hash, glyph, slot);
+
+	lru_remove(slot);
+	lru_add_head(atlas, slot);
+
+	return slot;
+}
+
+static struct glyph_atlas *glyph_atlas(struct sgx_glyph_cache *cache,
+				       GlyphPtr glyph)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cache->atlas); i++) {
+		if (glyph->info.width <= cache->atlas[i].cell &&
+		    glyph->info.height <= cache->atlas[i].cell)
+			return &cache->atlas[i];
+	}
+
+	return NULL;
+}
+
+static Bool check_glyphs(int nlist, GlyphListPtr list, GlyphPtr *glyphs,
+			 struct sgx_glyph_cache *cache)
+{
+	int n;
+
+	while (nlist--) {
+		if (list->format->format != PICT_a8)
+			return FALSE;
+
+		n = list->len;
+		list++;
+
+		while (n--) {
+			GlyphPtr glyph = *glyphs++;
+
+			if (glyph->info.width && glyph->info.height &&
+			    !glyph_atlas(cache, glyph))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void glyph_extents(int nlist, GlyphListPtr list, GlyphPtr *glyphs,
+			  BoxPtr extents)
+{
+	int x1, x2, y1, y2;
+	int x = 0, y = 0;
+	int n;
+
+	extents->x1 = MAXSHORT;
+	extents->x2 = MINSHORT;
+	extents->y1 = MAXSHORT;
+	extents->y2 = MINSHORT;
+
+	while (nlist--) {
+		x += list->xOff;
+		y += list->yOff;
+		n = list->len;
+		list++;
+
+		while (n--) {
+			GlyphPtr glyph = *glyphs++;
+
+			x1 = max(x - glyph->info.x, MINSHORT);
+			y1 = max(y - glyph->info.y, MINSHORT);
+			x2 = min(x1 + glyph->info.width, MAXSHORT);
+			y2 = min(y1 + glyph->info.height, MAXSHORT);
+
+			if (glyph->info.width && glyph->info.height) {
+				extents->x1 = min(extents->x1, x1);
+				extents->y1 = min(extents->y1, y1);
+				extents->x2 = max(extents->x2, x2);
+				extents->y2 = max(extents->y2, y2);
+			}
+
+			x += glyph->info.xOff;
+			y += glyph->info.yOff;
+		}
+	}
+}
+
+static Bool glyphs_to_mask(ScreenPtr pScreen, struct sgx_glyph_cache *cache,
+			   int nlist, GlyphListPtr list, GlyphPtr *glyphs,
+			   const BoxRec *extents)
+{
+	int x = 0, y = 0;
+	int i, n;
+
+	cache->serial++;
+
+	for (i = 0; i < ARRAY_SIZE(cache->atlas); i++)
+		cache->atlas[i].num_rects = 0;
+
+	/* First copy all the glyphs of the run into the atlas */
+	while (nlist--) {
+		x += list->xOff;
+		y += list->yOff;
+		n = list->len;
+		list++;
+
+		while (n--) {
+			GlyphPtr glyph = *glyphs++;
+			struct glyph_atlas *atlas;
+			struct glyph_slot *slot;
+			struct sgx_composite_rect *rect;
+
+			if (glyph->info.width && glyph->info.height) {
+				atlas = glyph_atlas(cache, glyph);
+				slot = cache_glyph(pScreen, cache, atlas, glyph);
+				if (!slot)
+					return FALSE;
+
+				rect = &atlas->rects[atlas->num_rects++];
+				rect->src_x = slot->x;
+				rect->src_y = slot->y;
+				rect->dst_x = x - glyph->info.x - extents->x1;
+				rect->dst_y = y - glyph->info.y - extents->y1;
+				rect->width = glyph->info.width;
+				rect->height = glyph->info.height;
+			}
+
+			x += glyph->info.xOff;
+			y += glyph->info.yOff;
+		}
+	}
+
+	clear_mask(pScreen, cache->mask, extents->x2 - extents->x1,
+		   extents->y2 - extents->y1);
+
+	/* Then add them into the mask with one batch per atlas */
+	for (i = 0; i < ARRAY_SIZE(cache->atlas); i++) {
+		struct glyph_atlas *atlas = &cache->atlas[i];
+		int j;
+
+		if (!atlas->num_rects)
+			continue;
+
+		if (PVR2DCompositeRects(PictOpAdd, atlas->picture, cache->mask,
+					atlas->num_rects, atlas->rects)) {
+			PERF_INCREMENT2(glyph_hw, atlas->num_rects);
+			continue;
+		}
+
+		for (j = 0; j < atlas->num_rects; j++) {
+			const struct sgx_composite_rect *rect = &atlas->rects[j];
+
+			CompositePicture(PictOpAdd, atlas->picture, NULL,
+					 cache->mask, rect->src_x, rect->src_y,
+					 0, 0, rect->dst_x, rect->dst_y,
+					 rect->width, rect->height);
+		}
+		PERF_INCREMENT2(glyph_sw, atlas->num_rects);
+	}
+
+	return TRUE;
+}
+
+static void sgx_glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+		       PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+		       int nlist, GlyphListPtr list, GlyphPtr *glyphs)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	PictureScreenPtr ps = GetPictureScreen(pScreen);
+	struct sgx_glyph_cache *cache = get_cache(pScreen);
+	BoxRec extents;
+	int width, height;
+
+	if (!maskFormat || maskFormat->format != PICT_a8 || !nlist)
+		goto fallback;
+
+	if (!check_glyphs(nlist, list, glyphs, cache))
+		goto fallback;
+
+	glyph_extents(nlist, list, glyphs, &extents);
+	if (extents.x2 <= extents.x1 || extents.y2 <= extents.y1)
+		return;
+
+	width = extents.x2 - extents.x1;
+	height = extents.y2 - extents.y1;
+
+	if (!cache_realize(pScreen, cache) ||
+	    !ensure_mask(pScreen, cache, width, height) ||
+	    !glyphs_to_mask(pScreen, cache, nlist, list, glyphs, &extents))
+		goto fallback;
+
+	CompositePicture(op, pSrc, cache->mask, pDst,
+			 xSrc + extents.x1 - list->xOff,
+			 ySrc + extents.y1 - list->yOff,
+			 0, 0, extents.x1, extents.y1, width, height);
+	return;
+
+ fallback:
+	PERF_INCREMENT(glyph_fallback);
+
+	ps->Glyphs = cache->glyphs;
+	(*ps->Glyphs)(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+		      nlist, list, glyphs);
+	cache->glyphs = ps->Glyphs;
+	ps->Glyphs = sgx_glyphs;
+}
+
+static void sgx_unrealize_glyph(ScreenPtr pScreen, GlyphPtr glyph)
+{
+	PictureScreenPtr ps = GetPictureScreen(pScreen);
+	struct sgx_glyph_cache *cache = get_cache(pScreen);
+	struct glyph_slot *slot;
+
+	slot = x_hash_table_lookup(cache->hash, glyph, NULL);
+	if (slot) {
+		struct glyph_atlas *atlas = glyph_atlas(cache, glyph);
+
+		x_hash_table_remove(cache->hash, glyph);
+		slot->glyph = NULL;
+		slot->serial = 0;
+
+		/* Reuse the slot first */
+		lru_remove(slot);
+		lru_add_tail(atlas, slot);
+	}
+
+	ps->UnrealizeGlyph = cache->unrealize_glyph;
+	(*ps->UnrealizeGlyph)(pScreen, glyph);
+	cache->unrealize_glyph = ps->UnrealizeGlyph;
+	ps->UnrealizeGlyph = sgx_unrealize_glyph;
+}
+
+Bool sgx_glyph_init(ScreenPtr pScreen)
+{
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(pScreen));
+	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+	struct sgx_glyph_cache *cache;
+
+	if (!ps)
+		return FALSE;
+
+	cache = calloc(1, sizeof *cache);
+	if (!cache)
+		return FALSE;
+
+	cache->hash = x_hash_table_new(NULL, NULL, NULL, NULL);
+	if (!cache->hash) {
+		free(cache);
+		return FALSE;
+	}
+
+	cache->glyphs = ps->Glyphs;
+	ps->Glyphs = sgx_glyphs;
+	cache->unrealize_glyph = ps->UnrealizeGlyph;
+	ps->UnrealizeGlyph = sgx_unrealize_glyph;
+
+	screen->glyphs = cache;
+
+	return TRUE;
+}
+
+void sgx_glyph_fini(ScreenPtr pScreen)
+{
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(pScreen));
+	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+	struct sgx_glyph_cache *cache = screen->glyphs;
+	int i;
+
+	if (!cache)
+		return;
+
+	if (ps) {
+		ps->Glyphs = cache->glyphs;
+		ps->UnrealizeGlyph = cache->unrealize_glyph;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(cache->atlas); i++)
+		atlas_fini(&cache->atlas[i]);
+
+	if (cache->mask)
+		FreePicture(cache->mask, 0);
+
+	x_hash_table_free(cache->hash);
+	free(cache);
+
+	screen->glyphs = NULL;
+}
+
+#else
+
+Bool sgx_glyph_init(ScreenPtr pScreen)
+{
+	return FALSE;
+}
+
+void sgx_glyph_fini(ScreenPtr pScreen)
+{
+}
+
+#endif
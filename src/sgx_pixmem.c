@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2010  Nokia Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Memory for malloc() backed pixmaps.
+ *
+ * Freed pixmap memory is kept on per size class free lists and handed
+ * out again. Reused blocks are cleared, so a new pixmap never shows what
+ * the old one held, but this saves the page faults and, for big
+ * pixmaps, the mmap()/munmap() glibc does for each of them, which adds
+ * up when windows are resized or animated.
+ *
+ * At most SGX_PIXMEM_CACHE_MAX bytes are kept. The free lists are
+ * emptied when an allocation fails and when the server runs short of
+ * memory for the GPU.
+ */
+
+#include "fbdev.h"
+#include "sgx_pixmem.h"
+#include "perf.h"
+
+struct pixmem_block {
+	struct pixmem_block *next;
+};
+
+static struct pixmem_block *free_lists[SGX_PIXMEM_CLASSES];
+static unsigned int cached_bytes;
+
+/* returns the size class for size bytes, -1 if it's too big for one */
+static int pixmem_class(unsigned int size)
+{
+	unsigned int shift, step;
+
+	if (size <= 1u << SGX_PIXMEM_MIN_SHIFT)
+		return 0;
+
+	/* 2^shift < size <= 2^(shift + 1) */
+	shift = 31 - __builtin_clz(size - 1);
+	if (shift >= SGX_PIXMEM_MAX_SHIFT)
+		return -1;
+
+	step = (1u << shift) / SGX_PIXMEM_STEPS;
+
+	return (shift - SGX_PIXMEM_MIN_SHIFT) * SGX_PIXMEM_STEPS +
+		((size - (1u << shift)) + step - 1) / step;
+}
+
+unsigned int sgx_pixmem_class_size(int class)
+{
+	unsigned int shift, step;
+
+	if (!class)
+		return 1u << SGX_PIXMEM_MIN_SHIFT;
+
+	shift = SGX_PIXMEM_MIN_SHIFT + (class - 1) / SGX_PIXMEM_STEPS;
+	step = (1u << shift) / SGX_PIXMEM_STEPS;
+
+	return (1u << shift) + ((class - 1) % SGX_PIXMEM_STEPS + 1) * step;
+}
+
+void *sgx_pixmem_alloc(unsigned int size)
+{
+	int class = pixmem_class(size);
+	struct pixmem_block *block;
+	unsigned int alloc_size;
+
+	if (class < 0)
+		alloc_size = size;
+	else if (free_lists[class]) {
+		block = free_lists[class];
+		free_lists[class] = block->next;
+		cached_bytes -= sgx_pixmem_class_size(class);
+
+		PERF_DECREMENT(pixmem_cached[class]);
+		PERF_INCREMENT(pixmem_segments[class]);
+		PERF_INCREMENT(pixmem_reused);
+
+		memset(block, 0, size);
+		goto done;
+	} else
+		alloc_size = sgx_pixmem_class_size(class);
+
+	block = calloc(1, alloc_size);
+	if (!block) {
+		sgx_pixmem_trim();
+
+		block = calloc(1, alloc_size);
+		if (!block)
+			return NULL;
+	}
+
+	if (class >= 0)
+		PERF_INCREMENT(pixmem_segments[class]);
+
+ done:
+	PERF_INCREMENT2(malloc_bytes, size);
+	PERF_INCREMENT(malloc_segments);
+
+	return block;
+}
+
+void sgx_pixmem_free(void *ptr, unsigned int size)
+{
+	int class = pixmem_class(size);
+	struct pixmem_block *block = ptr;
+
+	PERF_DECREMENT2(malloc_bytes, size);
+	PERF_DECREMENT(malloc_segments);
+
+	if (class < 0) {
+		free(ptr);
+		return;
+	}
+
+	PERF_DECREMENT(pixmem_segments[class]);
+
+	if (cached_bytes + sgx_pixmem_class_size(class) >
+	    SGX_PIXMEM_CACHE_MAX) {
+		free(ptr);
+		return;
+	}
+
+	block->next = free_lists[class];
+	free_lists[class] = block;
+	cached_bytes += sgx_pixmem_class_size(class);
+
+	PERF_INCREMENT(pixmem_cached[class]);
+}
+
+void sgx_pixmem_trim(void)
+{
+	struct pixmem_block *block;
+	int class;
+
+	for (class = 0; class < SGX_PIXMEM_CLASSES; class++) {
+		while ((block = free_lists[class])) {
+			free_lists[class] = block->next;
+			free(block);
+			PERF_DECREMENT(pixmem_cached[class]);
+		}
+	}
+
+	cached_bytes = 0;
+}
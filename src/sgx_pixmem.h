@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2010  Nokia Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SGX_PIXMEM_H
+#define SGX_PIXMEM_H 1
+
+/*
+ * Size classes for malloc() pixmap memory, four per power of two from
+ * 1 KiB to 8 MiB. Bigger pixmaps go straight to malloc().
+ */
+#define SGX_PIXMEM_MIN_SHIFT	10
+#define SGX_PIXMEM_MAX_SHIFT	23
+#define SGX_PIXMEM_STEPS	4
+#define SGX_PIXMEM_CLASSES \
+	((SGX_PIXMEM_MAX_SHIFT - SGX_PIXMEM_MIN_SHIFT) * SGX_PIXMEM_STEPS + 1)
+
+/* free memory kept around for reuse */
+#define SGX_PIXMEM_CACHE_MAX	(8 << 20)
+
+/* returns zeroed memory like calloc() */
+void *sgx_pixmem_alloc(unsigned int size);
+void sgx_pixmem_free(void *ptr, unsigned int size);
+void sgx_pixmem_trim(void);
+unsigned int sgx_pixmem_class_size(int class);
+
+#endif /* SGX_PIXMEM_H */
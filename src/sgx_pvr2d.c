@@ -25,31 +25,98 @@
 #include "sgx_pvr2d.h"
 #include "sgx_pvr2d_alloc.h"
 #include "sgx_exa_user.h"
+#include "sgx_wait.h"
 #include <services.h>
 #include "pvr_events.h"
 #include "perf.h"
 
 #include <exa.h>
 
-struct pvr2d_screen *pvr2d_get_screen(void)
+struct pvr2d_screen *pvr2d_get_screen(ScrnInfoPtr scrn_info)
 {
-	/* These should really be tracked per screen but are global for now */
-	static struct pvr2d_screen only_screen;
-
-	return &only_screen;
+	return FBDEVPTR(scrn_info)->pvr2d;
 }
 
 void SysMemInfoChanged(ScrnInfoPtr pScrn)
 {
 	FBDevPtr fbdev = FBDEVPTR(pScrn);
 	struct PVR2DPixmap *ppix = exaGetPixmapDriverPrivate(fbdev->pixmap);
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	struct pvr2d_screen *screen = fbdev->pvr2d;
 
 	ppix->pvr2dmem = screen->sys_mem_info;
 	if (screen->sys_mem_info)
 		ppix->shmaddr = screen->sys_mem_info->pBase;
 	else
 		ppix->shmaddr = NULL;
+
+	PVR2DPixmapChanged(ppix);
+}
+
+static void put_clone_bufs(struct pvr2d_screen *screen)
+{
+	int i;
+
+	for (i = 0; i < screen->num_clone_bufs; i++) {
+		PVR2DQueryBlitsComplete(screen->context,
+					screen->clone_bufs[i], TRUE);
+		PVR2DMemFree(screen->context, screen->clone_bufs[i]);
+		screen->clone_bufs[i] = NULL;
+	}
+
+	screen->num_clone_bufs = 0;
+}
+
+/*
+ * The GPU clone buffers live in the framebuffer memory right
+ * after the page flip buffers so that DSS can scan them out.
+ */
+static void get_clone_bufs(struct pvr2d_screen *screen,
+			   void *mem, unsigned buf_len, unsigned num_bufs)
+{
+	int i;
+
+	for (i = 0; i < num_bufs; i++) {
+		if (PVR2DMemWrap(screen->context, mem + i * buf_len,
+				 PVR2D_WRAPFLAG_CONTIGUOUS, buf_len, NULL,
+				 &screen->clone_bufs[i]) != PVR2D_OK) {
+			ErrorF("%s: Failed to wrap clone buffer\n", __func__);
+			put_clone_bufs(screen);
+			return;
+		}
+		screen->num_clone_bufs++;
+	}
+}
+
+/*
+ * The overlay swap buffers come after the clone buffers. They are
+ * handed to DRI2 clients just like the page flip buffers.
+ */
+static void get_ovl_swap_bufs(ScrnInfoPtr scrn_info,
+			      struct pvr2d_screen *screen,
+			      unsigned fb_idx, unsigned buf_len)
+{
+	unsigned stride = scrn_info->displayWidth *
+			scrn_info->bitsPerPixel >> 3;
+	FBDevPtr dev = FBDEVPTR(scrn_info);
+	void *bufs[OVERLAY_SWAP_BUFFERS];
+	int i;
+
+	if (!dev->conf.overlay_swap)
+		return;
+
+	for (i = 0; i < OVERLAY_SWAP_BUFFERS; i++)
+		bufs[i] = dev->fbmem + (fb_idx + i) * buf_len;
+
+	if (pvr2d_page_flip_create(screen->context,
+				   buf_len,
+				   stride, scrn_info->bitsPerPixel,
+				   bufs, OVERLAY_SWAP_BUFFERS,
+				   &screen->ovl_swap)) {
+		ErrorF("%s: Failed to wrap overlay swap buffers\n", __func__);
+		return;
+	}
+
+	screen->ovl_swap_fb_idx = fb_idx;
 }
 
 static int pvr2d_set_frame_buffer(ScrnInfoPtr scrn_info,
@@ -58,21 +125,39 @@ static int pvr2d_set_frame_buffer(ScrnInfoPtr scrn_info,
 	unsigned stride = scrn_info->displayWidth *
 			scrn_info->bitsPerPixel >> 3;
 	FBDevPtr dev = FBDEVPTR(scrn_info);
+	unsigned int buf_len, buf_h;
 	void *bufs[MAX_PAGE_FLIP_BUFFERS];
+	unsigned num_clone_bufs;
 	int i;
 
+	/*
+	 * The mapping can be larger than the buffers when the
+	 * fb was resized within its current allocation.
+	 */
+	if (!omap_fb_get_info(dev->fb[0], NULL, &buf_h, NULL))
+		FatalError("unable to get framebuffer info\n");
+	buf_len = stride * buf_h;
+
 	bufs[0] = dev->fbmem;
 	for (i = 1; i < dev->conf.page_flip_bufs; i++)
-		bufs[i] = bufs[i - 1] +
-			dev->fbmem_len / dev->conf.page_flip_bufs;
+		bufs[i] = bufs[i - 1] + buf_len;
 
 	if (pvr2d_page_flip_create(screen->context,
-				   dev->fbmem_len / dev->conf.page_flip_bufs,
+				   buf_len,
 				   stride, scrn_info->bitsPerPixel,
 				   bufs, dev->conf.page_flip_bufs,
 				   &screen->page_flip))
 		FatalError("unable to create flip buffers\n");
 
+	num_clone_bufs = dev->conf.video_clone_blit ? CLONE_BLIT_BUFFERS : 0;
+
+	get_clone_bufs(screen,
+		       dev->fbmem + dev->conf.page_flip_bufs * buf_len, buf_len,
+		       num_clone_bufs);
+
+	get_ovl_swap_bufs(scrn_info, screen,
+			  dev->conf.page_flip_bufs + num_clone_bufs, buf_len);
+
 	screen->sys_mem_info =
 		screen->page_flip.bufs[screen->page_flip.front_idx].mem_info;
 
@@ -81,10 +166,10 @@ static int pvr2d_set_frame_buffer(ScrnInfoPtr scrn_info,
 	return 0;
 }
 
-static Bool update_flip_pixmaps(ScreenPtr pScreen)
+static Bool update_flip_pixmaps(ScreenPtr pScreen,
+				struct pvr2d_page_flip *page_flip)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
 	int i;
 
 	for (i = 0; i < page_flip->num_bufs; i++) {
@@ -111,13 +196,17 @@ static Bool update_flip_pixmaps(ScreenPtr pScreen)
  */
 Bool PVR2D_PostFBReset(ScrnInfoPtr scrn_info)
 {
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	struct pvr2d_screen *screen = pvr2d_get_screen(scrn_info);
 	PVR2DMEMINFO *pMemInfo = screen->sys_mem_info;
 
 	if (!screen->sys_mem_info) {
 		if (pvr2d_set_frame_buffer(scrn_info, screen))
 			return FALSE;
-		if (!update_flip_pixmaps(scrn_info->pScreen))
+		if (!update_flip_pixmaps(scrn_info->pScreen,
+					 &screen->page_flip))
+			return FALSE;
+		if (!update_flip_pixmaps(scrn_info->pScreen,
+					 &screen->ovl_swap))
 			return FALSE;
 	}
 
@@ -138,10 +227,13 @@ Bool PVR2D_PostFBReset(ScrnInfoPtr scrn_info)
  */
 Bool PVR2D_PreFBReset(ScrnInfoPtr scrn_info)
 {
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	struct pvr2d_screen *screen = pvr2d_get_screen(scrn_info);
 
 	dri2_kill_swap_reqs();
+	dri2_ovl_swap_release(scrn_info);
 
+	put_clone_bufs(screen);
+	pvr2d_page_flip_destroy(screen->context, &screen->ovl_swap);
 	pvr2d_page_flip_destroy(screen->context, &screen->page_flip);
 
 	screen->sys_mem_info = NULL;
@@ -153,7 +245,8 @@ Bool PVR2D_PreFBReset(ScrnInfoPtr scrn_info)
 #if !HAVE_NOTIFY_FD
 static void pvr2d_wakeup_handler(pointer data, int err, pointer p)
 {
-	int fd = (int)data;
+	struct pvr2d_screen *screen = data;
+	int fd = screen->fd;
 	fd_set *read_mask = p;
 	char buf[1024];
 	int len;
@@ -169,8 +262,6 @@ static void pvr2d_wakeup_handler(pointer data, int err, pointer p)
 		return;
 
 	for (i = 0; i < len; i += e->length) {
-		struct pvr2d_screen *screen = pvr2d_get_screen();
-
 		e = (const struct pvr_event *)&buf[i];
 
 		if (e->length < sizeof(struct pvr_event)
@@ -181,6 +272,9 @@ static void pvr2d_wakeup_handler(pointer data, int err, pointer p)
 			const struct pvr_event_sync *sync =
 				(const struct pvr_event_sync *)e;
 
+			if (sgx_wait_sync_event(sync->user_data))
+				continue;
+
 			if (screen->sync_event_handler != 0)
 				screen->sync_event_handler(fd, sync->sync_info,
 						sync->tv_sec, sync->tv_usec,
@@ -200,6 +294,7 @@ static void pvr2d_wakeup_handler(pointer data, int err, pointer p)
 }
 #else
 static void pvr2d_notify_fd(int fd, int ready, void *data) {
+	struct pvr2d_screen *screen = data;
 	char buf[1024];
 	int len;
 	int i;
@@ -211,8 +306,6 @@ static void pvr2d_notify_fd(int fd, int ready, void *data) {
 		return;
 
 	for (i = 0; i < len; i += e->length) {
-		struct pvr2d_screen *screen = pvr2d_get_screen();
-
 		e = (const struct pvr_event *)&buf[i];
 
 		if (e->length < sizeof(struct pvr_event) || e->length + i > len)
@@ -222,6 +315,9 @@ static void pvr2d_notify_fd(int fd, int ready, void *data) {
 			const struct pvr_event_sync *sync =
 				(const struct pvr_event_sync *)e;
 
+			if (sgx_wait_sync_event(sync->user_data))
+				continue;
+
 			 if (screen->sync_event_handler != 0)
 				 screen->sync_event_handler(fd, sync->sync_info,
 							    sync->tv_sec, sync->tv_usec,
@@ -242,7 +338,8 @@ static void pvr2d_notify_fd(int fd, int ready, void *data) {
 
 Bool PVR2D_Init(ScrnInfoPtr scrn_info)
 {
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	FBDevPtr fbdev = FBDEVPTR(scrn_info);
+	struct pvr2d_screen *screen;
 	PVR2DERROR ePVR2DStatus;
 	PVR2DDEVICEINFO *pDevInfo = 0;
 	int nDeviceNum;
@@ -250,6 +347,20 @@ Bool PVR2D_Init(ScrnInfoPtr scrn_info)
 	long lRevMajor = 0;
 	long lRevMinor = 0;
 
+	/*
+	 * Kept around until the screen is freed as pixmaps
+	 * may still point to it after PVR2D_DeInit(). Not cleared
+	 * on server regeneration: the SHM accounting and the pixmap
+	 * generation carry over, the rest is torn down by DeInit.
+	 */
+	if (!fbdev->pvr2d) {
+		fbdev->pvr2d = calloc(1, sizeof *fbdev->pvr2d);
+		if (!fbdev->pvr2d)
+			return FALSE;
+	}
+
+	screen = fbdev->pvr2d;
+
 	PVR2DGetAPIRev(&lRevMajor, &lRevMinor);
 
 	if (lRevMajor != PVR2D_REV_MAJOR || lRevMinor != PVR2D_REV_MINOR) {
@@ -297,7 +408,7 @@ Bool PVR2D_Init(ScrnInfoPtr scrn_info)
 		goto destroy_context;
 
 #if SGX_CACHE_SEGMENTS
-	InitSharedSegments();
+	InitSharedSegments(&screen->cache);
 #endif
 
 	screen->fd = PVR2DGetFileHandle(screen->context);
@@ -309,10 +420,10 @@ Bool PVR2D_Init(ScrnInfoPtr scrn_info)
 
 	if (!RegisterBlockAndWakeupHandlers((BlockHandlerProcPtr)NoopDDA,
 					    pvr2d_wakeup_handler,
-					    (pointer)screen->fd))
+					    screen))
 		goto remove_socket;
 #else
-	if (!SetNotifyFd(screen->fd, pvr2d_notify_fd, X_NOTIFY_READ, NULL))
+	if (!SetNotifyFd(screen->fd, pvr2d_notify_fd, X_NOTIFY_READ, screen))
 		goto destroy_page_flip;
 #endif
 
@@ -324,8 +435,9 @@ Bool PVR2D_Init(ScrnInfoPtr scrn_info)
 #endif
  destroy_page_flip:
 #if SGX_CACHE_SEGMENTS
-	DeInitSharedSegments();
+	DeInitSharedSegments(&screen->cache);
 #endif
+	pvr2d_page_flip_destroy(screen->context, &screen->ovl_swap);
 	pvr2d_page_flip_destroy(screen->context, &screen->page_flip);
  destroy_context:
 	PVR2DDestroyDeviceContext(screen->context);
@@ -334,9 +446,9 @@ Bool PVR2D_Init(ScrnInfoPtr scrn_info)
 	return FALSE;
 }
 
-void PVR2D_DeInit(void)
+void PVR2D_DeInit(ScrnInfoPtr scrn_info)
 {
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	struct pvr2d_screen *screen = pvr2d_get_screen(scrn_info);
 
 #if !HAVE_NOTIFY_FD
 	RemoveGeneralSocket(screen->fd);
@@ -345,18 +457,78 @@ void PVR2D_DeInit(void)
 #endif
 
 #if SGX_CACHE_SEGMENTS
-	DeInitSharedSegments();
+	DeInitSharedSegments(&screen->cache);
 #endif
 
+	put_clone_bufs(screen);
+	sgx_slab_fini(screen);
+	pvr2d_page_flip_destroy(screen->context, &screen->ovl_swap);
 	pvr2d_page_flip_destroy(screen->context, &screen->page_flip);
+	screen->sys_mem_info = NULL;
 
 	PVR2DDestroyDeviceContext(screen->context);
+	screen->context = NULL;
+}
+
+/* Splits the pixmap into PVR2D_NUM_BANDS bands for CPU write tracking */
+void PVR2DSetBands(struct PVR2DPixmap *ppix, int height, int pitch)
+{
+	ppix->band_rows = (height + PVR2D_NUM_BANDS - 1) / PVR2D_NUM_BANDS;
+	ppix->band_size = ppix->band_rows * pitch;
+}
+
+/* returns the mask of bands first to last */
+static CARD32 band_range(unsigned int first, unsigned int last)
+{
+	if (last == PVR2D_NUM_BANDS - 1)
+		return PVR2D_ALL_BANDS << first;
+
+	return (PVR2D_ALL_BANDS << first) & ~(PVR2D_ALL_BANDS << (last + 1));
+}
+
+/* returns the bands covering rows y1 to y2 - 1 */
+static CARD32 band_mask(struct PVR2DPixmap *ppix, int y1, int y2)
+{
+	unsigned int first, last;
+
+	if (y2 <= y1)
+		return 0;
+
+	if (!ppix->band_size)
+		return PVR2D_ALL_BANDS;
+
+	first = y1 / ppix->band_rows;
+	last = (y2 - 1) / ppix->band_rows;
+
+	if (first >= PVR2D_NUM_BANDS)
+		return 0;
+
+	return band_range(first, min(last, PVR2D_NUM_BANDS - 1));
+}
+
+/* Marks rows y1 to y2 - 1 as written by the CPU */
+void PVR2DMarkCPUWrites(struct PVR2DPixmap *ppix, int y1, int y2)
+{
+	ppix->cpu_dirty |= band_mask(ppix, y1, y2);
+}
+
+/* returns how many bytes of the pixmap the CPU has written to */
+static unsigned int dirty_size(struct PVR2DPixmap *ppix)
+{
+	unsigned int size;
+
+	if (ppix->cpu_dirty == PVR2D_ALL_BANDS || !ppix->band_size)
+		return ppix->shmsize;
+
+	size = __builtin_popcount(ppix->cpu_dirty) * ppix->band_size;
+
+	return min(size, (unsigned int) ppix->shmsize);
 }
 
 /* returns how much memory PVR2DFlushCache would flush */
 int PVR2DGetFlushSize(struct PVR2DPixmap *ppix)
 {
-	if (ppix->pvr2dmem == pvr2d_get_screen()->sys_mem_info ||
+	if (ppix->pvr2dmem == ppix->screen->sys_mem_info ||
 		ppix->shmid == -1 || !ppix->shmaddr || !ppix->shmsize)
 		return 0;
 	if ((ppix->owner == PVR2D_OWNER_GPU) && (ppix->pvr2dmem)) {
@@ -368,18 +540,55 @@ int PVR2DGetFlushSize(struct PVR2DPixmap *ppix)
 		if (ui32WriteOpsComplete == ppix->ui32WriteOpsComplete)
 			return 0;
 	}
-	if ((ppix->owner == PVR2D_OWNER_CPU) && (!ppix->bCPUWrites)) {
-		return 0;
-	}
+	if (ppix->owner == PVR2D_OWNER_CPU)
+		return dirty_size(ppix);
 	return ppix->shmsize;
 }
 
+static void flush_to_gpu(struct PVR2DPixmap *ppix,
+			 unsigned int offset, unsigned int length)
+{
+	PERF_INCREMENT(cache_flush);
+	PERF_INCREMENT2(cache_flush_bytes, length);
+
+	if (PVR2D_OK != PVR2DCacheFlushDRI(ppix->screen->context,
+		DRM_PVR2D_CFLUSH_TO_GPU,
+		(uint32_t) ppix->shmaddr + offset, length))
+		xf86DrvMsg(0, X_ERROR,
+			"DRM_PVR2D_CFLUSH ioctl failed\n");
+}
+
+/* Flushes the runs of bands the CPU has written to */
+static void flush_dirty_bands(struct PVR2DPixmap *ppix)
+{
+	CARD32 dirty = ppix->cpu_dirty;
+	unsigned int first, last, offset, end;
+
+	if (dirty == PVR2D_ALL_BANDS || !ppix->band_size) {
+		flush_to_gpu(ppix, 0, ppix->shmsize);
+		return;
+	}
+
+	while (dirty) {
+		first = __builtin_ctz(dirty);
+		for (last = first; last + 1 < PVR2D_NUM_BANDS; last++)
+			if (!(dirty & (1u << (last + 1))))
+				break;
+		dirty &= ~band_range(first, last);
+
+		offset = first * ppix->band_size;
+		end = min((last + 1) * ppix->band_size,
+			  (unsigned int) ppix->shmsize);
+		if (offset >= end)
+			break;
+
+		flush_to_gpu(ppix, offset, end - offset);
+	}
+}
+
 void PVR2DFlushCache(struct PVR2DPixmap *ppix)
 {
-	struct pvr2d_screen *screen = pvr2d_get_screen();
-	unsigned int cflush_type;
-	unsigned long cflush_virt;
-	unsigned int cflush_length;
+	struct pvr2d_screen *screen = ppix->screen;
 	Bool bNeedFlush = FALSE;
 
 	if (ppix->pvr2dmem == screen->sys_mem_info || ppix->shmid == -1 ||
@@ -388,10 +597,13 @@ void PVR2DFlushCache(struct PVR2DPixmap *ppix)
 
 	/* check if pixmap was modified
 	 * by GPU: ui32WriteOpsComplete changed
-	 * by CPU: PrepareAccess was called with EXA_PREPARE_DEST
+	 * by CPU: some bands are marked dirty
 	 */
 	if ((ppix->owner == PVR2D_OWNER_CPU) && (ppix->pvr2dmem)) {
-		bNeedFlush = ppix->bCPUWrites;
+		if (ppix->cpu_dirty)
+			flush_dirty_bands(ppix);
+		ppix->cpu_dirty = 0;
+		return;
 	} else if ((ppix->owner == PVR2D_OWNER_GPU) && (ppix->pvr2dmem)) {
 		PVRSRV_CLIENT_MEM_INFO *pMemInfo =
 		    (PVRSRV_CLIENT_MEM_INFO *) ppix->pvr2dmem->hPrivateData;
@@ -401,35 +613,67 @@ void PVR2DFlushCache(struct PVR2DPixmap *ppix)
 		bNeedFlush = ui32WriteOpsComplete != ppix->ui32WriteOpsComplete;
 		ppix->ui32WriteOpsComplete = ui32WriteOpsComplete;
 	}
-	//ErrorF("%s: Need flush? %s\n",__func__, (bNeedFlush ? "true" : "false") );
 
+	/*
+	 * The GPU's writes aren't tracked per band, DRI2 clients and
+	 * Xv write to pixmaps behind our back.
+	 */
 	if (bNeedFlush) {
-		ppix->bCPUWrites = FALSE;
-		cflush_type =
-		    ppix->owner ==
-		    PVR2D_OWNER_GPU ? DRM_PVR2D_CFLUSH_FROM_GPU :
-		    DRM_PVR2D_CFLUSH_TO_GPU;
-		cflush_virt = (uint32_t) ppix->shmaddr;
-		cflush_length = ppix->shmsize;
-
-		if (cflush_type == DRM_PVR2D_CFLUSH_FROM_GPU)
-			PERF_INCREMENT(cache_inval);
-		else
-			PERF_INCREMENT(cache_flush);
-
-		if (PVR2D_OK != PVR2DCacheFlushDRI(screen->context, cflush_type,
-			cflush_virt, cflush_length))
+		PERF_INCREMENT(cache_inval);
+
+		if (PVR2D_OK != PVR2DCacheFlushDRI(screen->context,
+			DRM_PVR2D_CFLUSH_FROM_GPU,
+			(uint32_t) ppix->shmaddr, ppix->shmsize))
 			xf86DrvMsg(0, X_ERROR,
 				"DRM_PVR2D_CFLUSH ioctl failed\n");
 	}
 }
 
+/*
+ * Flush or invalidate the CPU cache for a part of the pixmap only,
+ * for CPU accesses that don't change the pixmap's ownership.
+ * Invalidation is skipped if the GPU hasn't written to the pixmap.
+ */
+void PVR2DFlushCacheRange(struct PVR2DPixmap *ppix,
+			  enum drm_pvr2d_cflush_type type,
+			  unsigned int offset, unsigned int length)
+{
+	struct pvr2d_screen *screen = ppix->screen;
+
+	if (ppix->pvr2dmem == screen->sys_mem_info || ppix->shmid == -1 ||
+		!ppix->shmaddr || !ppix->shmsize || !length)
+		return;
+
+	assert(offset + length <= ppix->shmsize);
+
+	if (type == DRM_PVR2D_CFLUSH_FROM_GPU) {
+		PVRSRV_CLIENT_MEM_INFO *pMemInfo;
+
+		if (!ppix->pvr2dmem)
+			return;
+
+		pMemInfo = (PVRSRV_CLIENT_MEM_INFO *)
+			ppix->pvr2dmem->hPrivateData;
+		if (pMemInfo->psClientSyncInfo->psSyncData->ui32WriteOpsComplete ==
+		    ppix->ui32WriteOpsComplete)
+			return;
+
+		PERF_INCREMENT(cache_inval);
+	} else
+		PERF_INCREMENT(cache_flush);
+
+	if (PVR2D_OK != PVR2DCacheFlushDRI(screen->context, type,
+		(uint32_t) ppix->shmaddr + offset, length))
+		xf86DrvMsg(0, X_ERROR,
+			"DRM_PVR2D_CFLUSH ioctl failed\n");
+}
+
 PVR2DERROR QueryBlitsComplete(struct PVR2DPixmap *ppix, unsigned int wait)
 {
 	if (ppix->owner == PVR2D_OWNER_CPU)
 		return PVR2D_OK;
 
-	return PVR2DQueryBlitsComplete(pvr2d_get_screen()->context,
+	return PVR2DQueryBlitsComplete(ppix->screen->context,
 					ppix->pvr2dmem, wait);
 }
 
@@ -438,13 +682,28 @@ PVR2DERROR QueryBlitsComplete(struct PVR2DPixmap *ppix, unsigned int wait)
  */
 void PVR2DInvalidate(struct PVR2DPixmap *ppix)
 {
+	/* the arena's mapping is shared */
+	if (ppix->slab)
+		return;
+
 	if ((ppix->shmid != -1) && (ppix->pvr2dmem)) {
 		DBG("%s: size %u\n", __func__, ppix->shmsize);
-		PVR2DMemFree(pvr2d_get_screen()->context, ppix->pvr2dmem);
+		PVR2DMemFree(ppix->screen->context, ppix->pvr2dmem);
 		ppix->pvr2dmem = NULL;
+		PVR2DPixmapChanged(ppix);
 	}
 }
 
+/*
+ * Must be called whenever the pixmap memory or its GPU mapping
+ * changes, so that cached blit descriptors referring to the old
+ * memory are no longer used.
+ */
+void PVR2DPixmapChanged(struct PVR2DPixmap *ppix)
+{
+	ppix->generation = ++ppix->screen->pixmap_generation;
+}
+
 /*
  * Transfer ownership of a pixmap to GPU
  * It makes sure the cache is flushed.
@@ -469,13 +728,15 @@ void PVR2DPixmapOwnership_GPU(struct PVR2DPixmap *ppix)
  */
 Bool PVR2DPixmapOwnership_CPU(struct PVR2DPixmap *ppix)
 {
-	PVR2DCONTEXTHANDLE context = pvr2d_get_screen()->context;
+	PVR2DCONTEXTHANDLE context;
 
 	if (!ppix) {
 		DBG("%s(%p) => FALSE\n", __func__, ppix);
 		return FALSE;
 	}
 
+	context = ppix->screen->context;
+
 	if (ppix->pvr2dmem) {
 		if (PVR2DQueryBlitsComplete(context, ppix->pvr2dmem, 0) !=
 			PVR2D_OK) {
@@ -507,7 +768,7 @@ Bool PVR2DCheckSizeLimits(int width, int height)
  * all memory mapped to GPU and try PVR2DMemWrap again */
 Bool PVR2DValidate(PixmapPtr pPixmap, struct PVR2DPixmap * ppix, Bool cleanup)
 {
-	PVR2DCONTEXTHANDLE context = pvr2d_get_screen()->context;
+	PVR2DCONTEXTHANDLE context;
 	unsigned int num_pages;
 	unsigned int contiguous = PVR2D_WRAPFLAG_NONCONTIGUOUS;
 
@@ -516,6 +777,8 @@ Bool PVR2DValidate(PixmapPtr pPixmap, struct PVR2DPixmap * ppix, Bool cleanup)
 		return FALSE;
 	}
 
+	context = ppix->screen->context;
+
 	if (ppix->pvr2dmem) {
 		DBG("%s: pPix->pvr2dmem: TRUE\n", __func__);
 		return TRUE;
@@ -531,7 +794,8 @@ Bool PVR2DValidate(PixmapPtr pPixmap, struct PVR2DPixmap * ppix, Bool cleanup)
 
 	/* shmsize should already be page-aligned, but just to be safe... */
 	num_pages = ALIGN(ppix->shmsize, getpagesize()) / getpagesize();
-	if (num_pages == 1)
+	if (num_pages == 1 ||
+	    (ppix->huge && ppix->shmsize <= ppix->screen->huge_page_size))
 		contiguous = PVR2D_WRAPFLAG_CONTIGUOUS;
 
 	if (PVR2DMemWrap(context, ppix->shmaddr, contiguous, ppix->shmsize,
@@ -554,9 +818,9 @@ Bool PVR2DValidate(PixmapPtr pPixmap, struct PVR2DPixmap * ppix, Bool cleanup)
 
 	if (cleanup) {
 #if SGX_CACHE_SEGMENTS
-		CleanupSharedSegments();
+		CleanupSharedSegments(&ppix->screen->cache);
 #endif
-		PVR2DUnmapAllPixmaps();
+		PVR2DUnmapAllPixmaps(ppix->screen);
 
 		if (PVR2DMemWrap(context, ppix->shmaddr, contiguous,
 			ppix->shmsize, NULL, &ppix->pvr2dmem) != PVR2D_OK) {
@@ -569,10 +833,10 @@ Bool PVR2DValidate(PixmapPtr pPixmap, struct PVR2DPixmap * ppix, Bool cleanup)
 	return TRUE;
 }
 
-Bool PVR2DCreateScreenResources(ScreenPtr pScreen)
+static Bool create_flip_pixmaps(ScreenPtr pScreen,
+				struct pvr2d_page_flip *page_flip)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
 	int i;
 
 	for (i = 0; i < page_flip->num_bufs; i++) {
@@ -597,13 +861,41 @@ Bool PVR2DCreateScreenResources(ScreenPtr pScreen)
 	return FALSE;
 }
 
-void PVR2DCloseScreen(ScreenPtr pScreen)
+static void destroy_flip_pixmaps(ScreenPtr pScreen,
+				 struct pvr2d_page_flip *page_flip)
 {
-	struct pvr2d_page_flip *page_flip = &pvr2d_get_screen()->page_flip;
 	int i;
 
-	for (i = 0; i < page_flip->num_bufs; i++) {
+	/* The buffers may have been given up since, see realloc_fb() */
+	for (i = 0; i < MAX_PAGE_FLIP_BUFFERS; i++) {
+		if (!page_flip->bufs[i].pixmap)
+			continue;
 		(*pScreen->DestroyPixmap)(page_flip->bufs[i].pixmap);
 		page_flip->bufs[i].pixmap = NULL;
 	}
 }
+
+Bool PVR2DCreateScreenResources(ScreenPtr pScreen)
+{
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(pScreen));
+
+	if (!create_flip_pixmaps(pScreen, &screen->page_flip))
+		return FALSE;
+
+	if (!create_flip_pixmaps(pScreen, &screen->ovl_swap)) {
+		destroy_flip_pixmaps(pScreen, &screen->page_flip);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void PVR2DCloseScreen(ScreenPtr pScreen)
+{
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(pScreen));
+
+	destroy_flip_pixmaps(pScreen, &screen->ovl_swap);
+	destroy_flip_pixmaps(pScreen, &screen->page_flip);
+}
@@ -25,6 +25,8 @@
 
 #include <xorg-server.h>
 #include <xf86.h>
+#include <xf86Crtc.h>
+#include <picture.h>
 
 #define PVR2D_EXT_BLIT 1
 #include <pvr2d.h>
@@ -37,9 +39,20 @@
 
 #include "sgx_exa.h"
 #include "sgx_cache.h"
+#include "sgx_slab.h"
 #include "sgx_pvr2d_flip.h"
+#include "x-hash.h"
+
+struct sgx_glyph_cache;
+struct omap_overlay;
+struct dri2_swap_request;
 
 struct PVR2DPixmap {
+	/* the screen the pixmap was created on */
+	struct pvr2d_screen *screen;
+	/* changes whenever the memory or the GPU mapping changes */
+	unsigned int generation;
+
 	PVR2DMEMINFO *pvr2dmem;
 	enum {
 		PVR2D_OWNER_CPU,
@@ -49,28 +62,130 @@ struct PVR2DPixmap {
 	/* how many operations GPU has completed on the pixmap */
 	IMG_UINT32 ui32WriteOpsComplete;
 
-	/* has PreparedAccess been called with EXA_PREPARE_DEST */
-	Bool bCPUWrites;
+	/*
+	 * Rows written by the CPU since the last flush, one bit per band
+	 * of band_rows rows. band_size is the size of a band in bytes,
+	 * 0 if the pixmap is not split into bands.
+	 */
+	CARD32 cpu_dirty;
+	unsigned int band_rows;
+	unsigned int band_size;
+
+	/*
+	 * Arena the pixmap is sub-allocated from, NULL if it has memory
+	 * of its own. offset is the pixmap's offset in pvr2dmem.
+	 */
+	struct sgx_slab *slab;
+	unsigned int offset;
 
 	/* SHM backed pixmap */
 	int shmid;
 	int shmsize;
 	void *shmaddr;
+	/* segment made of huge pages */
+	Bool huge;
 
 	/* malloc() backed pixmap */
 	int mallocsize;
 	void *mallocaddr;
+
+	/* accelerated operations refused for lack of SHM */
+	unsigned int fallbacks;
+	/* size of the malloc() memory the pixmap was promoted from */
+	int promoted_size;
+	/* used by the GPU since the last memory pressure */
+	Bool gpu_used;
 };
 
+#define PVR2D_NUM_BANDS 32
+#define PVR2D_ALL_BANDS 0xffffffff
+
 enum drm_pvr2d_cflush_type {
 	DRM_PVR2D_CFLUSH_FROM_GPU = 1,
 	DRM_PVR2D_CFLUSH_TO_GPU = 2
 };
 
+/*
+ * EXA operation descriptors. The fields that are the same for every
+ * operation are filled in once at init, Prepare*() only fills in
+ * the per-pixmap fields and the operations themselves only the
+ * rectangles.
+ */
+#define SGX_BLT_CACHE_SIZE 16
+
+/*
+ * A descriptor prepared for a pixmap pair. It can be reused
+ * as long as neither pixmap generation has changed since.
+ */
+struct sgx_blt_cache_entry {
+	struct PVR2DPixmap *src;
+	struct PVR2DPixmap *dst;
+	unsigned int src_generation;
+	unsigned int dst_generation;
+	PVR2DBLTINFO blt;
+};
+
+struct sgx_exa_solid {
+	PVR2DBLTINFO blt;
+	/* fill colour in the pixmap's format for software fills */
+	Pixel colour;
+	struct sgx_blt_cache_entry cache[SGX_BLT_CACHE_SIZE];
+};
+
+struct sgx_exa_copy {
+	PVR2DBLTINFO blt;
+	PixmapPtr src;
+	/* scratch GC for software copies */
+	GCPtr gc;
+	struct sgx_blt_cache_entry cache[SGX_BLT_CACHE_SIZE];
+};
+
+struct sgx_exa_composite {
+	PVR2DEXTBLTINFO blt;
+	PicturePtr pict[2];
+	/* for software composites: source and mask pixmaps */
+	PixmapPtr pixmap[2];
+	PicturePtr dst;
+	CARD8 op;
+};
+
+/* The overlay scanning out the overlay swap buffers (OverlaySwap) */
+struct sgx_ovl_plane {
+	struct omap_overlay *ovl;
+	/* NULL while nothing is shown */
+	xf86CrtcPtr crtc;
+	/* the window area the overlay covers */
+	BoxRec box;
+	/* the output colorkey is enabled for the overlay */
+	Bool ckey;
+	/* the colorkey needs to be painted into the window */
+	Bool ckey_dirty;
+	/* the window lacks the frame the overlay showed */
+	Bool stale;
+	Bool restore_queued;
+	/* buffer last put on the overlay or copied to the window */
+	unsigned int shown_idx;
+	/* swaps waiting for rendering or the overlay, head first */
+	struct dri2_swap_request *reqs_head;
+	struct dri2_swap_request *reqs_tail;
+
+	ClipNotifyProcPtr ClipNotify;
+	UnrealizeWindowProcPtr UnrealizeWindow;
+};
+
+/* Per-screen driver state, hung off FBDevRec */
 struct pvr2d_screen {
 	PVR2DCONTEXTHANDLE context;
 	PVR2DMEMINFO *sys_mem_info;
 	struct pvr2d_page_flip page_flip;
+	/* destination buffers for GPU scaled Xv clones */
+	PVR2DMEMINFO *clone_bufs[CLONE_BLIT_BUFFERS];
+	unsigned num_clone_bufs;
+	/* buffers of a DRI2 window scanned out by an overlay */
+	struct pvr2d_page_flip ovl_swap;
+	/* framebuffer buffer index of ovl_swap.bufs[0] */
+	unsigned ovl_swap_fb_idx;
+	struct sgx_ovl_plane ovl_plane;
 
 	void (*sync_event_handler)(int fd, const void *sync_info,
 			unsigned tv_sec, unsigned tv_usec,
@@ -79,19 +194,52 @@ struct pvr2d_screen {
 			unsigned tv_sec, unsigned tv_usec,
 			unsigned long user_data);
 	int fd;
+
+	/* SHM segment cache */
+	struct sgx_cache cache;
+	/* arenas for small SHM pixmaps */
+	struct sgx_slabs slabs;
+	/* move malloc() pixmaps the GPU is asked to use to SHM */
+	Bool promote_pixmaps;
+	/* SHM_LOCKed memory and its limit in bytes, 0 for no limit */
+	unsigned long locked_bytes;
+	unsigned long locked_limit;
+	/* back big SHM pixmaps with pages this big, 0 if not */
+	unsigned int huge_page_size;
+
+	/* all pixmaps, for unmapping them from the GPU */
+	x_hash_table *pixmaps;
+	/* the next pixmap created is the screen pixmap */
+	Bool create_screen_pixmap;
+	Bool test_copy_only;
+	/* last pixmap generation handed out */
+	unsigned int pixmap_generation;
+
+	struct sgx_exa_solid solid;
+	struct sgx_exa_copy copy;
+	struct sgx_exa_composite composite;
+
+	/* glyph atlas, NULL if not in use */
+	struct sgx_glyph_cache *glyphs;
 };
 
-struct pvr2d_screen *pvr2d_get_screen(void);
+struct pvr2d_screen *pvr2d_get_screen(ScrnInfoPtr scrn_info);
 
 Bool PVR2D_Init(ScrnInfoPtr scrn_info);
-void PVR2D_DeInit(void);
+void PVR2D_DeInit(ScrnInfoPtr scrn_info);
 void SysMemInfoChanged(ScrnInfoPtr pScrn);
 Bool PVR2D_PostFBReset(ScrnInfoPtr scrn_info);
 Bool PVR2D_PreFBReset(ScrnInfoPtr scrn_info);
+void PVR2DSetBands(struct PVR2DPixmap *ppix, int height, int pitch);
+void PVR2DMarkCPUWrites(struct PVR2DPixmap *ppix, int y1, int y2);
 int PVR2DGetFlushSize(struct PVR2DPixmap *ppix);
 void PVR2DFlushCache(struct PVR2DPixmap *ppix);
+void PVR2DFlushCacheRange(struct PVR2DPixmap *ppix,
+			  enum drm_pvr2d_cflush_type type,
+			  unsigned int offset, unsigned int length);
 PVR2DERROR QueryBlitsComplete(struct PVR2DPixmap *ppix, unsigned int wait);
 void PVR2DInvalidate(struct PVR2DPixmap *ppix);
+void PVR2DPixmapChanged(struct PVR2DPixmap *ppix);
 void PVR2DPixmapOwnership_GPU(struct PVR2DPixmap *ppix);
 Bool PVR2DPixmapOwnership_CPU(struct PVR2DPixmap *ppix);
 Bool PVR2DValidate(PixmapPtr pPixmap, struct PVR2DPixmap *ppix, Bool cleanup);
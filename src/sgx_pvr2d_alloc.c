@@ -24,9 +24,11 @@
 #include "sgx_pvr2d.h"
 #include "sgx_pvr2d_alloc.h"
 #include "sgx_dri2.h"
+#include "sgx_pixmem.h"
 #include "perf.h"
 
 #include <exa.h>
+#include <sys/mman.h>
 #include "x-hash.h"
 
 /* PVR2D memory can only be freed once all PVR2D operations using it have
@@ -40,39 +42,130 @@ static struct PVR2DMemDestroy {
 
 unsigned int page_size;
 
+static Bool locked_over(struct pvr2d_screen *screen, unsigned int size)
+{
+	return screen->locked_limit &&
+		screen->locked_bytes + size > screen->locked_limit;
+}
 
-static void doDestroyMemory(struct PVR2DPixmap *ppix)
+/*
+ * Gives back locked memory that isn't strictly needed, cheapest first:
+ * pooled DRI2 back buffers, completed delayed frees, the segment
+ * cache and the cached malloc() blocks, empty slab arenas and finally
+ * the GPU mappings of idle pixmaps, which demotes the promoted ones
+ * the GPU hasn't used lately back to malloc() memory.
+ *
+ * The last step is skipped unless cleanup is set, like in
+ * PVR2DValidate(): an operand validated earlier must keep its mapping.
+ */
+static void reclaim_locked(struct pvr2d_screen *screen, unsigned int size,
+			   Bool cleanup)
 {
-	CALLTRACE("%s: Start\n", __func__);
+	PERF_INCREMENT(locked_reclaim);
+
+	/* Freed through the segment cache, so do this first */
+	dri2_back_pool_trim();
 
+	PVR2DDelayedMemDestroy(FALSE);
 #if SGX_CACHE_SEGMENTS
-	if (AddToCache (ppix))
-		return;
+	CleanupSharedSegments(&screen->cache);
 #endif
+	/* Doesn't count against the budget, but we're short on RAM */
+	sgx_pixmem_trim();
+	if (!locked_over(screen, size))
+		return;
+
+	sgx_slab_trim(screen, FALSE);
+	if (!locked_over(screen, size) || !cleanup)
+		return;
+
+	PVR2DUnmapAllPixmaps(screen);
+}
+
+/*
+ * Locks an SHM segment of size bytes into RAM and charges it to the
+ * LockedMemory budget. Returns FALSE, leaving the segment unlocked,
+ * if it doesn't fit in the budget and force isn't set; the caller
+ * should then use other memory. cleanup is passed on to
+ * reclaim_locked().
+ */
+Bool PVR2DLockSHM(struct pvr2d_screen *screen, int shmid, unsigned int size,
+		  Bool force, Bool cleanup)
+{
+	if (locked_over(screen, size)) {
+		reclaim_locked(screen, size, cleanup);
+
+		if (locked_over(screen, size) && !force) {
+			PERF_INCREMENT(locked_refused);
+			return FALSE;
+		}
+	}
+
+	if (0 != shmctl(shmid, SHM_LOCK, 0))
+		ErrorF("shmctl(SHM_LOCK) failed\n");
+
+	screen->locked_bytes += size;
+	PERF_INCREMENT2(locked_bytes, size);
+
+	return TRUE;
+}
+
+/* Takes a detached segment off the budget */
+void PVR2DUnlockSHM(struct pvr2d_screen *screen, unsigned int size)
+{
+	screen->locked_bytes -= size;
+	PERF_DECREMENT2(locked_bytes, size);
+}
+
+
+static void freeMemory(struct PVR2DPixmap *ppix)
+{
+	if (ppix->slab) {
+		sgx_slab_free(ppix);
+		return;
+	}
 
 	if (ppix->pvr2dmem) {
-		PVR2DMemFree(pvr2d_get_screen()->context, ppix->pvr2dmem);
+		PVR2DMemFree(ppix->screen->context, ppix->pvr2dmem);
 		ppix->pvr2dmem = NULL;
 	}
 
 	if (ppix->shmid != -1) {
 		shmdt(ppix->shmaddr);
+		PVR2DUnlockSHM(ppix->screen, ppix->shmsize);
 		ppix->shmaddr = NULL;
 		ppix->shmid = -1;
 		PERF_DECREMENT2(shm_bytes, ppix->shmsize);
 		PERF_DECREMENT(shm_segments);
+		if (ppix->huge) {
+			PERF_DECREMENT2(huge_bytes, ppix->shmsize);
+			PERF_DECREMENT(huge_segments);
+		}
 		ppix->shmsize = 0;
+		ppix->huge = FALSE;
 	}
 
 	if (ppix->mallocaddr) {
-		free(ppix->mallocaddr);
+		sgx_pixmem_free(ppix->mallocaddr, ppix->mallocsize);
 		ppix->mallocaddr = NULL;
-		PERF_DECREMENT2(malloc_bytes, ppix->mallocsize);
-		PERF_DECREMENT(malloc_segments);
 		ppix->mallocsize = 0;
 	}
 }
 
+static void doDestroyMemory(struct PVR2DPixmap *ppix)
+{
+	CALLTRACE("%s: Start\n", __func__);
+
+#if SGX_CACHE_SEGMENTS
+	/* Over the budget the memory is better given back */
+	if (!ppix->slab && !locked_over(ppix->screen, 0) &&
+	    AddToCache(&ppix->screen->cache, ppix))
+		return;
+#endif
+
+	freeMemory(ppix);
+}
+
 Bool PVR2DDelayedMemDestroy(Bool wait)
 {
 	while (DelayedPVR2DMemDestroy) {
@@ -142,10 +235,13 @@ void DestroyPVR2DMemory(ScreenPtr pScreen, struct PVR2DPixmap *ppix)
 	DelayedPVR2DMemDestroy = destroy;
 
 	/* the delayed destroy mechanism keeps it's own copy of these. */
+	ppix->slab = NULL;
+	ppix->offset = 0;
 	ppix->pvr2dmem = NULL;
 	ppix->shmid = -1;
 	ppix->shmaddr = NULL;
 	ppix->shmsize = 0;
+	ppix->huge = FALSE;
 	ppix->mallocaddr = NULL;
 	ppix->mallocsize = 0;
 
@@ -156,7 +252,65 @@ void DestroyPVR2DMemory(ScreenPtr pScreen, struct PVR2DPixmap *ppix)
 	}
 }
 
-static Bool PVR2DAllocSHM(struct PVR2DPixmap *ppix)
+/* Returns the size of huge pages, 0 if the kernel doesn't have them */
+unsigned int PVR2DHugePageSize(void)
+{
+	unsigned int size = 0;
+	char line[64];
+	FILE *f;
+
+	f = fopen("/proc/meminfo", "r");
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "Hugepagesize: %u kB", &size) == 1)
+			break;
+
+	fclose(f);
+
+	return size << 10;
+}
+
+/*
+ * Creates the SHM segment. Segments of at least half a huge page are
+ * rounded up to whole huge pages and taken from the huge page pool if
+ * there is one: fewer TLB misses when the CPU walks a big pixmap, and a
+ * segment of a single huge page is physically contiguous for the GPU.
+ * shmsize stays the size of the pixmap, the rest of the last huge page
+ * is never flushed, mapped or accounted for.
+ */
+static int shm_get(struct PVR2DPixmap *ppix)
+{
+	unsigned int huge_size = ppix->screen->huge_page_size;
+#ifdef SHM_HUGETLB
+	int shmid;
+#endif
+
+	ppix->huge = FALSE;
+
+	if (!huge_size || ppix->shmsize < huge_size / 2)
+		return shmget(IPC_PRIVATE, ppix->shmsize, IPC_CREAT | 0666);
+
+#ifdef SHM_HUGETLB
+	shmid = shmget(IPC_PRIVATE, ALIGN(ppix->shmsize, huge_size),
+		       IPC_CREAT | SHM_HUGETLB | 0666);
+	if (shmid != -1) {
+		ppix->huge = TRUE;
+		return shmid;
+	}
+#endif
+
+	return shmget(IPC_PRIVATE, ppix->shmsize, IPC_CREAT | 0666);
+}
+
+/*
+ * Allocates an SHM segment for the pixmap. Unless force is set this
+ * fails when the segment doesn't fit in the locked memory budget.
+ * See PVR2DLockSHM() for cleanup.
+ */
+static Bool PVR2DAllocSHM(struct PVR2DPixmap *ppix, Bool force,
+			  Bool cleanup)
 {
 	CALLTRACE("%s: Start\n", __func__);
 
@@ -172,12 +326,12 @@ static Bool PVR2DAllocSHM(struct PVR2DPixmap *ppix)
 	assert(ppix->shmsize == ALIGN(ppix->shmsize, page_size));
 
 #if SGX_CACHE_SEGMENTS
-	if (GetFromCache (ppix))
+	if (GetFromCache(&ppix->screen->cache, ppix))
 	    if (ppix->shmaddr)
 			return TRUE;
 #endif
 
-	ppix->shmid = shmget(IPC_PRIVATE, ppix->shmsize, IPC_CREAT | 0666);
+	ppix->shmid = shm_get(ppix);
 
 	if (ppix->shmid == -1) {
 		perror("shmget failed");
@@ -188,8 +342,12 @@ static Bool PVR2DAllocSHM(struct PVR2DPixmap *ppix)
 	 * Cache flush/invalidate could cause unhandled page fault
 	 * if shared memory was swapped out
 	 */
-	if (0 != shmctl(ppix->shmid, SHM_LOCK, 0))
-		ErrorF("shmctl(SHM_LOCK) failed\n");
+	if (!PVR2DLockSHM(ppix->screen, ppix->shmid, ppix->shmsize,
+			  force, cleanup)) {
+		shmctl(ppix->shmid, IPC_RMID, NULL);
+		ppix->shmid = -1;
+		return FALSE;
+	}
 
 	ppix->shmaddr = shmat(ppix->shmid, NULL, 0);
 
@@ -202,16 +360,29 @@ static Bool PVR2DAllocSHM(struct PVR2DPixmap *ppix)
 
 	if (!ppix->shmaddr) {
 		perror("shmat failed");
+		PVR2DUnlockSHM(ppix->screen, ppix->shmsize);
 		ppix->shmid = -1;
 		return FALSE;
 	}
 
+#ifdef MADV_HUGEPAGE
+	/* No huge page pool, transparent huge pages may do */
+	if (!ppix->huge && ppix->screen->huge_page_size &&
+	    ppix->shmsize >= ppix->screen->huge_page_size &&
+	    !madvise(ppix->shmaddr, ppix->shmsize, MADV_HUGEPAGE))
+		PERF_INCREMENT(huge_advised);
+#endif
+
 	/* Allocating memory makes it CPU owned and dirty */
 	ppix->owner = PVR2D_OWNER_CPU;
-	ppix->bCPUWrites = TRUE;
+	ppix->cpu_dirty = PVR2D_ALL_BANDS;
 
 	PERF_INCREMENT2(shm_bytes, ppix->shmsize);
 	PERF_INCREMENT(shm_segments);
+	if (ppix->huge) {
+		PERF_INCREMENT2(huge_bytes, ppix->shmsize);
+		PERF_INCREMENT(huge_segments);
+	}
 
 	return TRUE;
 }
@@ -228,17 +399,17 @@ static Bool PVR2DAllocNormal(struct PVR2DPixmap *ppix)
 		return TRUE;
 
 #if SGX_CACHE_SEGMENTS
-	if (GetFromCache (ppix))
+	if (GetFromCache(&ppix->screen->cache, ppix))
 		return TRUE;
 #endif
 
-	ppix->mallocaddr = calloc(1, ppix->mallocsize);
+	ppix->mallocaddr = sgx_pixmem_alloc(ppix->mallocsize);
 	if (!ppix->mallocaddr)
 		return FALSE;
 
 	/* Allocating memory makes it CPU owned and dirty */
 	ppix->owner = PVR2D_OWNER_CPU;
-	ppix->bCPUWrites = TRUE;
+	ppix->cpu_dirty = PVR2D_ALL_BANDS;
 
 	return TRUE;
 }
@@ -246,9 +417,10 @@ static Bool PVR2DAllocNormal(struct PVR2DPixmap *ppix)
 Bool PVR2DAllocatePixmapMem(PixmapPtr pPixmap, struct PVR2DPixmap * ppix,
 			   int width, int height, int pitch, pointer pPixData)
 {
-	struct pvr2d_screen *screen = pvr2d_get_screen();
+	struct pvr2d_screen *screen = ppix->screen;
 	ScreenPtr pScreen = pPixmap->drawable.pScreen;
 	struct PVR2DPixmap newpix = {
+		.screen = screen,
 		.shmid = -1,
 	};
 
@@ -291,17 +463,24 @@ Bool PVR2DAllocatePixmapMem(PixmapPtr pPixmap, struct PVR2DPixmap * ppix,
 		assert(PVR2DCheckSizeLimits(width, height));
 
 #ifdef SGX_CACHE_SEGMENTS
-		SetWindowSizeSharedSegments(height * pitch);
+		SetWindowSizeSharedSegments(&screen->cache, height * pitch);
 #endif
 		return TRUE;
 	}
 
-	if (pPixmap->usage_hint == CREATE_PIXMAP_USAGE_BACKING_PIXMAP &&
-	    PVR2DCheckSizeLimits(width, height)) {
+	if ((pPixmap->usage_hint == CREATE_PIXMAP_USAGE_BACKING_PIXMAP ||
+	     pPixmap->usage_hint == SGX_EXA_CREATE_PIXMAP_GPU) &&
+	    PVR2DCheckSizeLimits(width, height) &&
+	    !sgx_slab_alloc(&newpix, pitch * height, TRUE)) {
 		newpix.shmsize = ALIGN(pitch * height, page_size);
 
-		if (!PVR2DAllocSHM(&newpix))
-			return FALSE;
+		/* Out of locked memory, it can still be promoted later */
+		if (!PVR2DAllocSHM(&newpix, FALSE, TRUE))
+			newpix.shmsize = 0;
+	}
+
+	if (newpix.shmaddr) {
+		PVR2DSetBands(&newpix, height, pitch);
 	} else {
 		newpix.mallocsize = pitch * height;
 
@@ -311,50 +490,181 @@ Bool PVR2DAllocatePixmapMem(PixmapPtr pPixmap, struct PVR2DPixmap * ppix,
 
 	DestroyPVR2DMemory(pScreen, ppix);
 	*ppix = newpix;
+	PVR2DPixmapChanged(ppix);
 
 	return TRUE;
 }
 
-Bool pvr2d_dri2_migrate_pixmap(PixmapPtr pPixmap, struct PVR2DPixmap *pix)
+/*
+ * Copies a malloc() pixmap into SHM, optionally into a slab. force
+ * goes over the locked memory budget if need be, cleanup allows
+ * unmapping other pixmaps to make room.
+ */
+static Bool move_to_shm(PixmapPtr pPixmap, struct PVR2DPixmap *pix,
+			Bool slab, Bool force, Bool cleanup)
+{
+	struct PVR2DPixmap newpix = {
+		.screen = pix->screen,
+		.shmid = -1,
+	};
+
+	assert(!pix->pvr2dmem);
+
+	assert(pix->shmid < 0);
+	assert(!pix->shmaddr);
+	assert(!pix->shmsize);
+
+	assert(pix->mallocaddr);
+	assert(pix->mallocsize);
+
+	if (!slab || !sgx_slab_alloc(&newpix, pix->mallocsize, cleanup)) {
+		newpix.shmsize = ALIGN(pix->mallocsize, page_size);
+
+		if (!PVR2DAllocSHM(&newpix, force, cleanup))
+			return FALSE;
+	}
+
+	PVR2DSetBands(&newpix, pPixmap->drawable.height, pPixmap->devKind);
+
+	DebugF("%s: memcpy %d bytes from malloc (%p) to SHM (%p)\n",
+	       __func__, pix->mallocsize, pix->mallocaddr, newpix.shmaddr);
+
+	PVR2DPixmapOwnership_CPU(&newpix);
+	memcpy(newpix.shmaddr, pix->mallocaddr, pix->mallocsize);
+
+	DestroyPVR2DMemory(pPixmap->drawable.pScreen, pix);
+	*pix = newpix;
+	PVR2DPixmapChanged(pix);
+
+	return TRUE;
+}
+
+/*
+ * Moves a malloc() pixmap that keeps falling back to software into SHM,
+ * so that the GPU can render to and from it.
+ */
+Bool PVR2DPromotePixmap(PixmapPtr pPixmap, struct PVR2DPixmap *pix,
+			Bool slab, Bool cleanup)
 {
+	int size = pix->mallocsize;
+
 	if (!page_size)
 		page_size = getpagesize();
 
-	if (pix->mallocaddr &&
-	    PVR2DCheckSizeLimits(pPixmap->drawable.width,
-				 pPixmap->drawable.height)) {
-		struct PVR2DPixmap newpix = {
-			.shmid = -1,
-			.shmsize = ALIGN(pix->mallocsize, page_size),
-		};
+	if (!pix->mallocaddr ||
+	    !PVR2DCheckSizeLimits(pPixmap->drawable.width,
+				  pPixmap->drawable.height))
+		return FALSE;
 
-		assert(!pix->pvr2dmem);
+	if (!move_to_shm(pPixmap, pix, slab, FALSE, cleanup))
+		return FALSE;
 
-		assert(pix->shmid < 0);
-		assert(!pix->shmaddr);
-		assert(!pix->shmsize);
+	pix->promoted_size = size;
+	pix->gpu_used = TRUE;
 
-		assert(pix->mallocaddr);
-		assert(pix->mallocsize);
+	PERF_INCREMENT(promoted);
+	PERF_INCREMENT2(promoted_bytes, size);
 
-		if (!PVR2DAllocSHM(&newpix))
-			return FALSE;
+	return TRUE;
+}
 
-		DebugF("%s: memcpy %d bytes from malloc (%p) to SHM (%p)\n",
-		       __func__, pix->mallocsize, pix->mallocaddr, newpix.shmaddr);
+/*
+ * Moves a promoted pixmap back to malloc() memory, freeing its SHM and
+ * GPU mapping right away. There must be no blits pending on it.
+ */
+Bool PVR2DDemotePixmap(struct PVR2DPixmap *pix)
+{
+	struct PVR2DPixmap newpix = {
+		.screen = pix->screen,
+		.shmid = -1,
+		.mallocsize = pix->promoted_size,
+	};
 
-		PVR2DPixmapOwnership_CPU(&newpix);
-		memcpy(newpix.shmaddr, pix->mallocaddr, pix->mallocsize);
+	assert(pix->promoted_size);
+	assert(pix->shmaddr);
 
-		DestroyPVR2DMemory(pPixmap->drawable.pScreen, pix);
-		*pix = newpix;
-	}
+	if (!PVR2DAllocNormal(&newpix))
+		return FALSE;
+
+	PVR2DPixmapOwnership_CPU(pix);
+	memcpy(newpix.mallocaddr, pix->shmaddr, newpix.mallocsize);
+
+	PERF_INCREMENT(demoted);
+
+	/* Not into the segment cache, the memory is needed elsewhere */
+	freeMemory(pix);
+	*pix = newpix;
+	PVR2DPixmapChanged(pix);
+
+	return TRUE;
+}
+
+/*
+ * Moves a slab pixmap into an SHM segment of its own, for users which
+ * can only address whole segments: DRI2 clients and the extended blits.
+ * force goes over the locked memory budget if need be.
+ */
+Bool PVR2DUnslabPixmap(PixmapPtr pPixmap, struct PVR2DPixmap *pix,
+		       Bool force, Bool cleanup)
+{
+	int size = pPixmap->devKind * pPixmap->drawable.height;
+	struct PVR2DPixmap newpix = {
+		.screen = pix->screen,
+		.shmid = -1,
+	};
+
+	if (!pix->slab)
+		return TRUE;
+
+	if (!page_size)
+		page_size = getpagesize();
+
+	newpix.shmsize = ALIGN(size, page_size);
+
+	/* Keep reclaiming the budget from demoting the pixmap under us */
+	pix->gpu_used = TRUE;
+
+	if (!PVR2DAllocSHM(&newpix, force, cleanup))
+		return FALSE;
+
+	PVR2DSetBands(&newpix, pPixmap->drawable.height, pPixmap->devKind);
+
+	PVR2DPixmapOwnership_CPU(pix);
+	PVR2DPixmapOwnership_CPU(&newpix);
+	memcpy(newpix.shmaddr, pix->shmaddr, size);
+
+	DestroyPVR2DMemory(pPixmap->drawable.pScreen, pix);
+	*pix = newpix;
+	PVR2DPixmapChanged(pix);
+
+	PERF_INCREMENT(slab_moved);
+
+	return TRUE;
+}
+
+Bool pvr2d_dri2_migrate_pixmap(PixmapPtr pPixmap, struct PVR2DPixmap *pix)
+{
+	if (!page_size)
+		page_size = getpagesize();
+
+	/* DRI2 clients attach the whole segment */
+	if (!PVR2DUnslabPixmap(pPixmap, pix, TRUE, TRUE))
+		return FALSE;
+
+	if (pix->mallocaddr &&
+	    PVR2DCheckSizeLimits(pPixmap->drawable.width,
+				 pPixmap->drawable.height) &&
+	    !move_to_shm(pPixmap, pix, FALSE, TRUE, TRUE))
+		return FALSE;
 
 	if (!PVR2DValidate(pPixmap, pix, TRUE)) {
 		ErrorF("%s: !PVR2DValidate()\n", __func__);
 		return FALSE;
 	}
 
+	/* Clients may be using it, it must stay in SHM */
+	pix->promoted_size = 0;
+
 	PVR2DPixmapOwnership_GPU(pix);
 
 	return TRUE;
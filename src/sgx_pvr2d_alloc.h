@@ -30,6 +30,15 @@ void DestroyPVR2DMemory(ScreenPtr pScreen, struct PVR2DPixmap *ppix);
 Bool PVR2DAllocatePixmapMem(PixmapPtr pPixmap, struct PVR2DPixmap *ppix,
 			    int width, int height, int pitch,
 			    pointer pPixData);
+Bool PVR2DPromotePixmap(PixmapPtr pPixmap, struct PVR2DPixmap *pix,
+			Bool slab, Bool cleanup);
+Bool PVR2DDemotePixmap(struct PVR2DPixmap *pix);
+Bool PVR2DUnslabPixmap(PixmapPtr pPixmap, struct PVR2DPixmap *pix,
+		       Bool force, Bool cleanup);
+Bool PVR2DLockSHM(struct pvr2d_screen *screen, int shmid, unsigned int size,
+		  Bool force, Bool cleanup);
+void PVR2DUnlockSHM(struct pvr2d_screen *screen, unsigned int size);
+unsigned int PVR2DHugePageSize(void);
 Bool pvr2d_dri2_migrate_pixmap(PixmapPtr pPixmap, struct PVR2DPixmap *pix);
 
 #endif
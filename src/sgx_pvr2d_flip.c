@@ -96,6 +96,17 @@ int pvr2d_page_flip_create(PVR2DCONTEXTHANDLE ctx, unsigned buf_len,
 void pvr2d_page_flip_destroy(PVR2DCONTEXTHANDLE ctx,
 			struct pvr2d_page_flip *page_flip)
 {
+	PixmapPtr pixmaps[MAX_PAGE_FLIP_BUFFERS];
+	int i;
+
 	pvr2d_flip_put_bufs(ctx, page_flip->bufs, page_flip->num_bufs);
+
+	/* The pixmaps live as long as the screen, see update_flip_pixmaps() */
+	for (i = 0; i < MAX_PAGE_FLIP_BUFFERS; i++)
+		pixmaps[i] = page_flip->bufs[i].pixmap;
+
 	memset(page_flip, 0, sizeof(*page_flip));
+
+	for (i = 0; i < MAX_PAGE_FLIP_BUFFERS; i++)
+		page_flip->bufs[i].pixmap = pixmaps[i];
 }
@@ -50,6 +50,22 @@ struct pvr2d_fs_flip_buf {
  */
 #define MAX_PAGE_FLIP_BUFFERS 3
 
+/*
+ * Extra buffers after the page flip buffers, used as the
+ * destination of GPU scaled Xv clones (VideoCloneBlit).
+ * One is scanned out, one holds the previous frame waiting
+ * to be shown, and one is being blitted to.
+ */
+#define CLONE_BLIT_BUFFERS 3
+
+/*
+ * Extra buffers after the clone buffers, which a DRI2 window
+ * renders into while a video overlay scans it out (OverlaySwap).
+ * One is scanned out, one may still be until the overlay picks
+ * up the next one, and one is being rendered to.
+ */
+#define OVERLAY_SWAP_BUFFERS 3
+
 struct pvr2d_page_flip {
 	unsigned stride;
 	unsigned bpp;
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2010  Nokia Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Slab sub-allocator for small SHM pixmaps.
+ *
+ * Every SHM pixmap used to cost a segment, up to a page of slack and a
+ * GPU mapping of its own. Small pixmaps are instead given a slot in an
+ * arena which is allocated, locked and wrapped for the GPU once. Blits
+ * address the pixmap through DstOffset/SrcOffset.
+ *
+ * The GPU tracks blits per wrapped memory, so an arena is busy as long
+ * as any blit on any of its pixmaps is pending. Slots are freed through
+ * the delayed destroy list like any other PVR2D memory, and an arena is
+ * only released once it is empty and idle. New slots are taken from the
+ * fullest arena of the size class so that sparsely used arenas drain
+ * and can be released.
+ */
+
+#include "fbdev.h"
+#include "sgx_pvr2d.h"
+#include "sgx_pvr2d_alloc.h"
+#include "sgx_slab.h"
+#include "perf.h"
+
+static int slab_class(unsigned int size)
+{
+	int shift = SGX_SLAB_MIN_SHIFT;
+
+	while ((1u << shift) < size)
+		shift++;
+
+	return shift - SGX_SLAB_MIN_SHIFT;
+}
+
+static unsigned int slab_slots(struct sgx_slab *slab)
+{
+	return SGX_SLAB_ARENA_SIZE >> slab->slot_shift;
+}
+
+static struct sgx_slab *slab_create(struct pvr2d_screen *screen,
+				    unsigned int slot_shift, Bool cleanup)
+{
+	struct sgx_slab *slab;
+	unsigned int i;
+
+	slab = calloc(1, sizeof(*slab));
+	if (!slab)
+		return NULL;
+
+	slab->slot_shift = slot_shift;
+
+	slab->shmid = shmget(IPC_PRIVATE, SGX_SLAB_ARENA_SIZE,
+			     IPC_CREAT | 0666);
+	if (slab->shmid == -1) {
+		perror("shmget failed");
+		goto free_slab;
+	}
+
+	/* see PVR2DAllocSHM() */
+	if (!PVR2DLockSHM(screen, slab->shmid, SGX_SLAB_ARENA_SIZE,
+			  FALSE, cleanup)) {
+		shmctl(slab->shmid, IPC_RMID, NULL);
+		goto free_slab;
+	}
+
+	slab->addr = shmat(slab->shmid, NULL, 0);
+	shmctl(slab->shmid, IPC_RMID, NULL);
+
+	if (slab->addr == (void *) -1) {
+		perror("shmat failed");
+		goto unlock;
+	}
+
+	if (PVR2DMemWrap(screen->context, slab->addr,
+			 PVR2D_WRAPFLAG_NONCONTIGUOUS, SGX_SLAB_ARENA_SIZE,
+			 NULL, &slab->mem) != PVR2D_OK) {
+		/* Try again after freeing PVR2D memory synchronously */
+		PVR2DDelayedMemDestroy(TRUE);
+
+		if (PVR2DMemWrap(screen->context, slab->addr,
+				 PVR2D_WRAPFLAG_NONCONTIGUOUS,
+				 SGX_SLAB_ARENA_SIZE, NULL,
+				 &slab->mem) != PVR2D_OK)
+			goto detach;
+	}
+
+	for (i = 0; i < slab_slots(slab); i++)
+		slab->free_map[i / 32] |= 1u << (i % 32);
+
+	PERF_INCREMENT2(shm_bytes, SGX_SLAB_ARENA_SIZE);
+	PERF_INCREMENT(shm_segments);
+	PERF_INCREMENT(slab_arenas);
+
+	return slab;
+
+ detach:
+	shmdt(slab->addr);
+ unlock:
+	PVR2DUnlockSHM(screen, SGX_SLAB_ARENA_SIZE);
+ free_slab:
+	free(slab);
+	return NULL;
+}
+
+static void slab_destroy(struct pvr2d_screen *screen, struct sgx_slab *slab)
+{
+	PVR2DMemFree(screen->context, slab->mem);
+	shmdt(slab->addr);
+	PVR2DUnlockSHM(screen, SGX_SLAB_ARENA_SIZE);
+	free(slab);
+
+	PERF_DECREMENT2(shm_bytes, SGX_SLAB_ARENA_SIZE);
+	PERF_DECREMENT(shm_segments);
+	PERF_DECREMENT(slab_arenas);
+}
+
+static Bool slab_idle(struct pvr2d_screen *screen, struct sgx_slab *slab)
+{
+	return PVR2DQueryBlitsComplete(screen->context, slab->mem, 0) ==
+		PVR2D_OK;
+}
+
+/*
+ * Gives the pixmap a slot of at least size bytes. The pixmap is left
+ * CPU owned and dirty like a freshly allocated segment. cleanup is
+ * as for PVR2DLockSHM().
+ */
+Bool sgx_slab_alloc(struct PVR2DPixmap *ppix, unsigned int size,
+		    Bool cleanup)
+{
+	struct pvr2d_screen *screen = ppix->screen;
+	struct sgx_slab *slab, *best = NULL;
+	unsigned int slot, i;
+	int class;
+
+	if (!screen->slabs.enabled || !size ||
+	    size > 1u << SGX_SLAB_MAX_SHIFT)
+		return FALSE;
+
+	class = slab_class(size);
+
+	for (slab = screen->slabs.arenas[class]; slab; slab = slab->next) {
+		if (slab->used == slab_slots(slab))
+			continue;
+		if (!best || slab->used > best->used)
+			best = slab;
+	}
+
+	if (!best) {
+		best = slab_create(screen, class + SGX_SLAB_MIN_SHIFT,
+				   cleanup);
+		if (!best)
+			return FALSE;
+
+		best->next = screen->slabs.arenas[class];
+		screen->slabs.arenas[class] = best;
+	}
+
+	for (i = 0; !best->free_map[i]; i++)
+		;
+	slot = i * 32 + __builtin_ctz(best->free_map[i]);
+	best->free_map[i] &= ~(1u << (slot % 32));
+	best->used++;
+
+	ppix->slab = best;
+	ppix->offset = slot << best->slot_shift;
+	ppix->pvr2dmem = best->mem;
+	ppix->shmid = best->shmid;
+	ppix->shmaddr = (char *) best->addr + ppix->offset;
+	ppix->shmsize = 1u << best->slot_shift;
+
+	ppix->owner = PVR2D_OWNER_CPU;
+	ppix->cpu_dirty = PVR2D_ALL_BANDS;
+
+	PERF_INCREMENT(slab_pixmaps);
+	PERF_INCREMENT2(slab_bytes, ppix->shmsize);
+
+	return TRUE;
+}
+
+/* Returns the slot to its arena, there must be no blits pending on it */
+void sgx_slab_free(struct PVR2DPixmap *ppix)
+{
+	struct sgx_slab *slab = ppix->slab;
+	unsigned int slot = ppix->offset >> slab->slot_shift;
+
+	assert(!(slab->free_map[slot / 32] & (1u << (slot % 32))));
+
+	slab->free_map[slot / 32] |= 1u << (slot % 32);
+	slab->used--;
+
+	PERF_DECREMENT(slab_pixmaps);
+	PERF_DECREMENT2(slab_bytes, ppix->shmsize);
+
+	ppix->slab = NULL;
+	ppix->offset = 0;
+	ppix->pvr2dmem = NULL;
+	ppix->shmid = -1;
+	ppix->shmaddr = NULL;
+	ppix->shmsize = 0;
+
+	if (!slab->used)
+		sgx_slab_trim(ppix->screen, TRUE);
+}
+
+/*
+ * Releases empty and idle arenas. With keep_spare one empty arena per
+ * size class is kept, so that a pixmap being recreated over and over
+ * doesn't cost a new arena each time.
+ */
+void sgx_slab_trim(struct pvr2d_screen *screen, Bool keep_spare)
+{
+	struct sgx_slab **p, *slab;
+	int class, spare;
+
+	for (class = 0; class < SGX_SLAB_CLASSES; class++) {
+		spare = 0;
+
+		for (p = &screen->slabs.arenas[class]; (slab = *p);) {
+			if (slab->used || !slab_idle(screen, slab) ||
+			    (keep_spare && !spare++)) {
+				p = &slab->next;
+				continue;
+			}
+
+			*p = slab->next;
+			slab_destroy(screen, slab);
+		}
+	}
+}
+
+void sgx_slab_fini(struct pvr2d_screen *screen)
+{
+	struct sgx_slab *slab;
+	int class;
+
+	for (class = 0; class < SGX_SLAB_CLASSES; class++) {
+		while ((slab = screen->slabs.arenas[class])) {
+			if (slab->used)
+				ErrorF("%s: freeing arena with %u pixmaps\n",
+				       __func__, slab->used);
+
+			screen->slabs.arenas[class] = slab->next;
+			slab_destroy(screen, slab);
+		}
+	}
+}
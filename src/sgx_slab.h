@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2010  Nokia Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SGX_SLAB_H
+#define SGX_SLAB_H 1
+
+struct PVR2DPixmap;
+struct pvr2d_screen;
+
+/*
+ * Small SHM pixmaps are packed into slots of shared arenas, one slot
+ * size per arena. Slot sizes are powers of two from 256 bytes to
+ * 16 KiB, which keeps slots cache line aligned.
+ */
+#define SGX_SLAB_MIN_SHIFT	8
+#define SGX_SLAB_MAX_SHIFT	14
+#define SGX_SLAB_CLASSES	(SGX_SLAB_MAX_SHIFT - SGX_SLAB_MIN_SHIFT + 1)
+#define SGX_SLAB_ARENA_SIZE	(64 * 1024)
+#define SGX_SLAB_MAX_SLOTS	(SGX_SLAB_ARENA_SIZE >> SGX_SLAB_MIN_SHIFT)
+
+struct sgx_slab {
+	struct sgx_slab *next;
+	int shmid;
+	void *addr;
+	/* wrapped once, shared by all the pixmaps in the arena */
+	PVR2DMEMINFO *mem;
+	unsigned int slot_shift;
+	unsigned int used;
+	/* set bits are free slots */
+	CARD32 free_map[SGX_SLAB_MAX_SLOTS / 32];
+};
+
+struct sgx_slabs {
+	Bool enabled;
+	struct sgx_slab *arenas[SGX_SLAB_CLASSES];
+};
+
+Bool sgx_slab_alloc(struct PVR2DPixmap *ppix, unsigned int size,
+		    Bool cleanup);
+void sgx_slab_free(struct PVR2DPixmap *ppix);
+void sgx_slab_trim(struct pvr2d_screen *screen, Bool keep_spare);
+void sgx_slab_fini(struct pvr2d_screen *screen);
+
+#endif /* SGX_SLAB_H */
@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2010  Nokia Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Asynchronous waits for the GPU.
+ *
+ * Requests that EXA always renders with the CPU would block the whole
+ * server in PVR2DPixmapOwnership_CPU() while the SGX is still busy with
+ * the drawable. Instead such a request is put back, its client is
+ * ignored and a sync event is requested for the drawable's memory.
+ * Other clients are served until the event arrives, then the client is
+ * attended again and the request is run from the start.
+ *
+ * Requests can only be put back before anything has been done for them,
+ * so this is done in front of the core request handlers rather than in
+ * PrepareAccess. A woken request runs even if the GPU is busy again.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "fbdev.h"
+#include "sgx_pvr2d.h"
+#include "sgx_wait.h"
+#include "perf.h"
+
+#include <exa.h>
+#include <dixstruct.h>
+#include <X11/Xproto.h>
+
+struct sgx_wait {
+	struct sgx_wait *next;
+	/* NULL once the client is gone */
+	ClientPtr client;
+	/* the sync event has arrived */
+	Bool done;
+};
+
+/* requests which EXA renders with the CPU, all start with a drawable */
+static const CARD8 deferred_requests[] = {
+	X_PutImage,
+	X_GetImage,
+	X_PolyPoint,
+	X_PolyLine,
+	X_PolyArc,
+	X_FillPoly,
+	X_PolyFillArc,
+	X_PolyText8,
+	X_PolyText16,
+	X_ImageText8,
+	X_ImageText16,
+};
+
+static ScreenPtr wait_screen;
+static struct sgx_wait *waits;
+static int (*saved_procs[256])(ClientPtr client);
+
+static void unlink_wait(struct sgx_wait *wait)
+{
+	struct sgx_wait **p;
+
+	for (p = &waits; *p; p = &(*p)->next) {
+		if (*p == wait) {
+			*p = wait->next;
+			break;
+		}
+	}
+}
+
+static struct sgx_wait *find_done_wait(ClientPtr client)
+{
+	struct sgx_wait *wait;
+
+	for (wait = waits; wait; wait = wait->next)
+		if (wait->client == client && wait->done)
+			return wait;
+
+	return NULL;
+}
+
+/* returns TRUE if the client was put to sleep */
+static Bool defer_request(ClientPtr client, DrawablePtr draw)
+{
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(draw->pScreen));
+	struct PVR2DPixmap *ppix;
+	struct sgx_wait *wait;
+	PixmapPtr pix;
+
+	pix = draw->type == DRAWABLE_WINDOW ?
+		draw->pScreen->GetWindowPixmap((WindowPtr) draw) :
+		(PixmapPtr) draw;
+
+	ppix = exaGetPixmapDriverPrivate(pix);
+	if (!ppix || !ppix->pvr2dmem || ppix->owner != PVR2D_OWNER_GPU ||
+	    QueryBlitsComplete(ppix, 0) == PVR2D_OK)
+		return FALSE;
+
+	wait = calloc(1, sizeof *wait);
+	if (!wait)
+		return FALSE;
+
+	wait->client = client;
+
+	if (PVR2DSyncEventReq(screen->context, ppix->pvr2dmem, wait,
+			      PVR2D_WAIT_SYNC_EVENT) != PVR2D_OK) {
+		free(wait);
+		return FALSE;
+	}
+
+	wait->next = waits;
+	waits = wait;
+
+	ResetCurrentRequest(client);
+	client->sequence--;
+	IgnoreClient(client);
+
+	PERF_INCREMENT(client_wait);
+
+	return TRUE;
+}
+
+static int ProcSGXDeferred(ClientPtr client)
+{
+	REQUEST(xResourceReq);
+	struct sgx_wait *wait;
+	DrawablePtr draw;
+
+	wait = find_done_wait(client);
+	if (wait) {
+		unlink_wait(wait);
+		free(wait);
+		goto run;
+	}
+
+	/* the request would be swapped again when it's run */
+	if (client->swapped ||
+	    client->req_len < bytes_to_int32(sizeof(xResourceReq)))
+		goto run;
+
+	if (dixLookupDrawable(&draw, stuff->id, client, M_ANY,
+			      DixGetAttrAccess) != Success ||
+	    draw->pScreen != wait_screen)
+		goto run;
+
+	if (defer_request(client, draw))
+		return Success;
+
+ run:
+	return saved_procs[stuff->reqType](client);
+}
+
+static void sgx_wait_client_state(CallbackListPtr *list, pointer closure,
+				  pointer data)
+{
+	NewClientInfoRec *info = data;
+	ClientPtr client = info->client;
+	struct sgx_wait *wait, *next;
+
+	if (client->clientState != ClientStateGone &&
+	    client->clientState != ClientStateRetained)
+		return;
+
+	for (wait = waits; wait; wait = next) {
+		next = wait->next;
+
+		if (wait->client != client)
+			continue;
+
+		/* the sync event still has to arrive for a pending wait */
+		if (wait->done) {
+			unlink_wait(wait);
+			free(wait);
+		} else
+			wait->client = NULL;
+	}
+}
+
+/* returns TRUE if the sync event was for a deferred request */
+Bool sgx_wait_sync_event(unsigned long user_data)
+{
+	struct sgx_wait *wait;
+
+	for (wait = waits; wait; wait = wait->next)
+		if ((unsigned long) wait == user_data)
+			break;
+
+	if (!wait)
+		return FALSE;
+
+	if (!wait->client) {
+		unlink_wait(wait);
+		free(wait);
+		return TRUE;
+	}
+
+	wait->done = TRUE;
+	AttendClient(wait->client);
+
+	return TRUE;
+}
+
+Bool sgx_wait_init(ScreenPtr pScreen)
+{
+	int i;
+
+	/* ProcVector is shared by all screens */
+	if (wait_screen)
+		return FALSE;
+
+	if (!AddCallback(&ClientStateCallback, sgx_wait_client_state, NULL))
+		return FALSE;
+
+	for (i = 0; i < ARRAY_SIZE(deferred_requests); i++) {
+		CARD8 req = deferred_requests[i];
+
+		saved_procs[req] = ProcVector[req];
+		ProcVector[req] = ProcSGXDeferred;
+	}
+
+	wait_screen = pScreen;
+
+	return TRUE;
+}
+
+void sgx_wait_fini(ScreenPtr pScreen)
+{
+	struct sgx_wait *wait;
+	int i;
+
+	if (wait_screen != pScreen)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(deferred_requests); i++) {
+		CARD8 req = deferred_requests[i];
+
+		ProcVector[req] = saved_procs[req];
+		saved_procs[req] = NULL;
+	}
+
+	DeleteCallback(&ClientStateCallback, sgx_wait_client_state, NULL);
+
+	/* no more events will arrive */
+	while (waits) {
+		wait = waits;
+		waits = wait->next;
+		if (wait->client && !wait->done)
+			AttendClient(wait->client);
+		free(wait);
+	}
+
+	wait_screen = NULL;
+}
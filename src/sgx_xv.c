@@ -25,6 +25,7 @@
 #include "sgx_exa.h"
 #include "sgx_xv.h"
 #include "omap_video.h"
+#include "omap_video_copy.h"
 
 #include <xf86xv.h>
 #include <X11/extensions/Xv.h>
@@ -51,7 +52,18 @@
 
 static Atom xvBrightness, xvContrast, xvHue, xvSaturation;
 
+/* putImage needs 1 source surface for packed and 3 source surfaces for planar formats.
+ * We keep two sets of source surfaces for asynchronous operation */
+struct _Mem {
+	PVR2DMEMINFO *pMemInfo;
+	unsigned size;
+};
+
 typedef struct _pvr2DPortPrivRec {
+	struct pvr2d_screen *screen;
+	PVR2DEXTBLTINFO pvr2dextblt;
+	struct _Mem MemSet[2][3];
+	int memsetSelector;
 	int brightness;
 	int contrast;
 	int saturation;
@@ -237,17 +249,9 @@ static int pvr2DQueryImageAttributes(ScrnInfoPtr pScrn, int id,
 
 }
 
-static PVR2DEXTBLTINFO pvr2dextblt;
-/* putImage needs 1 source surface for packed and 3 source surfaces for planar formats.
- * We keep two sets of source surfaces for asynchronous operation */
-static struct _Mem {
-	PVR2DMEMINFO *pMemInfo;
-	unsigned size;
-} MemSet[2][3], *pMem;
-
-static void freeMem(struct _Mem *pMem)
+static void freeMem(struct pvr2d_screen *screen, struct _Mem *pMem)
 {
-	PVR2DCONTEXTHANDLE context = pvr2d_get_screen()->context;
+	PVR2DCONTEXTHANDLE context = screen->context;
 
 	if (!pMem->pMemInfo)
 		return;
@@ -261,14 +265,15 @@ static void freeMem(struct _Mem *pMem)
 	pMem->size = 0;
 }
 
-static Bool allocMem(struct _Mem *pMem, unsigned size)
+static Bool allocMem(struct pvr2d_screen *screen, struct _Mem *pMem,
+		     unsigned size)
 {
 	if (pMem->size >= size)
 		return TRUE;
-	freeMem(pMem);
+	freeMem(screen, pMem);
 
 	if (!pMem->pMemInfo
-	    && PVR2DMemAlloc(pvr2d_get_screen()->context, size, 4, 0,
+	    && PVR2DMemAlloc(screen->context, size, 4, 0,
 			     &pMem->pMemInfo) != PVR2D_OK) {
 		pMem->pMemInfo = NULL;
 		return FALSE;
@@ -279,34 +284,67 @@ static Bool allocMem(struct _Mem *pMem, unsigned size)
 
 static void pvr2DStopVideo(ScrnInfoPtr pScrn, pointer data, Bool cleanup)
 {
+	pvr2DPortPrivPtr pPriv = (pvr2DPortPrivPtr) data;
+
 	DBG("%s(pScrn, %p, %s\n", __func__, data, cleanup ? "TRUE" : "FALSE");
 
 	if (cleanup) {
 		int i;
 
 		for (i = 0; i < 3; i++) {
-			freeMem(&MemSet[0][i]);
-			freeMem(&MemSet[1][i]);
+			freeMem(pPriv->screen, &pPriv->MemSet[0][i]);
+			freeMem(pPriv->screen, &pPriv->MemSet[1][i]);
 		}
 	}
 }
 
-static int initSrcSurf(int surfNum, unsigned width, unsigned stride,
+struct surf_copy {
+	CARD8 *dst;
+	const CARD8 *src;
+	unsigned stride;
+	unsigned buf_stride;
+};
+
+static void copySurfBand(void *data, int y1, int y2)
+{
+	const struct surf_copy *c = data;
+	CARD8 *dst = c->dst + y1 * c->stride;
+	const CARD8 *src = c->src + y1 * c->buf_stride;
+	int i;
+
+	if (c->stride == c->buf_stride) {
+		memcpy(dst, src, c->stride * (y2 - y1));
+	} else {
+		unsigned copy_size = min(c->stride, c->buf_stride);
+
+		for (i = y1; i < y2; i++) {
+			memcpy(dst, src, copy_size);
+			dst += c->stride;
+			src += c->buf_stride;
+		}
+	}
+}
+
+static int initSrcSurf(pvr2DPortPrivPtr pPriv, struct _Mem *pMem,
+		       struct omap_copy_pool *pool,
+		       int surfNum, unsigned width, unsigned stride,
 		       unsigned height, void *buf, unsigned buf_stride)
 {
-	PVR2DCONTEXTHANDLE context = pvr2d_get_screen()->context;
+	PVR2DCONTEXTHANDLE context = pPriv->screen->context;
+	PVR2DEXTBLTINFO *pvr2dextblt = &pPriv->pvr2dextblt;
+	struct surf_copy c;
 
-	if (!allocMem(&pMem[surfNum], stride * height))
+	if (!allocMem(pPriv->screen, &pMem[surfNum], stride * height))
 		return BadAlloc;
 
 	DBG("Preparing surface %i, w=%i,stride=%i,height=%i\n", surfNum, width,
 	    stride, height);
-	pvr2dextblt.SrcSurface[surfNum].pSrcMemInfo = pMem[surfNum].pMemInfo;
-	pvr2dextblt.SrcSurface[surfNum].SrcFilterMode = PVR2D_FILTER_LINEAR;
-	pvr2dextblt.SrcSurface[surfNum].SrcRepeatMode = PVR2D_REPEAT_NONE;
-	pvr2dextblt.SrcSurface[surfNum].SrcSurfWidth = width;
-	pvr2dextblt.SrcSurface[surfNum].SrcStride = stride;
-	pvr2dextblt.SrcSurface[surfNum].SrcSurfHeight = height;
+	pvr2dextblt->SrcSurface[surfNum].pSrcMemInfo = pMem[surfNum].pMemInfo;
+	pvr2dextblt->SrcSurface[surfNum].SrcFilterMode = PVR2D_FILTER_LINEAR;
+	pvr2dextblt->SrcSurface[surfNum].SrcRepeatMode = PVR2D_REPEAT_NONE;
+	pvr2dextblt->SrcSurface[surfNum].SrcSurfWidth = width;
+	pvr2dextblt->SrcSurface[surfNum].SrcStride = stride;
+	pvr2dextblt->SrcSurface[surfNum].SrcSurfHeight = height;
 
 	/* this is just a debugging check to see if blits have completed on a
 	 * source surface before we try to populate it with new data
@@ -317,18 +355,14 @@ static int initSrcSurf(int surfNum, unsigned width, unsigned stride,
 		PVR2DQueryBlitsComplete(context, pMem[surfNum].pMemInfo, 1);
 	}
 
-	if (stride == buf_stride)
-		memcpy(pvr2dextblt.SrcSurface[surfNum].pSrcMemInfo->pBase, buf,
-		       stride * height);
-	else {
-		int i;
-		unsigned copy_size = min(stride, buf_stride);
+	c.dst = pvr2dextblt->SrcSurface[surfNum].pSrcMemInfo->pBase;
+	c.src = buf;
+	c.stride = stride;
+	c.buf_stride = buf_stride;
 
-		for (i = 0; i < height; i++)
-			memcpy(pvr2dextblt.SrcSurface[surfNum].pSrcMemInfo->
-			       pBase + i * stride, buf + i * buf_stride,
-			       copy_size);
-	}
+	/* The copy is complete before PVR2DVideoBlt() gets submitted */
+	omap_copy_pool_run(pool, height, 1, stride * height,
+			   copySurfBand, &c);
 
 	return Success;
 }
@@ -346,31 +380,33 @@ static int pvr2DPutImage(ScrnInfoPtr pScrn, short src_x, short src_y,
 	int sgx_pitch_align;
 	int ret;
 	unsigned long *sgx_filtervalues = 0;
+	struct omap_copy_pool *pool = FBDEVPTR(pScrn)->copy_pool;
+	PVR2DEXTBLTINFO *pvr2dextblt = &pPriv->pvr2dextblt;
+	struct _Mem *pMem;
 
-	static int memsetSelector;
-	pMem = MemSet[memsetSelector++];
-	memsetSelector &= 1;
+	pMem = pPriv->MemSet[pPriv->memsetSelector++];
+	pPriv->memsetSelector &= 1;
 
 	DBG("%s(pScrn, %d, %d, %d, %d, %d, %d, %d, %d, %d, %p, %d, %d, %s, %p, %p, %p\n", __func__, src_x, src_y, drw_x, drw_y, src_w, src_h, drw_w, drw_h, id, buf, width, height, Sync ? "TRUE" : "FALSE", clipBoxes, data, pDraw);
 
 	if (!getDrawableInfo
-	    (pDraw, &pvr2dextblt.pDstMemInfo, &pvr2dextblt.DstX,
-	     &pvr2dextblt.DstY))
+	    (pDraw, &pvr2dextblt->pDstMemInfo, &pvr2dextblt->DstX,
+	     &pvr2dextblt->DstY))
 		return BadDrawable;
 
-	if (!GetPVR2DFormat(pDraw->depth, &pvr2dextblt.DstFormat))
+	if (!GetPVR2DFormat(pDraw->depth, &pvr2dextblt->DstFormat))
 		return BadMatch;
 
-	pvr2dextblt.DstX += drw_x;
-	pvr2dextblt.DstY += drw_y;
-	pvr2dextblt.DSizeX = drw_w;
-	pvr2dextblt.DSizeY = drw_h;
+	pvr2dextblt->DstX += drw_x;
+	pvr2dextblt->DstY += drw_y;
+	pvr2dextblt->DSizeX = drw_w;
+	pvr2dextblt->DSizeY = drw_h;
 
 	if (pDraw->type == DRAWABLE_WINDOW)
-		pvr2dextblt.DstStride =
+		pvr2dextblt->DstStride =
 		    pScrn->pScreen->GetWindowPixmap((WindowPtr) pDraw)->devKind;
 	else
-		pvr2dextblt.DstStride = ((PixmapPtr) pDraw)->devKind;
+		pvr2dextblt->DstStride = ((PixmapPtr) pDraw)->devKind;
 
 	sgx_pitch_align = getSGXPitchAlign(width);
 
@@ -378,10 +414,10 @@ static int pvr2DPutImage(ScrnInfoPtr pScrn, short src_x, short src_y,
 	case FOURCC_YUY2:
 	case FOURCC_UYVY:
 		sgx_filtervalues = pPriv->sgx_packed_filtervalues;
-		pvr2dextblt.SrcSurface[0].SrcFormat =
+		pvr2dextblt->SrcSurface[0].SrcFormat =
 		    id == FOURCC_YUY2 ? PVR2D_YUY2 : PVR2D_UYVY;
 		ret =
-		    initSrcSurf(0, width,
+		    initSrcSurf(pPriv, pMem, pool, 0, width,
 				ALIGN(2 * width, sgx_pitch_align),
 				height, buf + src_y * src_w * 2 + src_x * 2,
 				src_w * 2);
@@ -389,14 +425,14 @@ static int pvr2DPutImage(ScrnInfoPtr pScrn, short src_x, short src_y,
 	case FOURCC_YV12:
 	case FOURCC_I420:
 		sgx_filtervalues = pPriv->sgx_planar_filtervalues;
-		pvr2dextblt.SrcSurface[0].SrcFormat =
-		    pvr2dextblt.SrcSurface[1].SrcFormat =
-		    pvr2dextblt.SrcSurface[2].SrcFormat =
+		pvr2dextblt->SrcSurface[0].SrcFormat =
+		    pvr2dextblt->SrcSurface[1].SrcFormat =
+		    pvr2dextblt->SrcSurface[2].SrcFormat =
 		    id == FOURCC_YV12 ? PVR2D_YV12 : PVR2D_I420;
 
 		src_stride = ALIGN(src_w, 4);
 		ret =
-		    initSrcSurf(0, width,
+		    initSrcSurf(pPriv, pMem, pool, 0, width,
 				ALIGN(width, sgx_pitch_align), height,
 				buf + src_y * src_stride + src_x, src_stride);
 		if (ret != Success)
@@ -412,14 +448,14 @@ static int pvr2DPutImage(ScrnInfoPtr pScrn, short src_x, short src_y,
 		src_stride = ALIGN(src_w, 4);
 		tex_stride = ALIGN(width, sgx_pitch_align);
 		ret =
-		    initSrcSurf(1, width, tex_stride, height,
+		    initSrcSurf(pPriv, pMem, pool, 1, width, tex_stride, height,
 				buf + src_y * src_stride + src_x, src_stride);
 		if (ret != Success)
 			break;
 		buf += src_h * src_stride;
 
 		ret =
-		    initSrcSurf(2, width, tex_stride, height,
+		    initSrcSurf(pPriv, pMem, pool, 2, width, tex_stride, height,
 				buf + src_y * src_stride + src_x, src_stride);
 		break;
 	default:
@@ -437,15 +473,162 @@ static int pvr2DPutImage(ScrnInfoPtr pScrn, short src_x, short src_y,
 
 	DamageDamageRegion(pDraw, clipBoxes);
 
-	if (PVR2DVideoBlt(pvr2d_get_screen()->context, &pvr2dextblt, texcoords,
+	if (PVR2DVideoBlt(pPriv->screen->context, pvr2dextblt, texcoords,
 				sgx_filtervalues) != PVR2D_OK)
 		return BadImplementation;
 
 	return Success;
 }
 
+/*
+ * GPU scaled Xv clone (VideoCloneBlit).
+ *
+ * The Xv overlay memory is wrapped once and both of its buffers
+ * are treated as a single surface, the buffer being blitted
+ * is selected with the texture coordinates.
+ */
+void *pvr2dCloneWrap(struct pvr2d_screen *screen, void *mem, unsigned len)
+{
+	PVR2DMEMINFO *meminfo;
+
+	if (PVR2DMemWrap(screen->context, mem,
+			 PVR2D_WRAPFLAG_CONTIGUOUS, len, NULL,
+			 &meminfo) != PVR2D_OK) {
+		ErrorF("%s: Failed to wrap video memory\n", __func__);
+		return NULL;
+	}
+
+	return meminfo;
+}
+
+void pvr2dCloneUnwrap(struct pvr2d_screen *screen, void *src)
+{
+	PVR2DCONTEXTHANDLE context = screen->context;
+
+	if (!src)
+		return;
+
+	PVR2DQueryBlitsComplete(context, src, 1);
+	PVR2DMemFree(context, src);
+}
+
+/* Wait until the GPU is done reading the video memory */
+void pvr2dCloneWaitSrc(struct pvr2d_screen *screen, void *src)
+{
+	PVR2DCONTEXTHANDLE context = screen->context;
+
+	if (src && PVR2DQueryBlitsComplete(context, src, 0) != PVR2D_OK)
+		PVR2DQueryBlitsComplete(context, src, 1);
+}
+
+/* I420 and YV12 are converted to YUY2 when copied into the overlay */
+static Bool cloneSrcFormat(enum omap_format format, PVR2DFORMAT *pvr2d_format)
+{
+	switch (format) {
+	case OMAP_FORMAT_YUY2:
+		*pvr2d_format = PVR2D_YUY2;
+		return TRUE;
+	case OMAP_FORMAT_UYVY:
+		*pvr2d_format = PVR2D_UYVY;
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/* Overlay pitch alignment needed for the overlay to be blitted */
+unsigned pvr2dClonePitchAlign(unsigned width)
+{
+	return getSGXPitchAlign(width);
+}
+
+/* Can a double buffered overlay in this format be blitted? */
+Bool pvr2dCloneCheck(struct pvr2d_screen *screen, enum omap_format format,
+		     unsigned width, unsigned height, unsigned pitch)
+{
+	PVR2DFORMAT pvr2d_format;
+
+	if (!screen->num_clone_bufs)
+		return FALSE;
+
+	if (!cloneSrcFormat(format, &pvr2d_format))
+		return FALSE;
+
+	if (pitch % getSGXPitchAlign(width))
+		return FALSE;
+
+	return PVR2DCheckSizeLimits(width, 2 * height);
+}
+
+/* Is the GPU still rendering into clone buffer idx? */
+Bool pvr2dCloneBusy(struct pvr2d_screen *screen, unsigned idx)
+{
+
+	return PVR2DQueryBlitsComplete(screen->context,
+				       screen->clone_bufs[idx], 0) != PVR2D_OK;
+}
+
+/*
+ * Scales the src_x,src_y,src_w,src_h area of overlay buffer
+ * 'buffer' to the top left dst_w x dst_h corner of clone buffer
+ * 'idx'. Doesn't wait for the blit to finish.
+ */
+Bool pvr2dCloneBlit(ScrnInfoPtr pScrn, void *src, enum omap_format format,
+		    unsigned width, unsigned height, unsigned pitch,
+		    unsigned buffer,
+		    short src_x, short src_y, short src_w, short src_h,
+		    unsigned idx, unsigned dst_w, unsigned dst_h)
+{
+	static pvr2DPortPrivRec clonePriv;
+	static Bool clonePrivInit;
+	struct pvr2d_screen *screen = pvr2d_get_screen(pScrn);
+	PVR2DEXTBLTINFO blt;
+	float texcoords[4];
+	unsigned surf_h = 2 * height;
+
+	if (!src || idx >= screen->num_clone_bufs)
+		return FALSE;
+
+	if (!clonePrivInit) {
+		pvr2DSetupFilterValues(&clonePriv);
+		clonePrivInit = TRUE;
+	}
+
+	memset(&blt, 0, sizeof blt);
+
+	if (!cloneSrcFormat(format, &blt.SrcSurface[0].SrcFormat))
+		return FALSE;
+
+	if (!GetPVR2DFormat(pScrn->bitsPerPixel, &blt.DstFormat))
+		return FALSE;
+
+	blt.SrcSurface[0].pSrcMemInfo = src;
+	blt.SrcSurface[0].SrcFilterMode = PVR2D_FILTER_LINEAR;
+	blt.SrcSurface[0].SrcRepeatMode = PVR2D_REPEAT_NONE;
+	blt.SrcSurface[0].SrcSurfWidth = width;
+	blt.SrcSurface[0].SrcStride = pitch;
+	blt.SrcSurface[0].SrcSurfHeight = surf_h;
+
+	blt.pDstMemInfo = screen->clone_bufs[idx];
+	blt.DstX = 0;
+	blt.DstY = 0;
+	blt.DSizeX = dst_w;
+	blt.DSizeY = dst_h;
+	blt.DstStride = pScrn->displayWidth * pScrn->bitsPerPixel >> 3;
+
+	texcoords[0] = (float)src_x / width;
+	texcoords[1] = (float)(buffer * height + src_y) / surf_h;
+	texcoords[2] = (float)(src_x + src_w) / width;
+	texcoords[3] = (float)(buffer * height + src_y + src_h) / surf_h;
+
+	return PVR2DVideoBlt(screen->context, &blt, texcoords,
+			     clonePriv.sgx_packed_filtervalues) == PVR2D_OK;
+}
+
 XF86VideoAdaptorPtr pvr2dSetupTexturedVideo(ScreenPtr pScreen)
 {
+	struct pvr2d_screen *screen =
+		pvr2d_get_screen(xf86ScreenToScrn(pScreen));
 	XF86VideoAdaptorPtr adapt;
 	pvr2DPortPrivPtr pPriv;
 	int i;
@@ -487,6 +670,7 @@ XF86VideoAdaptorPtr pvr2dSetupTexturedVideo(ScreenPtr pScreen)
 		if (!pPriv)
 			goto out_err;
 
+		pPriv->screen = screen;
 		pvr2DSetupFilterValues(pPriv);
 
 		adapt->pPortPrivates[i].ptr = (pointer) pPriv;
@@ -23,6 +23,24 @@
 #ifndef SGX_XV_H
 #define SGX_XV_H 1
 
+struct pvr2d_screen;
+
 extern XF86VideoAdaptorPtr pvr2dSetupTexturedVideo(ScreenPtr pScreen);
 
+extern void *pvr2dCloneWrap(struct pvr2d_screen *screen,
+			    void *mem, unsigned len);
+extern void pvr2dCloneUnwrap(struct pvr2d_screen *screen, void *src);
+extern void pvr2dCloneWaitSrc(struct pvr2d_screen *screen, void *src);
+extern unsigned pvr2dClonePitchAlign(unsigned width);
+extern Bool pvr2dCloneCheck(struct pvr2d_screen *screen,
+			    enum omap_format format,
+			    unsigned width, unsigned height, unsigned pitch);
+extern Bool pvr2dCloneBusy(struct pvr2d_screen *screen, unsigned idx);
+extern Bool pvr2dCloneBlit(ScrnInfoPtr pScrn, void *src,
+			   enum omap_format format,
+			   unsigned width, unsigned height, unsigned pitch,
+			   unsigned buffer,
+			   short src_x, short src_y, short src_w, short src_h,
+			   unsigned idx, unsigned dst_w, unsigned dst_h);
+
 #endif /* SGX_XV_H */